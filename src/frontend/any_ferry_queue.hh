@@ -0,0 +1,135 @@
+/* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef ANY_FERRY_QUEUE_HH
+#define ANY_FERRY_QUEUE_HH
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <functional>
+
+#include "file_descriptor.hh"
+
+/* holds any of the queues a PacketShell can be instantiated with
+   (DelayQueue, LinkQueue, ...), so the kind of link can be chosen at
+   runtime */
+class AnyFerryQueue
+{
+private:
+    struct Concept
+    {
+        virtual void read_packet( const std::string & contents ) = 0;
+        virtual void write_packets( FileDescriptor & fd ) = 0;
+        virtual void forward_packets( const std::function<void(const std::string &)> & next ) = 0;
+        virtual unsigned int wait_time( void ) = 0;
+        virtual bool pending_output( void ) const = 0;
+        virtual bool finished( void ) const = 0;
+        virtual ~Concept() {}
+    };
+
+    template <class QueueType>
+    struct Model : public Concept
+    {
+        QueueType queue;
+
+        template <typename... Targs>
+        Model( Targs&&... Fargs ) : queue( std::forward<Targs>( Fargs )... ) {}
+
+        void read_packet( const std::string & contents ) override { queue.read_packet( contents ); }
+        void write_packets( FileDescriptor & fd ) override { queue.write_packets( fd ); }
+        void forward_packets( const std::function<void(const std::string &)> & next ) override { queue.forward_packets( next ); }
+        unsigned int wait_time( void ) override { return queue.wait_time(); }
+        bool pending_output( void ) const override { return queue.pending_output(); }
+        bool finished( void ) const override { return queue.finished(); }
+    };
+
+    std::unique_ptr<Concept> queue_;
+
+    AnyFerryQueue( std::unique_ptr<Concept> && queue ) : queue_( std::move( queue ) ) {}
+
+public:
+    /* a queue chosen in one process and made in another (where the
+       function is called) */
+    AnyFerryQueue( const std::function<AnyFerryQueue( void )> & maker ) : AnyFerryQueue( maker() ) {}
+
+    template <class QueueType, typename... Targs>
+    static AnyFerryQueue make( Targs&&... Fargs )
+    {
+        return AnyFerryQueue( std::unique_ptr<Concept>( new Model<QueueType>( std::forward<Targs>( Fargs )... ) ) );
+    }
+
+    void read_packet( const std::string & contents ) { queue_->read_packet( contents ); }
+    void write_packets( FileDescriptor & fd ) { queue_->write_packets( fd ); }
+    void forward_packets( const std::function<void(const std::string &)> & next ) { queue_->forward_packets( next ); }
+    unsigned int wait_time( void ) { return queue_->wait_time(); }
+    bool pending_output( void ) const { return queue_->pending_output(); }
+    bool finished( void ) const { return queue_->finished(); }
+};
+
+/* queues one after another in the same direction, as the shells would be
+   if nested (but all ferried by one event loop): each packet goes
+   through the first, then on to the second as soon as the first lets it
+   go, and so on. Only the last stage writes, so packets move between the
+   others when the event loop asks how long to wait. */
+class FerryQueueSeries
+{
+private:
+    std::vector<AnyFerryQueue> stages_;
+
+    /* move what's ready along, up to (not out of) the last stage */
+    void advance( void )
+    {
+        for ( size_t i = 0; i + 1 < stages_.size(); i++ ) {
+            AnyFerryQueue & next = stages_[ i + 1 ];
+            stages_[ i ].forward_packets( [&] ( const std::string & contents ) { next.read_packet( contents ); } );
+        }
+    }
+
+public:
+    /* (there must be at least one) */
+    FerryQueueSeries( std::vector<AnyFerryQueue> && stages ) : stages_( std::move( stages ) ) {}
+
+    void read_packet( const std::string & contents )
+    {
+        stages_.front().read_packet( contents );
+        advance();
+    }
+
+    void write_packets( FileDescriptor & fd )
+    {
+        advance();
+        stages_.back().write_packets( fd );
+    }
+
+    void forward_packets( const std::function<void(const std::string &)> & next )
+    {
+        advance();
+        stages_.back().forward_packets( next );
+    }
+
+    unsigned int wait_time( void )
+    {
+        advance();
+
+        unsigned int ret = stages_.front().wait_time();
+        for ( auto & stage : stages_ ) {
+            ret = std::min( ret, stage.wait_time() );
+        }
+        return ret;
+    }
+
+    bool pending_output( void ) const { return stages_.back().pending_output(); }
+
+    bool finished( void ) const
+    {
+        for ( const auto & stage : stages_ ) {
+            if ( stage.finished() ) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+#endif /* ANY_FERRY_QUEUE_HH */
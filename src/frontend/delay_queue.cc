@@ -1,37 +1,260 @@
 /* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
 
 #include <limits>
+#include <stdexcept>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
 
 #include "delay_queue.hh"
 #include "timestamp.hh"
+#include "ezio.hh"
+#include "random.hh"
 
 using namespace std;
 
+static vector<string> split_spec( const string & spec )
+{
+    vector<string> ret;
+    istringstream ss( spec );
+    string field;
+    while ( getline( ss, field, ':' ) ) {
+        ret.push_back( field );
+    }
+    return ret;
+}
+
+JitterDistribution::JitterDistribution( const string & spec )
+    : type_(),
+      normal_(),
+      pareto_scale_( 0 ),
+      pareto_shape_( 0 ),
+      cdf_(),
+      uniform_( 0, 1 )
+{
+    const vector<string> fields = split_spec( spec );
+
+    if ( fields.size() == 2 and fields.at( 0 ) == "normal" ) {
+        type_ = Type::Normal;
+        const double stddev = myatof( fields.at( 1 ) );
+        if ( not ( stddev > 0 ) ) {
+            throw runtime_error( "jitter: standard deviation must be positive" );
+        }
+        normal_ = normal_distribution<double>( 0, stddev );
+    } else if ( fields.size() == 3 and fields.at( 0 ) == "pareto" ) {
+        type_ = Type::Pareto;
+        pareto_scale_ = myatof( fields.at( 1 ) );
+        pareto_shape_ = myatof( fields.at( 2 ) );
+        if ( not ( pareto_scale_ > 0 and pareto_shape_ > 0 ) ) {
+            throw runtime_error( "jitter: Pareto scale and shape must be positive" );
+        }
+    } else if ( fields.size() >= 2 and fields.at( 0 ) == "cdf" ) {
+        type_ = Type::Empirical;
+        const string filename = spec.substr( spec.find( ':' ) + 1 );
+
+        ifstream cdf_file( filename );
+        if ( not cdf_file.good() ) {
+            throw runtime_error( filename + ": error opening for reading" );
+        }
+
+        string line;
+        while ( cdf_file.good() and getline( cdf_file, line ) ) {
+            if ( line.empty() or line.front() == '#' ) {
+                continue;
+            }
+
+            istringstream fields_of_line( line );
+            double delay, probability;
+            if ( not ( fields_of_line >> delay >> probability )
+                 or probability < 0 or probability > 1
+                 or ( not cdf_.empty() and ( probability < cdf_.back().first
+                                             or delay < cdf_.back().second ) ) ) {
+                throw runtime_error( filename + ": invalid line (need increasing \"DELAY CUMULATIVE-PROBABILITY\"): " + line );
+            }
+
+            cdf_.emplace_back( probability, delay );
+        }
+
+        if ( cdf_.empty() or cdf_.back().first < 1 - 1e-9 ) {
+            throw runtime_error( filename + ": cumulative probability must reach 1" );
+        }
+    } else {
+        throw runtime_error( "jitter: unknown distribution \"" + spec + "\" (need normal:STDDEV, pareto:SCALE:SHAPE or cdf:FILENAME)" );
+    }
+}
+
+double JitterDistribution::sample( Xoshiro256 & prng )
+{
+    switch ( type_ ) {
+    case Type::Normal:
+        return normal_( prng );
+    case Type::Pareto:
+        return pareto_scale_ * ( pow( 1 - uniform_( prng ), -1 / pareto_shape_ ) - 1 );
+    case Type::Empirical:
+        {
+            /* invert the CDF, interpolating between its points */
+            const double u = uniform_( prng );
+            const auto above = upper_bound( cdf_.begin(), cdf_.end(), u,
+                                            [] ( const double x, const pair<double, double> & point ) {
+                                                return x < point.first; } );
+            if ( above == cdf_.begin() ) {
+                return above->second;
+            } else if ( above == cdf_.end() ) {
+                return cdf_.back().second;
+            }
+
+            const auto below = prev( above );
+            return below->second + ( u - below->first ) / ( above->first - below->first )
+                * ( above->second - below->second );
+        }
+    }
+
+    throw runtime_error( "JitterDistribution: unknown type" );
+}
+
+DelayTrace::DelayTrace( const string & filename, const bool interpolate, const bool loop )
+    : points_(),
+      interpolate_( interpolate ),
+      loop_( loop )
+{
+    ifstream trace_file( filename );
+
+    if ( not trace_file.good() ) {
+        throw runtime_error( filename + ": error opening for reading" );
+    }
+
+    string line;
+
+    while ( trace_file.good() and getline( trace_file, line ) ) {
+        if ( line.empty() or line.front() == '#' ) {
+            continue;
+        }
+
+        istringstream fields( line );
+        uint64_t ms;
+        double delay;
+        if ( not ( fields >> ms >> delay ) or delay < 0 ) {
+            throw runtime_error( filename + ": invalid line (need \"TIME DELAY\"): " + line );
+        }
+
+        if ( not points_.empty() and ms < points_.back().first ) {
+            throw runtime_error( filename + ": timestamps must be monotonically nondecreasing" );
+        }
+
+        points_.emplace_back( ms, delay );
+    }
+
+    if ( points_.empty() ) {
+        throw runtime_error( filename + ": no valid delays found" );
+    }
+
+    if ( loop_ and points_.back().first == 0 ) {
+        throw runtime_error( filename + ": trace must last for a nonzero amount of time" );
+    }
+}
+
+double DelayTrace::delay_at( const uint64_t time, size_t & index, uint64_t & base_time ) const
+{
+    uint64_t elapsed = time - base_time;
+
+    if ( loop_ ) {
+        const uint64_t period = points_.back().first;
+        if ( elapsed >= period ) {
+            base_time += elapsed - elapsed % period;
+            elapsed %= period;
+            index = 0;
+        }
+    }
+
+    while ( index + 1 < points_.size() and points_.at( index + 1 ).first <= elapsed ) {
+        index++;
+    }
+
+    const auto & point = points_.at( index );
+    if ( elapsed <= point.first or index + 1 == points_.size() or not interpolate_ ) {
+        return point.second;
+    }
+
+    const auto & next = points_.at( index + 1 );
+    return point.second + ( next.second - point.second )
+        * double( elapsed - point.first ) / double( next.first - point.first );
+}
+
+DelayQueue::DelayQueue( const uint64_t & s_delay_ms,
+                        const string & jitter,
+                        const bool in_order,
+                        const double reorder_probability,
+                        const shared_ptr<const DelayTrace> & delay_trace )
+    : delay_ms_( s_delay_ms ),
+      delay_trace_( delay_trace ),
+      trace_index_( 0 ),
+      trace_base_time_( timestamp() ),
+      jitter_( jitter.empty() ? nullptr : new JitterDistribution( jitter ) ),
+      in_order_( in_order ),
+      reorder_(),
+      prng_( Random::stream( "jitter" ) ),
+      last_release_time_( 0 ),
+      packets_( timestamp() )
+{
+    if ( not ( (0 <= reorder_probability) and (reorder_probability <= 1) ) ) {
+        throw runtime_error( "reorder probability must be between 0 and 1" );
+    }
+    reorder_ = bernoulli_distribution( reorder_probability );
+}
+
+uint64_t DelayQueue::release_time( const uint64_t now )
+{
+    /* sent on at once, ahead of the packets in flight */
+    if ( reorder_.p() > 0 and reorder_( prng_ ) ) {
+        return now;
+    }
+
+    double delay = delay_trace_
+        ? delay_trace_->delay_at( now, trace_index_, trace_base_time_ )
+        : delay_ms_;
+    if ( jitter_ ) {
+        delay = max( 0.0, delay + jitter_->sample( prng_ ) );
+    }
+
+    uint64_t release = now + uint64_t( round( delay ) );
+
+    /* no earlier than the packet before */
+    if ( in_order_ ) {
+        release = max( release, last_release_time_ );
+        last_release_time_ = release;
+    }
+
+    return release;
+}
+
 void DelayQueue::read_packet( const string & contents )
 {
-    packet_queue_.emplace( timestamp() + delay_ms_, contents );
+    packets_.insert( release_time( timestamp() ), string( contents ) );
 }
 
 void DelayQueue::write_packets( FileDescriptor & fd )
 {
-    while ( (!packet_queue_.empty())
-            && (packet_queue_.front().first <= timestamp()) ) {
-        fd.write( packet_queue_.front().second );
-        packet_queue_.pop();
-    }
+    packets_.release( timestamp(), [&] ( const string & contents ) { fd.write( contents ); } );
+}
+
+void DelayQueue::forward_packets( const function<void(const string &)> & next )
+{
+    packets_.release( timestamp(), next );
 }
 
 unsigned int DelayQueue::wait_time( void ) const
 {
-    if ( packet_queue_.empty() ) {
+    if ( packets_.empty() ) {
         return numeric_limits<uint16_t>::max();
     }
 
     const auto now = timestamp();
+    const uint64_t next_release = packets_.next_release_time();
 
-    if ( packet_queue_.front().first <= now ) {
+    if ( next_release <= now ) {
         return 0;
     } else {
-        return packet_queue_.front().first - now;
+        return min( next_release - now, uint64_t( numeric_limits<uint16_t>::max() ) );
     }
 }
@@ -3,26 +3,96 @@
 #ifndef DELAY_QUEUE_HH
 #define DELAY_QUEUE_HH
 
-#include <queue>
+#include <vector>
 #include <cstdint>
 #include <string>
+#include <random>
+#include <memory>
+#include <functional>
 
 #include "file_descriptor.hh"
+#include "timing_wheel.hh"
+#include "xoshiro.hh"
+
+/* extra delay (in ms) added to each packet, from a spec of
+   normal:STDDEV         zero-mean normal,
+   pareto:SCALE:SHAPE    Pareto, shifted to start at zero, or
+   cdf:FILENAME          an empirical distribution, given as lines of
+                         "DELAY CUMULATIVE-PROBABILITY" */
+class JitterDistribution
+{
+private:
+    enum class Type { Normal, Pareto, Empirical } type_;
+
+    std::normal_distribution<double> normal_;
+    double pareto_scale_, pareto_shape_;
+    std::vector<std::pair<double, double>> cdf_; /* cumulative probability, delay */
+    std::uniform_real_distribution<double> uniform_;
+
+public:
+    JitterDistribution( const std::string & spec );
+
+    /* may be negative */
+    double sample( Xoshiro256 & prng );
+};
+
+/* a delay (in ms) that changes over time, from a file of lines
+   "TIME DELAY" (TIME in ms from the start, nondecreasing), either
+   interpolated between the lines or held until the next one; a looping
+   trace starts again at its last TIME */
+class DelayTrace
+{
+private:
+    std::vector<std::pair<uint64_t, double>> points_; /* time, delay */
+    bool interpolate_;
+    bool loop_;
+
+public:
+    DelayTrace( const std::string & filename, const bool interpolate, const bool loop );
+
+    /* the delay a time after the start, moving the caller's cursor (an
+       index into the trace and the time its turn began) forward; the
+       times asked for must not decrease */
+    double delay_at( const uint64_t time, size_t & index, uint64_t & base_time ) const;
+};
 
 class DelayQueue
 {
 private:
     uint64_t delay_ms_;
-    std::queue< std::pair<uint64_t, std::string> > packet_queue_;
-    /* release timestamp, contents */
+
+    /* (shared with the other direction's queue, when given) */
+    std::shared_ptr<const DelayTrace> delay_trace_;
+    size_t trace_index_;
+    uint64_t trace_base_time_;
+
+    std::unique_ptr<JitterDistribution> jitter_;
+    bool in_order_;
+    std::bernoulli_distribution reorder_;
+    Xoshiro256 prng_;
+
+    uint64_t last_release_time_;
+    TimingWheel packets_;
+
+    uint64_t release_time( const uint64_t now );
 
 public:
-    DelayQueue( const uint64_t & s_delay_ms ) : delay_ms_( s_delay_ms ), packet_queue_() {}
+    /* with jitter, packets may overtake each other unless in_order is set;
+       with reorder_probability, that fraction is sent on at once; a delay
+       trace replaces the fixed delay */
+    DelayQueue( const uint64_t & s_delay_ms,
+                const std::string & jitter = "",
+                const bool in_order = false,
+                const double reorder_probability = 0,
+                const std::shared_ptr<const DelayTrace> & delay_trace = nullptr );
 
     void read_packet( const std::string & contents );
 
     void write_packets( FileDescriptor & fd );
 
+    /* hand the packets that are due to the next stage instead */
+    void forward_packets( const std::function<void(const std::string &)> & next );
+
     unsigned int wait_time( void ) const;
 
     bool pending_output( void ) const { return wait_time() <= 0; }
@@ -3,17 +3,38 @@
 #include <vector>
 #include <string>
 
+#include <getopt.h>
+
 #include "delay_queue.hh"
 #include "util.hh"
 #include "ezio.hh"
+#include "random.hh"
 #include "packetshell.cc"
 
 using namespace std;
 
+void usage_error( const string & program_name )
+{
+    cerr << "Usage: " << program_name << " [OPTION]... DELAY-MS [COMMAND...]" << endl;
+    cerr << "       " << program_name << " --delay-trace=FILENAME [OPTION]... [COMMAND...]" << endl;
+    cerr << endl;
+    cerr << "Options = --jitter=normal:STDDEV | pareto:SCALE:SHAPE | cdf:FILENAME" << endl;
+    cerr << "          --in-order --reorder=PROBABILITY --seed=N" << endl;
+    cerr << "          --step --once (with --delay-trace)" << endl;
+    cerr << "              (jitter is added to the delay, in ms; with --in-order, no packet overtakes" << endl;
+    cerr << "               another; --reorder sends that fraction of packets on without delay)" << endl;
+    cerr << "              (a delay trace has lines \"TIME-MS DELAY-MS\", interpolated unless --step," << endl;
+    cerr << "               and repeated unless --once)" << endl << endl;
+
+    throw runtime_error( "invalid arguments" );
+}
+
 int main( int argc, char *argv[] )
 {
     try {
         const bool passthrough_until_signal = getenv( "MAHIMAHI_PASSTHROUGH_UNTIL_SIGNAL" );
+        SetupTrace::enable( "mm-delay" );
+        Random::initialize();
 
         /* clear environment while running as root */
         char ** const user_environment = environ;
@@ -21,28 +42,107 @@ int main( int argc, char *argv[] )
 
         check_requirements( argc, argv );
 
-        if ( argc < 2 ) {
-            throw runtime_error( "Usage: " + string( argv[ 0 ] ) + " delay-milliseconds [command...]" );
+        const option command_line_options[] = {
+            { "jitter",       required_argument, nullptr, 'j' },
+            { "in-order",           no_argument, nullptr, 'i' },
+            { "reorder",      required_argument, nullptr, 'r' },
+            { "delay-trace",  required_argument, nullptr, 't' },
+            { "step",               no_argument, nullptr, 's' },
+            { "once",               no_argument, nullptr, 'o' },
+            { "seed",         required_argument, nullptr, 'S' },
+            { 0,                              0, nullptr, 0 }
+        };
+
+        string jitter, delay_trace_filename;
+        bool in_order = false, interpolate = true, repeat = true;
+        double reorder_probability = 0;
+
+        while ( true ) {
+            /* (options come before the delay; the command's own are left alone) */
+            const int opt = getopt_long( argc, argv, "+", command_line_options, nullptr );
+            if ( opt == -1 ) { /* end of options */
+                break;
+            }
+
+            switch ( opt ) {
+            case 'j':
+                jitter = optarg;
+                break;
+            case 'i':
+                in_order = true;
+                break;
+            case 'r':
+                reorder_probability = myatof( optarg );
+                break;
+            case 't':
+                delay_trace_filename = optarg;
+                break;
+            case 's':
+                interpolate = false;
+                break;
+            case 'o':
+                repeat = false;
+                break;
+            case 'S':
+                Random::set_seed( optarg );
+                break;
+            case '?':
+                usage_error( argv[ 0 ] );
+                break;
+            default:
+                throw runtime_error( "getopt_long: unexpected return value " + to_string( opt ) );
+            }
+        }
+
+        /* (with a delay trace, there is no fixed delay) */
+        const bool fixed_delay = delay_trace_filename.empty();
+        if ( fixed_delay and optind >= argc ) {
+            usage_error( argv[ 0 ] );
         }
 
-        const uint64_t delay_ms = myatoi( argv[ 1 ] );
+        const uint64_t delay_ms = fixed_delay ? myatoi( argv[ optind++ ] ) : 0;
 
         vector< string > command;
 
-        if ( argc == 2 ) {
+        if ( optind == argc ) {
             command.push_back( shell_path() );
         } else {
-            for ( int i = 2; i < argc; i++ ) {
+            for ( int i = optind; i < argc; i++ ) {
                 command.push_back( argv[ i ] );
             }
         }
 
+        /* read the user's files here, once, for the queues in each direction */
+        shared_ptr<const DelayTrace> delay_trace;
+        {
+            TemporarilyUnprivileged tu;
+
+            if ( not fixed_delay ) {
+                delay_trace = make_shared<const DelayTrace>( delay_trace_filename, interpolate, repeat );
+            }
+
+            if ( not jitter.empty() ) {
+                JitterDistribution check_jitter( jitter );
+            }
+        }
+
+        if ( not ( (0 <= reorder_probability) and (reorder_probability <= 1) ) ) {
+            throw runtime_error( "reorder probability must be between 0 and 1" );
+        }
+
+        string prefix = fixed_delay
+            ? "[delay " + to_string( delay_ms ) + " ms"
+            : "[delay " + delay_trace_filename;
+        if ( not jitter.empty() ) {
+            prefix += ", jitter " + jitter;
+        }
+        prefix += "] ";
+
         PacketShell<DelayQueue> delay_shell_app( "delay", user_environment, passthrough_until_signal );
 
-        delay_shell_app.start_uplink( "[delay " + to_string( delay_ms ) + " ms] ",
-                                      command,
-                                      delay_ms );
-        delay_shell_app.start_downlink( delay_ms );
+        delay_shell_app.start_uplink( prefix, command,
+                                      delay_ms, jitter, in_order, reorder_probability, delay_trace );
+        delay_shell_app.start_downlink( delay_ms, jitter, in_order, reorder_probability, delay_trace );
         return delay_shell_app.wait_for_exit();
     } catch ( const exception & e ) {
         print_exception( e );
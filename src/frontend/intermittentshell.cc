@@ -22,6 +22,7 @@ int main( int argc, char *argv[] )
 {
     try {
         const bool passthrough_until_signal = getenv( "MAHIMAHI_PASSTHROUGH_UNTIL_SIGNAL" );
+        SetupTrace::enable( "mm-intermittent" );
 
         /* clear environment while running as root */
         char ** const user_environment = environ;
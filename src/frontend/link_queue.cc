@@ -2,29 +2,44 @@
 
 #include <limits>
 #include <cassert>
+#include <algorithm>
+#include <sstream>
 
 #include "link_queue.hh"
 #include "timestamp.hh"
 #include "util.hh"
 #include "ezio.hh"
+#include "random.hh"
 #include "abstract_packet_queue.hh"
+#include "infinite_packet_queue.hh"
+#include "drop_tail_packet_queue.hh"
+#include "drop_head_packet_queue.hh"
+#include "codel_packet_queue.hh"
+#include "pie_packet_queue.hh"
+#include "l4s_packet_queue.hh"
 
 using namespace std;
 
-LinkQueue::LinkQueue( const string & link_name, const string & filename, const string & logfile,
-                      const bool repeat, const bool graph_throughput, const bool graph_delay,
-                      unique_ptr<AbstractPacketQueue> && packet_queue,
-                      const string & command_line )
+template <class PacketQueueType>
+LinkQueue<PacketQueueType>::LinkQueue( const string & link_name, const string & filename, const string & logfile,
+                                       const bool repeat, const bool graph_throughput, const bool graph_delay,
+                                       const GraphOutput & graph_output,
+                                       const string & packet_queue_args,
+                                       const string & command_line )
     : next_delivery_( 0 ),
       schedule_(),
       base_timestamp_( timestamp() ),
-      packet_queue_( move( packet_queue ) ),
+      packet_queue_( packet_queue_args ),
       packet_in_transit_( "", 0 ),
       packet_in_transit_bytes_left_( 0 ),
       output_queue_(),
       log_(),
       throughput_graph_( nullptr ),
       delay_graph_( nullptr ),
+      logged_dropped_packets_( 0 ),
+      logged_dropped_bytes_( 0 ),
+      logged_marked_packets_( 0 ),
+      logged_marked_bytes_( 0 ),
       repeat_( repeat ),
       finished_( false )
 {
@@ -44,22 +59,51 @@ LinkQueue::LinkQueue( const string & link_name, const string & filename, const s
             throw runtime_error( filename + ": invalid empty line" );
         }
 
-        const uint64_t ms = myatoi( line );
+        /* "TIME", or "TIME BYTES [PACKETS]" for an aggregate */
+        istringstream fields( line );
+        string ms_field, bytes_field, packets_field, extra_field;
+        fields >> ms_field >> bytes_field >> packets_field >> extra_field;
+
+        if ( ms_field.empty() or not extra_field.empty() ) {
+            throw runtime_error( filename + ": invalid line (need \"TIME [BYTES [PACKETS]]\"): " + line );
+        }
+
+        const uint64_t ms = myatoi( ms_field );
 
         if ( not schedule_.empty() ) {
-            if ( ms < schedule_.back() ) {
+            if ( ms < schedule_.back().time ) {
                 throw runtime_error( filename + ": timestamps must be monotonically nondecreasing" );
             }
         }
 
-        schedule_.emplace_back( ms );
+        DeliveryOpportunity opportunity = { ms, PACKET_SIZE, numeric_limits<unsigned int>::max(), false };
+
+        if ( not bytes_field.empty() ) {
+            const long int bytes = myatoi( bytes_field );
+            if ( bytes <= 0 ) {
+                throw runtime_error( filename + ": an aggregate must carry at least one byte: " + line );
+            }
+            opportunity.bytes = min( bytes, long( numeric_limits<unsigned int>::max() ) );
+
+            if ( not packets_field.empty() ) {
+                const long int max_packets = myatoi( packets_field );
+                if ( max_packets <= 0 ) {
+                    throw runtime_error( filename + ": an aggregate must carry at least one packet: " + line );
+                }
+                opportunity.max_packets = min( max_packets, long( numeric_limits<unsigned int>::max() ) );
+            }
+
+            opportunity.aggregate = true;
+        }
+
+        schedule_.push_back( opportunity );
     }
 
     if ( schedule_.empty() ) {
         throw runtime_error( filename + ": no valid timestamps found" );
     }
 
-    if ( schedule_.back() == 0 ) {
+    if ( schedule_.back().time == 0 ) {
         throw runtime_error( filename + ": trace must last for a nonzero amount of time" );
     }
 
@@ -72,16 +116,20 @@ LinkQueue::LinkQueue( const string & link_name, const string & filename, const s
 
         *log_ << "# mahimahi mm-link (" << link_name << ") [" << filename << "] > " << logfile << endl;
         *log_ << "# command line: " << command_line << endl;
-        *log_ << "# queue: " << packet_queue_->to_string() << endl;
+        *log_ << "# queue: " << packet_queue_.to_string() << endl;
         *log_ << "# init timestamp: " << initial_timestamp() << endl;
         *log_ << "# base timestamp: " << base_timestamp_ << endl;
+        *log_ << "# random seed: " << Random::seed() << endl;
         const char * prefix = getenv( "MAHIMAHI_SHELL_PREFIX" );
         if ( prefix ) {
             *log_ << "# mahimahi config: " << prefix << endl;
         }
     }
 
-    /* create graphs if called for */
+    /* create graphs if called for (named, as files, after the direction) */
+    string file_name = link_name;
+    transform( file_name.begin(), file_name.end(), file_name.begin(), ::tolower );
+
     if ( graph_throughput ) {
         throughput_graph_.reset( new BinnedLiveGraph( link_name + " [" + filename + "]",
                                                       { make_tuple( 1.0, 0.0, 0.0, 0.25, true ),
@@ -91,7 +139,9 @@ LinkQueue::LinkQueue( const string & link_name, const string & filename, const s
                                                       8.0 / 1000000.0,
                                                       true,
                                                       500,
-                                                      [] ( int, int & x ) { x = 0; } ) );
+                                                      [] ( int, int & x ) { x = 0; },
+                                                      graph_output, file_name,
+                                                      { "capacity", "arrivals", "departures" } ) );
     }
 
     if ( graph_delay ) {
@@ -99,11 +149,14 @@ LinkQueue::LinkQueue( const string & link_name, const string & filename, const s
                                                  { make_tuple( 0.0, 0.25, 0.0, 1.0, false ) },
                                                  "queueing delay (ms)",
                                                  1, false, 250,
-                                                 [] ( int, int & x ) { x = -1; } ) );
+                                                 [] ( int, int & x ) { x = -1; },
+                                                 graph_output, file_name + "-delay",
+                                                 { "queueing delay" } ) );
     }
 }
 
-void LinkQueue::record_arrival( const uint64_t arrival_time, const size_t pkt_size )
+template <class PacketQueueType>
+void LinkQueue<PacketQueueType>::record_arrival( const uint64_t arrival_time, const size_t pkt_size )
 {
     /* log it */
     if ( log_ ) {
@@ -112,11 +165,12 @@ void LinkQueue::record_arrival( const uint64_t arrival_time, const size_t pkt_si
 
     /* meter it */
     if ( throughput_graph_ ) {
-        throughput_graph_->add_value_now( 1, pkt_size );
+        throughput_graph_->add_value( 1, pkt_size, arrival_time );
     }
 }
 
-void LinkQueue::record_drop( const uint64_t time, const size_t pkts_dropped, const size_t bytes_dropped)
+template <class PacketQueueType>
+void LinkQueue<PacketQueueType>::record_drop( const uint64_t time, const size_t pkts_dropped, const size_t bytes_dropped)
 {
     /* log it */
     if ( log_ ) {
@@ -124,20 +178,52 @@ void LinkQueue::record_drop( const uint64_t time, const size_t pkts_dropped, con
     }
 }
 
-void LinkQueue::record_departure_opportunity( void )
+template <class PacketQueueType>
+void LinkQueue<PacketQueueType>::record_mark( const uint64_t time, const size_t pkts_marked, const size_t bytes_marked )
+{
+    /* log it */
+    if ( log_ ) {
+        *log_ << time << " m " << pkts_marked << " " << bytes_marked << endl;
+    }
+}
+
+/* log whatever the queue has dropped or marked since last time */
+template <class PacketQueueType>
+void LinkQueue<PacketQueueType>::record_queue_events( const uint64_t time )
+{
+    if ( packet_queue_.dropped_packets() != logged_dropped_packets_ ) {
+        record_drop( time, packet_queue_.dropped_packets() - logged_dropped_packets_,
+                     packet_queue_.dropped_bytes() - logged_dropped_bytes_ );
+        logged_dropped_packets_ = packet_queue_.dropped_packets();
+        logged_dropped_bytes_ = packet_queue_.dropped_bytes();
+    }
+
+    if ( packet_queue_.marked_packets() != logged_marked_packets_ ) {
+        record_mark( time, packet_queue_.marked_packets() - logged_marked_packets_,
+                     packet_queue_.marked_bytes() - logged_marked_bytes_ );
+        logged_marked_packets_ = packet_queue_.marked_packets();
+        logged_marked_bytes_ = packet_queue_.marked_bytes();
+    }
+}
+
+template <class PacketQueueType>
+void LinkQueue<PacketQueueType>::record_departure_opportunity( void )
 {
+    const unsigned int bytes = schedule_.at( next_delivery_ ).bytes;
+
     /* log the delivery opportunity */
     if ( log_ ) {
-        *log_ << next_delivery_time() << " # " << PACKET_SIZE << endl;
+        *log_ << next_delivery_time() << " # " << bytes << endl;
     }
 
     /* meter the delivery opportunity */
     if ( throughput_graph_ ) {
-        throughput_graph_->add_value_now( 0, PACKET_SIZE );
+        throughput_graph_->add_value( 0, bytes, next_delivery_time() );
     }    
 }
 
-void LinkQueue::record_departure( const uint64_t departure_time, const QueuedPacket & packet )
+template <class PacketQueueType>
+void LinkQueue<PacketQueueType>::record_departure( const uint64_t departure_time, const QueuedPacket & packet )
 {
     /* log the delivery */
     if ( log_ ) {
@@ -147,15 +233,16 @@ void LinkQueue::record_departure( const uint64_t departure_time, const QueuedPac
 
     /* meter the delivery */
     if ( throughput_graph_ ) {
-        throughput_graph_->add_value_now( 2, packet.contents.size() );
+        throughput_graph_->add_value( 2, packet.contents.size(), departure_time );
     }
 
     if ( delay_graph_ ) {
-        delay_graph_->set_max_value_now( 0, departure_time - packet.arrival_time );
+        delay_graph_->set_max_value( 0, departure_time - packet.arrival_time, departure_time );
     }    
 }
 
-void LinkQueue::read_packet( const string & contents )
+template <class PacketQueueType>
+void LinkQueue<PacketQueueType>::read_packet( const string & contents )
 {
     const uint64_t now = timestamp();
 
@@ -167,31 +254,23 @@ void LinkQueue::read_packet( const string & contents )
 
     record_arrival( now, contents.size() );
 
-    unsigned int bytes_before = packet_queue_->size_bytes();
-    unsigned int packets_before = packet_queue_->size_packets();
-
-    packet_queue_->enqueue( QueuedPacket( contents, now ) );
+    packet_queue_.enqueue( QueuedPacket( contents, now ) );
 
-    assert( packet_queue_->size_packets() <= packets_before + 1 );
-    assert( packet_queue_->size_bytes() <= bytes_before + contents.size() );
-    
-    unsigned int missing_packets = packets_before + 1 - packet_queue_->size_packets();
-    unsigned int missing_bytes = bytes_before + contents.size() - packet_queue_->size_bytes();
-    if ( missing_packets > 0 || missing_bytes > 0 ) {
-        record_drop( now, missing_packets, missing_bytes );
-    }
+    record_queue_events( now );
 }
 
-uint64_t LinkQueue::next_delivery_time( void ) const
+template <class PacketQueueType>
+uint64_t LinkQueue<PacketQueueType>::next_delivery_time( void ) const
 {
     if ( finished_ ) {
         return -1;
     } else {
-        return schedule_.at( next_delivery_ ) + base_timestamp_;
+        return schedule_.at( next_delivery_ ).time + base_timestamp_;
     }
 }
 
-void LinkQueue::use_a_delivery_opportunity( void )
+template <class PacketQueueType>
+void LinkQueue<PacketQueueType>::use_a_delivery_opportunity( void )
 {
     record_departure_opportunity();
 
@@ -200,7 +279,7 @@ void LinkQueue::use_a_delivery_opportunity( void )
     /* wraparound */
     if ( next_delivery_ == 0 ) {
         if ( repeat_ ) {
-            base_timestamp_ += schedule_.back();
+            base_timestamp_ += schedule_.back().time;
         } else {
             finished_ = true;
         }
@@ -210,22 +289,35 @@ void LinkQueue::use_a_delivery_opportunity( void )
 /* emulate the link up to the given timestamp */
 /* this function should be called before enqueueing any packets and before
    calculating the wait_time until the next event */
-void LinkQueue::rationalize( const uint64_t now )
+template <class PacketQueueType>
+void LinkQueue<PacketQueueType>::rationalize( const uint64_t now )
 {
     while ( next_delivery_time() <= now ) {
         const uint64_t this_delivery_time = next_delivery_time();
+        const DeliveryOpportunity opportunity = schedule_.at( next_delivery_ );
 
         /* burn a delivery opportunity */
-        unsigned int bytes_left_in_this_delivery = PACKET_SIZE;
+        unsigned int bytes_left_in_this_delivery = opportunity.bytes;
+        unsigned int packets_in_this_delivery = 0;
         use_a_delivery_opportunity();
 
         while ( bytes_left_in_this_delivery > 0 ) {
             if ( not packet_in_transit_bytes_left_ ) {
-                if ( packet_queue_->empty() ) {
+                if ( packet_queue_.empty() or packets_in_this_delivery == opportunity.max_packets ) {
                     break;
                 }
-                packet_in_transit_ = packet_queue_->dequeue();
+                packet_in_transit_ = packet_queue_.dequeue();
                 packet_in_transit_bytes_left_ = packet_in_transit_.contents.size();
+
+                record_queue_events( this_delivery_time );
+            }
+
+            /* a packet that won't fit in the rest of an aggregate waits for
+               the next opportunity (one too big for a whole aggregate is
+               spread over several, as on a plain link) */
+            if ( opportunity.aggregate and packets_in_this_delivery > 0
+                 and packet_in_transit_bytes_left_ > bytes_left_in_this_delivery ) {
+                break;
             }
 
             assert( packet_in_transit_.arrival_time <= this_delivery_time );
@@ -243,6 +335,7 @@ void LinkQueue::rationalize( const uint64_t now )
 
             /* has the packet been fully sent? */
             if ( packet_in_transit_bytes_left_ == 0 ) {
+                packets_in_this_delivery++;
                 record_departure( this_delivery_time, packet_in_transit_ );
 
                 /* this packet is ready to go */
@@ -252,7 +345,8 @@ void LinkQueue::rationalize( const uint64_t now )
     }
 }
 
-void LinkQueue::write_packets( FileDescriptor & fd )
+template <class PacketQueueType>
+void LinkQueue<PacketQueueType>::write_packets( FileDescriptor & fd )
 {
     while ( not output_queue_.empty() ) {
         fd.write( output_queue_.front() );
@@ -260,7 +354,17 @@ void LinkQueue::write_packets( FileDescriptor & fd )
     }
 }
 
-unsigned int LinkQueue::wait_time( void )
+template <class PacketQueueType>
+void LinkQueue<PacketQueueType>::forward_packets( const function<void(const string &)> & next )
+{
+    while ( not output_queue_.empty() ) {
+        next( output_queue_.front() );
+        output_queue_.pop();
+    }
+}
+
+template <class PacketQueueType>
+unsigned int LinkQueue<PacketQueueType>::wait_time( void )
 {
     const auto now = timestamp();
 
@@ -273,7 +377,56 @@ unsigned int LinkQueue::wait_time( void )
     }
 }
 
-bool LinkQueue::pending_output( void ) const
+template <class PacketQueueType>
+bool LinkQueue<PacketQueueType>::pending_output( void ) const
 {
     return not output_queue_.empty();
 }
+
+unique_ptr<AbstractPacketQueue> make_packet_queue( const string & type, const string & args )
+{
+    if ( type == "infinite" ) {
+        return unique_ptr<AbstractPacketQueue>( new InfinitePacketQueue( args ) );
+    } else if ( type == "droptail" ) {
+        return unique_ptr<AbstractPacketQueue>( new DropTailPacketQueue( args ) );
+    } else if ( type == "drophead" ) {
+        return unique_ptr<AbstractPacketQueue>( new DropHeadPacketQueue( args ) );
+    } else if ( type == "codel" ) {
+        return unique_ptr<AbstractPacketQueue>( new CODELPacketQueue( args ) );
+    } else if ( type == "pie" ) {
+        return unique_ptr<AbstractPacketQueue>( new PIEPacketQueue( args ) );
+    } else if ( type == "l4s" ) {
+        return unique_ptr<AbstractPacketQueue>( new L4SPacketQueue( args ) );
+    }
+
+    return nullptr;
+}
+
+AnyFerryQueue make_link_queue( const string & packet_queue_type, const string & packet_queue_args,
+                               const string & link_name, const string & filename, const string & logfile,
+                               const bool repeat, const bool graph_throughput, const bool graph_delay,
+                               const GraphOutput & graph_output,
+                               const string & command_line )
+{
+    if ( packet_queue_type == "infinite" ) {
+        return AnyFerryQueue::make<LinkQueue<InfinitePacketQueue>>( link_name, filename, logfile, repeat, graph_throughput, graph_delay,
+                                                                    graph_output, packet_queue_args, command_line );
+    } else if ( packet_queue_type == "droptail" ) {
+        return AnyFerryQueue::make<LinkQueue<DropTailPacketQueue>>( link_name, filename, logfile, repeat, graph_throughput, graph_delay,
+                                                                    graph_output, packet_queue_args, command_line );
+    } else if ( packet_queue_type == "drophead" ) {
+        return AnyFerryQueue::make<LinkQueue<DropHeadPacketQueue>>( link_name, filename, logfile, repeat, graph_throughput, graph_delay,
+                                                                    graph_output, packet_queue_args, command_line );
+    } else if ( packet_queue_type == "codel" ) {
+        return AnyFerryQueue::make<LinkQueue<CODELPacketQueue>>( link_name, filename, logfile, repeat, graph_throughput, graph_delay,
+                                                                 graph_output, packet_queue_args, command_line );
+    } else if ( packet_queue_type == "pie" ) {
+        return AnyFerryQueue::make<LinkQueue<PIEPacketQueue>>( link_name, filename, logfile, repeat, graph_throughput, graph_delay,
+                                                               graph_output, packet_queue_args, command_line );
+    } else if ( packet_queue_type == "l4s" ) {
+        return AnyFerryQueue::make<LinkQueue<L4SPacketQueue>>( link_name, filename, logfile, repeat, graph_throughput, graph_delay,
+                                                               graph_output, packet_queue_args, command_line );
+    } else {
+        throw runtime_error( "Unknown queue type: " + packet_queue_type );
+    }
+}
@@ -12,17 +12,34 @@
 #include "file_descriptor.hh"
 #include "binned_livegraph.hh"
 #include "abstract_packet_queue.hh"
+#include "any_ferry_queue.hh"
 
+/* a link whose packets wait in a queue of the given type
+   (DropTailPacketQueue, CODELPacketQueue...), called directly rather
+   than through AbstractPacketQueue so that its operations inline */
+template <class PacketQueueType>
 class LinkQueue
 {
 private:
     const static unsigned int PACKET_SIZE = 1504; /* default max TUN payload size */
 
+    /* a time the link can deliver some bytes: a plain opportunity carries
+       PACKET_SIZE of them, and a packet may be spread over several; an
+       aggregate (like an 802.11 A-MPDU) carries whole packets, up to a
+       budget of bytes and a number of packets, which leave together */
+    struct DeliveryOpportunity
+    {
+        uint64_t time;
+        unsigned int bytes;
+        unsigned int max_packets;
+        bool aggregate;
+    };
+
     unsigned int next_delivery_;
-    std::vector<uint64_t> schedule_;
+    std::vector<DeliveryOpportunity> schedule_;
     uint64_t base_timestamp_;
 
-    std::unique_ptr<AbstractPacketQueue> packet_queue_;
+    PacketQueueType packet_queue_;
     QueuedPacket packet_in_transit_;
     unsigned int packet_in_transit_bytes_left_;
     std::queue<std::string> output_queue_;
@@ -31,6 +48,10 @@ private:
     std::unique_ptr<BinnedLiveGraph> throughput_graph_;
     std::unique_ptr<BinnedLiveGraph> delay_graph_;
 
+    /* the queue's counts of drops and marks, as logged so far */
+    unsigned int logged_dropped_packets_, logged_dropped_bytes_;
+    unsigned int logged_marked_packets_, logged_marked_bytes_;
+
     bool repeat_;
     bool finished_;
 
@@ -40,6 +61,8 @@ private:
 
     void record_arrival( const uint64_t arrival_time, const size_t pkt_size );
     void record_drop( const uint64_t time, const size_t pkts_dropped, const size_t bytes_dropped );
+    void record_mark( const uint64_t time, const size_t pkts_marked, const size_t bytes_marked );
+    void record_queue_events( const uint64_t time );
     void record_departure_opportunity( void );
     void record_departure( const uint64_t departure_time, const QueuedPacket & packet );
 
@@ -49,13 +72,17 @@ private:
 public:
     LinkQueue( const std::string & link_name, const std::string & filename, const std::string & logfile,
                const bool repeat, const bool graph_throughput, const bool graph_delay,
-               std::unique_ptr<AbstractPacketQueue> && packet_queue,
+               const GraphOutput & graph_output,
+               const std::string & packet_queue_args,
                const std::string & command_line );
 
     void read_packet( const std::string & contents );
 
     void write_packets( FileDescriptor & fd );
 
+    /* hand the delivered packets to the next stage instead */
+    void forward_packets( const std::function<void(const std::string &)> & next );
+
     unsigned int wait_time( void );
 
     bool pending_output( void ) const;
@@ -63,4 +90,14 @@ public:
     bool finished( void ) const { return finished_; }
 };
 
+/* a queue of the given type (nullptr if there's no such type) */
+std::unique_ptr<AbstractPacketQueue> make_packet_queue( const std::string & type, const std::string & args );
+
+/* a LinkQueue of the given type of packet queue; throws for an unknown type */
+AnyFerryQueue make_link_queue( const std::string & packet_queue_type, const std::string & packet_queue_args,
+                               const std::string & link_name, const std::string & filename, const std::string & logfile,
+                               const bool repeat, const bool graph_throughput, const bool graph_delay,
+                               const GraphOutput & graph_output,
+                               const std::string & command_line );
+
 #endif /* LINK_QUEUE_HH */
@@ -1,13 +1,12 @@
 /* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
 
 #include <getopt.h>
+#include <functional>
 
-#include "infinite_packet_queue.hh"
-#include "drop_tail_packet_queue.hh"
-#include "drop_head_packet_queue.hh"
-#include "codel_packet_queue.hh"
-#include "pie_packet_queue.hh"
 #include "link_queue.hh"
+#include "any_ferry_queue.hh"
+#include "ezio.hh"
+#include "random.hh"
 #include "packetshell.cc"
 
 using namespace std;
@@ -21,36 +20,29 @@ void usage_error( const string & program_name )
     cerr << "          --meter-uplink --meter-uplink-delay" << endl;
     cerr << "          --meter-downlink --meter-downlink-delay" << endl;
     cerr << "          --meter-all" << endl;
+    cerr << "          --meter-output=DIRECTORY [--meter-format=png|svg|csv] [--meter-interval=MS]" << endl;
     cerr << "          --uplink-queue=QUEUE_TYPE --downlink-queue=QUEUE_TYPE" << endl;
     cerr << "          --uplink-queue-args=QUEUE_ARGS --downlink-queue-args=QUEUE_ARGS" << endl;
+    cerr << "          --seed=N" << endl;
     cerr << endl;
-    cerr << "          QUEUE_TYPE = infinite | droptail | drophead | codel | pie" << endl;
+    cerr << "          QUEUE_TYPE = infinite | droptail | drophead | codel | pie | l4s" << endl;
     cerr << "          QUEUE_ARGS = \"NAME=NUMBER[, NAME2=NUMBER2, ...]\"" << endl;
-    cerr << "              (with NAME = bytes | packets | target | interval | qdelay_ref | max_burst)" << endl;
-    cerr << "                  target, interval, qdelay_ref, max_burst are in milli-second" << endl << endl;
+    cerr << "              (with NAME = bytes | packets | target | interval | qdelay_ref | max_burst | ecn | threshold)" << endl;
+    cerr << "                  target, interval, qdelay_ref, max_burst, threshold are in milli-second" << endl;
+    cerr << "                  ecn=1 makes codel and pie mark ECN-capable packets instead of dropping them" << endl << endl;
 
     throw runtime_error( "invalid arguments" );
 }
 
-unique_ptr<AbstractPacketQueue> get_packet_queue( const string & type, const string & args, const string & program_name )
+/* each direction makes its own queue once it has dropped privileges
+   (and specialises its LinkQueue on the queue's type); this one is only
+   to catch a bad type or arguments up front */
+void check_packet_queue( const string & type, const string & args, const string & program_name )
 {
-    if ( type == "infinite" ) {
-        return unique_ptr<AbstractPacketQueue>( new InfinitePacketQueue( args ) );
-    } else if ( type == "droptail" ) {
-        return unique_ptr<AbstractPacketQueue>( new DropTailPacketQueue( args ) );
-    } else if ( type == "drophead" ) {
-        return unique_ptr<AbstractPacketQueue>( new DropHeadPacketQueue( args ) );
-    } else if ( type == "codel" ) {
-        return unique_ptr<AbstractPacketQueue>( new CODELPacketQueue( args ) );
-    } else if ( type == "pie" ) {
-        return unique_ptr<AbstractPacketQueue>( new PIEPacketQueue( args ) );
-    } else {
+    if ( not make_packet_queue( type, args ) ) {
         cerr << "Unknown queue type: " << type << endl;
+        usage_error( program_name );
     }
-
-    usage_error( program_name );
-
-    return nullptr;
 }
 
 string shell_quote( const string & arg )
@@ -72,6 +64,8 @@ int main( int argc, char *argv[] )
 {
     try {
         const bool passthrough_until_signal = getenv( "MAHIMAHI_PASSTHROUGH_UNTIL_SIGNAL" );
+        SetupTrace::enable( "mm-link" );
+        Random::initialize();
 
         /* clear environment while running as root */
         char ** const user_environment = environ;
@@ -101,6 +95,10 @@ int main( int argc, char *argv[] )
             { "downlink-queue",       required_argument, nullptr, 'w' },
             { "uplink-queue-args",    required_argument, nullptr, 'a' },
             { "downlink-queue-args",  required_argument, nullptr, 'b' },
+            { "meter-output",         required_argument, nullptr, 'O' },
+            { "meter-format",         required_argument, nullptr, 'F' },
+            { "meter-interval",       required_argument, nullptr, 'I' },
+            { "seed",                 required_argument, nullptr, 'S' },
             { 0,                                      0, nullptr, 0 }
         };
 
@@ -110,6 +108,7 @@ int main( int argc, char *argv[] )
         bool meter_uplink_delay = false, meter_downlink_delay = false;
         string uplink_queue_type = "infinite", downlink_queue_type = "infinite",
                uplink_queue_args, downlink_queue_args;
+        GraphOutput meter_output;
 
         while ( true ) {
             const int opt = getopt_long( argc, argv, "u:d:", command_line_options, nullptr );
@@ -156,6 +155,18 @@ int main( int argc, char *argv[] )
             case 'b':
                 downlink_queue_args = optarg;
                 break;
+            case 'O':
+                meter_output.directory = optarg;
+                break;
+            case 'F':
+                meter_output.format = optarg;
+                break;
+            case 'I':
+                meter_output.interval_ms = myatoi( optarg );
+                break;
+            case 'S':
+                Random::set_seed( optarg );
+                break;
             case '?':
                 usage_error( argv[ 0 ] );
                 break;
@@ -181,16 +192,24 @@ int main( int argc, char *argv[] )
             }
         }
 
-        PacketShell<LinkQueue> link_shell_app( "link", user_environment, passthrough_until_signal );
+        check_packet_queue( uplink_queue_type, uplink_queue_args, argv[ 0 ] );
+        check_packet_queue( downlink_queue_type, downlink_queue_args, argv[ 0 ] );
+
+        const function<AnyFerryQueue( void )> uplink_queue
+            = bind( make_link_queue, uplink_queue_type, uplink_queue_args,
+                    "Uplink", uplink_filename, uplink_logfile, repeat, meter_uplink, meter_uplink_delay, meter_output,
+                    command_line );
+
+        const function<AnyFerryQueue( void )> downlink_queue
+            = bind( make_link_queue, downlink_queue_type, downlink_queue_args,
+                    "Downlink", downlink_filename, downlink_logfile, repeat, meter_downlink, meter_downlink_delay, meter_output,
+                    command_line );
+
+        PacketShell<AnyFerryQueue> link_shell_app( "link", user_environment, passthrough_until_signal );
 
-        link_shell_app.start_uplink( "[link] ", command,
-                                     "Uplink", uplink_filename, uplink_logfile, repeat, meter_uplink, meter_uplink_delay,
-                                     get_packet_queue( uplink_queue_type, uplink_queue_args, argv[ 0 ] ),
-                                     command_line );
+        link_shell_app.start_uplink( "[link] ", command, uplink_queue );
 
-        link_shell_app.start_downlink( "Downlink", downlink_filename, downlink_logfile, repeat, meter_downlink, meter_downlink_delay,
-                                       get_packet_queue( downlink_queue_type, downlink_queue_args, argv[ 0 ] ),
-                                       command_line );
+        link_shell_app.start_downlink( downlink_queue );
 
         return link_shell_app.wait_for_exit();
     } catch ( const exception & e ) {
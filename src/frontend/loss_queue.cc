@@ -5,14 +5,18 @@
 #include <fstream>
 #include <string>
 #include <iostream>
+#include <cmath>
+#include <algorithm>
 
 #include "loss_queue.hh"
 #include "timestamp.hh"
+#include "ezio.hh"
+#include "random.hh"
 
 using namespace std;
 
 LossQueue::LossQueue()
-    : prng_( random_device()() )
+    : prng_( Random::stream( "loss" ) )
 {}
 
 void LossQueue::read_packet( const string & contents )
@@ -30,6 +34,14 @@ void LossQueue::write_packets( FileDescriptor & fd )
     }
 }
 
+void LossQueue::forward_packets( const function<void(const string &)> & next )
+{
+    while ( not packet_queue_.empty() ) {
+        next( packet_queue_.front() );
+        packet_queue_.pop();
+    }
+}
+
 unsigned int LossQueue::wait_time( void )
 {
     return packet_queue_.empty() ? numeric_limits<uint16_t>::max() : 0;
@@ -40,21 +52,67 @@ bool IIDLoss::drop_packet( const string & packet __attribute((unused)) )
     return drop_dist_( prng_ );
 }
 
-static const double MS_PER_SECOND = 1000.0;
+MarkovLoss::MarkovLoss( const vector<vector<double>> & transitions,
+                        const vector<double> & loss_rates )
+    : transition_thresholds_(),
+      loss_thresholds_(),
+      state_( 0 )
+{
+    if ( transitions.empty() or transitions.size() != loss_rates.size() ) {
+        throw runtime_error( "Markov loss model: need a loss rate and a row of transitions for each state" );
+    }
+
+    for ( unsigned int i = 0; i < transitions.size(); i++ ) {
+        const auto & row = transitions.at( i );
+        if ( row.size() != transitions.size() ) {
+            throw runtime_error( "Markov loss model: need a transition probability to each state from state " + to_string( i ) );
+        }
+
+        double cumulative = 0;
+        transition_thresholds_.emplace_back();
+        for ( const double probability : row ) {
+            if ( not ( (0 <= probability) and (probability <= 1) ) ) {
+                throw runtime_error( "Markov loss model: probabilities must be between 0 and 1" );
+            }
+            cumulative += probability;
+            transition_thresholds_.back().push_back( Xoshiro256::threshold( cumulative ) );
+        }
+
+        if ( abs( cumulative - 1 ) > 1e-6 ) {
+            throw runtime_error( "Markov loss model: transition probabilities from state " + to_string( i ) + " must sum to 1" );
+        }
+        transition_thresholds_.back().back() = Xoshiro256::threshold( 1 );
+
+        const double loss_rate = loss_rates.at( i );
+        if ( not ( (0 <= loss_rate) and (loss_rate <= 1) ) ) {
+            throw runtime_error( "Markov loss model: loss rates must be between 0 and 1" );
+        }
+        loss_thresholds_.push_back( Xoshiro256::threshold( loss_rate ) );
+    }
+}
 
-TraceLoss::TraceLoss( const bool drop_direction, const string & filename )
-    : schedule_(),
-      loss_rate_(),
-      drop_dist_(),
-      drop_direction_( drop_direction ),
-      base_timestamp_( timestamp() ),
-      next_delivery_( 0 )
-      
+bool MarkovLoss::drop_packet( const string & packet __attribute((unused)) )
 {
-    if ( !drop_direction_ ) {
-        return ;
+    const bool drop = prng_.chance( loss_thresholds_[ state_ ] );
+
+    /* then move to the next state */
+    const auto & row = transition_thresholds_[ state_ ];
+    const uint64_t draw = prng_.draw53();
+    unsigned int next = 0;
+    while ( next + 1 < row.size() and draw >= row[ next ] ) {
+        next++;
     }
+    state_ = next;
 
+    return drop;
+}
+
+static const double MS_PER_SECOND = 1000.0;
+
+LossTrace::LossTrace( const string & filename )
+    : end_times_(),
+      loss_thresholds_()
+{
     ifstream trace_file( filename );
 
     if ( not trace_file.good() ) {
@@ -68,56 +126,70 @@ TraceLoss::TraceLoss( const bool drop_direction, const string & filename )
             throw runtime_error( filename + ": invalid empty line" );
         }
 
-        const size_t space = line.find( ',' );
+        const size_t comma = line.find( ',' );
 
-        if ( space == string::npos ) {
+        if ( comma == string::npos ) {
             throw runtime_error( filename + ": invalid line: " + line );
         }
 
-        const uint64_t ms = stoull( line.substr( 0, space ) );
-        const float loss_rate = stof( line.substr( space + 1 ) );
+        const uint64_t ms = myatoi( line.substr( 0, comma ) );
+        const double loss_rate = myatof( line.substr( comma + 1 ) );
 
-        schedule_.emplace_back( ms );
-        loss_rate_.emplace_back( loss_rate * 100 );
-        drop_dist_.emplace_back( std::bernoulli_distribution(loss_rate) );
+        if ( not ( (0 <= loss_rate) and (loss_rate <= 1) ) ) {
+            throw runtime_error( filename + ": loss rate must be between 0 and 1: " + line );
+        }
+
+        if ( not end_times_.empty() and ms < end_times_.back() ) {
+            throw runtime_error( filename + ": timestamps must be monotonically nondecreasing" );
+        }
+
+        end_times_.emplace_back( ms );
+        loss_thresholds_.emplace_back( Xoshiro256::threshold( loss_rate ) );
     }
 
-    if ( schedule_.empty() ) {
+    if ( end_times_.empty() ) {
         throw runtime_error( filename + ": no valid trace data found" );
     }
 
-    srand(0);
+    if ( end_times_.back() == 0 ) {
+        throw runtime_error( filename + ": trace must last for a nonzero amount of time" );
+    }
 }
 
-bool TraceLoss::gen_random_pkt( int schedule )
+uint64_t LossTrace::loss_threshold_at( const uint64_t time, size_t & index, uint64_t & base_time ) const
 {
-    int loss_rate = loss_rate_.at(schedule);
-    int random = (rand() % 100) + 1;
-    return random <= loss_rate;
+    uint64_t elapsed = time - base_time;
+
+    /* start again after the end */
+    const uint64_t period = end_times_.back();
+    if ( elapsed >= period ) {
+        base_time += elapsed - elapsed % period;
+        elapsed %= period;
+        index = 0;
+    }
+
+    /* catch up with the time, however far behind (the first segment
+       ending at or after it) */
+    if ( end_times_[ index ] < elapsed ) {
+        index = lower_bound( end_times_.begin() + index, end_times_.end(), elapsed ) - end_times_.begin();
+    }
+
+    return loss_thresholds_[ index ];
 }
 
+TraceLoss::TraceLoss( const shared_ptr<const LossTrace> & trace )
+    : trace_( trace ),
+      trace_index_( 0 ),
+      base_timestamp_( timestamp() )
+{}
+
 bool TraceLoss::drop_packet( const string & packet __attribute((unused)) )
 {
-    if ( !drop_direction_ ) {
+    if ( not trace_ ) {
         return false;
     }
 
-    const uint64_t now = timestamp();
-    const uint64_t elapsed = now - base_timestamp_;
-    uint64_t trace_timestamp = schedule_.at(next_delivery_);
-    bool res;
-
-    if ( elapsed <= trace_timestamp) {
-        res = gen_random_pkt(next_delivery_);
-        return res;
-    } else {
-        next_delivery_ = (next_delivery_ + 1) % schedule_.size();
-        if ( next_delivery_ == 0 ) {
-            base_timestamp_ = now;
-        }
-        res = gen_random_pkt(next_delivery_);
-        return res;
-    }
+    return prng_.chance( trace_->loss_threshold_at( timestamp(), trace_index_, base_timestamp_ ) );
 }
 
 StochasticSwitchingLink::StochasticSwitchingLink( const double mean_on_time, const double mean_off_time )
@@ -7,8 +7,11 @@
 #include <cstdint>
 #include <string>
 #include <random>
+#include <memory>
+#include <functional>
 
 #include "file_descriptor.hh"
+#include "xoshiro.hh"
 
 class LossQueue
 {
@@ -18,7 +21,7 @@ private:
     virtual bool drop_packet( const std::string & packet ) = 0;
 
 protected:
-    std::default_random_engine prng_;
+    Xoshiro256 prng_;
 
 public:
     LossQueue();
@@ -28,6 +31,9 @@ public:
 
     void write_packets( FileDescriptor & fd );
 
+    /* hand the packets that weren't dropped to the next stage instead */
+    void forward_packets( const std::function<void(const std::string &)> & next );
+
     unsigned int wait_time( void );
 
     bool pending_output( void ) const { return not packet_queue_.empty(); }
@@ -46,23 +52,66 @@ public:
     IIDLoss( const double loss_rate ) : drop_dist_( loss_rate ) {}
 };
 
+/* bursty loss: a Markov chain that moves between k states after each
+   packet, with a loss rate of its own in each state */
+class MarkovLoss : public LossQueue
+{
+private:
+    /* (cumulative along each row, as Xoshiro256 thresholds) */
+    std::vector<std::vector<uint64_t>> transition_thresholds_;
+    std::vector<uint64_t> loss_thresholds_;
+    unsigned int state_;
+
+    bool drop_packet( const std::string & packet ) override;
+
+public:
+    /* transitions[ i ][ j ] is the probability of going from state i to
+       state j (each row summing to 1); the chain starts in state 0 */
+    MarkovLoss( const std::vector<std::vector<double>> & transitions,
+                const std::vector<double> & loss_rates );
+};
+
+/* the two-state (good and bad) chain of Gilbert and Elliott */
+class GilbertElliottLoss : public MarkovLoss
+{
+public:
+    GilbertElliottLoss( const double good_to_bad, const double bad_to_good,
+                        const double loss_rate_good, const double loss_rate_bad )
+        : MarkovLoss( { { 1 - good_to_bad, good_to_bad }, { bad_to_good, 1 - bad_to_good } },
+                      { loss_rate_good, loss_rate_bad } ) {}
+};
+
+/* loss rates that change over time, from a file of lines "TIME,RATE":
+   each RATE holds until its TIME (in ms from the start, nondecreasing),
+   and then the trace starts again */
+class LossTrace
+{
+private:
+    std::vector<uint64_t> end_times_;
+    std::vector<uint64_t> loss_thresholds_; /* (as Xoshiro256 thresholds) */
+
+public:
+    LossTrace( const std::string & filename );
+
+    /* the loss threshold a time after the start, moving the caller's
+       cursor (an index into the trace and the time its turn began)
+       forward; the times asked for must not decrease */
+    uint64_t loss_threshold_at( const uint64_t time, size_t & index, uint64_t & base_time ) const;
+};
+
 class TraceLoss : public LossQueue
 {
 private:
-    std::vector<uint64_t> schedule_;
-    std::vector<int> loss_rate_;
-    std::vector<std::bernoulli_distribution> drop_dist_;
-    bool drop_direction_;
+    std::shared_ptr<const LossTrace> trace_;
+    size_t trace_index_;
     uint64_t base_timestamp_;
-    unsigned int next_delivery_;
 
     bool drop_packet( const std::string & packet ) override;
-    bool gen_random_pkt( int schedule );
 
 public:
-    TraceLoss(const bool drop_direction, const std::string & filename );
-
-}; 
+    /* (without a trace, nothing is dropped) */
+    TraceLoss( const std::shared_ptr<const LossTrace> & trace );
+};
 
 class StochasticSwitchingLink : public LossQueue
 {
@@ -3,25 +3,57 @@
 #include <vector>
 #include <string>
 #include <iostream>
+#include <sstream>
 
 #include <getopt.h>
 
 #include "loss_queue.hh"
 #include "util.hh"
 #include "ezio.hh"
+#include "random.hh"
 #include "packetshell.cc"
 
 using namespace std;
 
 void usage( const string & program_name )
 {
-    throw runtime_error( "Usage: " + program_name + " uplink|downlink RATE [COMMAND...]" );
+    throw runtime_error( "Usage: " + program_name + " [--seed=N] uplink|downlink RATE [COMMAND...]\n"
+                         + "       " + program_name + " [--seed=N] uplink|downlink gilbert-elliott"
+                         + " P-GOOD-TO-BAD P-BAD-TO-GOOD LOSS-RATE-GOOD LOSS-RATE-BAD [COMMAND...]\n"
+                         + "       " + program_name + " [--seed=N] uplink|downlink markov TRANSITIONS LOSS-RATES [COMMAND...]\n"
+                         + "           (TRANSITIONS = a row of probabilities from each state, e.g. 0.9,0.1/0.5,0.5;\n"
+                         + "            LOSS-RATES = one for each state, e.g. 0,0.8)" );
+}
+
+/* numbers separated by a character */
+static vector<double> number_list( const string & str, const char separator )
+{
+    vector<double> ret;
+    istringstream ss( str );
+    string field;
+    while ( getline( ss, field, separator ) ) {
+        ret.push_back( myatof( field ) );
+    }
+    return ret;
+}
+
+static vector<vector<double>> transition_matrix( const string & str )
+{
+    vector<vector<double>> ret;
+    istringstream ss( str );
+    string row;
+    while ( getline( ss, row, '/' ) ) {
+        ret.push_back( number_list( row, ',' ) );
+    }
+    return ret;
 }
 
 int main( int argc, char *argv[] )
 {
     try {
         const bool passthrough_until_signal = getenv( "MAHIMAHI_PASSTHROUGH_UNTIL_SIGNAL" );
+        SetupTrace::enable( "mm-loss" );
+        Random::initialize();
 
         /* clear environment while running as root */
         char ** const user_environment = environ;
@@ -29,54 +61,115 @@ int main( int argc, char *argv[] )
 
         check_requirements( argc, argv );
 
-        if ( argc < 3 ) {
-            usage( argv[ 0 ] );
+        const option command_line_options[] = {
+            { "seed",         required_argument, nullptr, 's' },
+            { 0,                              0, nullptr, 0 }
+        };
+
+        while ( true ) {
+            /* (options come first; the command's own are left alone) */
+            const int opt = getopt_long( argc, argv, "+", command_line_options, nullptr );
+            if ( opt == -1 ) { /* end of options */
+                break;
+            }
+
+            switch ( opt ) {
+            case 's':
+                Random::set_seed( optarg );
+                break;
+            case '?':
+                usage( argv[ 0 ] );
+                break;
+            default:
+                throw runtime_error( "getopt_long: unexpected return value " + to_string( opt ) );
+            }
         }
 
-        const double loss_rate = myatof( argv[ 2 ] );
-        if ( (0 <= loss_rate) and (loss_rate <= 1) ) {
-            /* do nothing */
-        } else {
-            cerr << "Error: loss rate must be between 0 and 1." << endl;
+        if ( argc - optind < 2 ) {
             usage( argv[ 0 ] );
         }
 
-        double uplink_loss = 0, downlink_loss = 0;
+        const string link = argv[ optind ];
+        if ( link != "uplink" and link != "downlink" ) {
+            usage( argv[ 0 ] );
+        }
+        const bool uplink = link == "uplink";
 
-        const string link = argv[ 1 ];
-        if ( link == "uplink" ) {
-            uplink_loss = loss_rate;
-        } else if ( link == "downlink" ) {
-            downlink_loss = loss_rate;
-        } else {
+        /* the loss model, and where the command starts */
+        const string model = argv[ optind + 1 ];
+        const int model_arguments = model == "gilbert-elliott" ? 4 : model == "markov" ? 2 : 0;
+        const int command_start = optind + 2 + model_arguments;
+        if ( command_start > argc ) {
             usage( argv[ 0 ] );
         }
 
+        string shell_prefix = uplink ? "[loss up=" : "[loss down=";
+        for ( int i = optind + 1; i < command_start; i++ ) {
+            shell_prefix += ( i > optind + 1 ? " " : "" ) + string( argv[ i ] );
+        }
+        shell_prefix += "] ";
+
         vector<string> command;
 
-        if ( argc == 3 ) {
+        if ( command_start == argc ) {
             command.push_back( shell_path() );
         } else {
-            for ( int i = 3; i < argc; i++ ) {
+            for ( int i = command_start; i < argc; i++ ) {
                 command.push_back( argv[ i ] );
             }
         }
 
-        PacketShell<IIDLoss> loss_app( "loss", user_environment, passthrough_until_signal );
+        /* (the other direction has the same kind of queue, without loss) */
+        if ( model == "gilbert-elliott" ) {
+            const double good_to_bad = myatof( argv[ optind + 2 ] ), bad_to_good = myatof( argv[ optind + 3 ] );
+            const double loss_rate_good = myatof( argv[ optind + 4 ] ), loss_rate_bad = myatof( argv[ optind + 5 ] );
+            GilbertElliottLoss check_arguments( good_to_bad, bad_to_good, loss_rate_good, loss_rate_bad );
+
+            PacketShell<GilbertElliottLoss> loss_app( "loss", user_environment, passthrough_until_signal );
+
+            if ( uplink ) {
+                loss_app.start_uplink( shell_prefix, command,
+                                       good_to_bad, bad_to_good, loss_rate_good, loss_rate_bad );
+                loss_app.start_downlink( 0, 1, 0, 0 );
+            } else {
+                loss_app.start_uplink( shell_prefix, command, 0, 1, 0, 0 );
+                loss_app.start_downlink( good_to_bad, bad_to_good, loss_rate_good, loss_rate_bad );
+            }
+            return loss_app.wait_for_exit();
+        } else if ( model == "markov" ) {
+            const vector<vector<double>> transitions = transition_matrix( argv[ optind + 2 ] );
+            const vector<double> loss_rates = number_list( argv[ optind + 3 ], ',' );
+            MarkovLoss check_arguments( transitions, loss_rates );
+
+            const vector<vector<double>> no_transitions { { 1 } };
+            const vector<double> no_loss { 0 };
+
+            PacketShell<MarkovLoss> loss_app( "loss", user_environment, passthrough_until_signal );
+
+            if ( uplink ) {
+                loss_app.start_uplink( shell_prefix, command, transitions, loss_rates );
+                loss_app.start_downlink( no_transitions, no_loss );
+            } else {
+                loss_app.start_uplink( shell_prefix, command, no_transitions, no_loss );
+                loss_app.start_downlink( transitions, loss_rates );
+            }
+            return loss_app.wait_for_exit();
+        }
 
-        string shell_prefix = "[loss ";
-        if ( link == "uplink" ) {
-            shell_prefix += "up=";
+        const double loss_rate = myatof( model );
+        if ( (0 <= loss_rate) and (loss_rate <= 1) ) {
+            /* do nothing */
         } else {
-            shell_prefix += "down=";
+            cerr << "Error: loss rate must be between 0 and 1." << endl;
+            usage( argv[ 0 ] );
         }
-        shell_prefix += argv[ 2 ];
-        shell_prefix += "] ";
+
+        PacketShell<IIDLoss> loss_app( "loss", user_environment, passthrough_until_signal );
 
         loss_app.start_uplink( shell_prefix,
                                command,
-                               uplink_loss );
-        loss_app.start_downlink( downlink_loss );
+                               uplink ? loss_rate : 0 );
+        loss_app.start_downlink( uplink ? 0 : loss_rate );
         return loss_app.wait_for_exit();
     } catch ( const exception & e ) {
         print_exception( e );
@@ -3,12 +3,14 @@
 #include <vector>
 #include <string>
 #include <iostream>
+#include <memory>
 
 #include <getopt.h>
 
 #include "loss_queue.hh"
 #include "util.hh"
 #include "ezio.hh"
+#include "random.hh"
 #include "packetshell.cc"
 
 using namespace std;
@@ -17,7 +19,7 @@ void usage_error( const string & program_name )
 {
     cerr << "Usage: " + program_name + " downlink|uplink [OPTION]" << endl;
     cerr << endl;
-    cerr << "Options = --trace-file=FILENAME" << endl;
+    cerr << "Options = --trace-file=FILENAME --seed=N" << endl;
 
     throw runtime_error( "invalid arguments" );
 }
@@ -26,6 +28,8 @@ int main( int argc, char *argv[] )
 {
     try {
         const bool passthrough_until_signal = getenv( "MAHIMAHI_PASSTHROUGH_UNTIL_SIGNAL" );
+        SetupTrace::enable( "mm-loss-trace" );
+        Random::initialize();
 
         /* clear environment while running as root */
         char ** const user_environment = environ;
@@ -40,13 +44,12 @@ int main( int argc, char *argv[] )
         const option command_line_options[] = {
             { "trace-file",           required_argument, nullptr, 't' },
             { "configure-file",       required_argument, nullptr, 'c' },
+            { "seed",                 required_argument, nullptr, 's' },
             { 0,                                      0, nullptr, 0 }
         };
 
-        string link = argv[ 1 ];
         string trace_file;
         string configure_file;
-        bool drop_uplink = false, drop_downlink = false;
 
         while ( true ) {
             const int opt = getopt_long( argc, argv, "t:c:", command_line_options, nullptr );
@@ -61,6 +64,9 @@ int main( int argc, char *argv[] )
             case 'c':
                 configure_file = optarg;
                 break;
+            case 's':
+                Random::set_seed( optarg );
+                break;
             case '?':
                 usage_error( argv[ 0 ] );
                 break;
@@ -69,24 +75,29 @@ int main( int argc, char *argv[] )
             }
         }
 
+        /* (the options may come before or after the link) */
+        if ( optind >= argc ) {
+            usage_error( argv[ 0 ] );
+        }
+
+        const string link = argv[ optind ];
         if ( link != "uplink" and link != "downlink" ) {
             throw runtime_error( "unexpected link value: " +  link );
         }
 
-        if ( link == "uplink" ) {
-            drop_uplink = true;
-        } else {
-            drop_downlink = true;
+        /* read the trace (as the user) for the direction that drops */
+        shared_ptr<const LossTrace> trace;
+        {
+            TemporarilyUnprivileged tu;
+            trace = make_shared<const LossTrace>( trace_file );
         }
 
         vector<string> command;
 
-        cout << argc << endl;
-
-        if ( argc == 4 ) {
+        if ( optind + 1 == argc ) {
             command.push_back( shell_path() );
         } else {
-            for ( int i = 4; i < argc; i++ ) {
+            for ( int i = optind + 1; i < argc; i++ ) {
                 command.push_back( argv[ i ] );
             }
         }
@@ -106,10 +117,12 @@ int main( int argc, char *argv[] )
 
         shell_prefix += "trace-file] ";
 
+        const shared_ptr<const LossTrace> no_trace;
+
         loss_app.start_uplink( shell_prefix,
                                command,
-                               drop_uplink, trace_file);
-        loss_app.start_downlink(drop_downlink, trace_file);
+                               link == "uplink" ? trace : no_trace );
+        loss_app.start_downlink( link == "downlink" ? trace : no_trace );
         return loss_app.wait_for_exit();
     } catch ( const exception & e ) {
         print_exception( e );
@@ -3,19 +3,22 @@
 #include <getopt.h>
 
 #include "meter_queue.hh"
+#include "ezio.hh"
 #include "packetshell.cc"
 
 using namespace std;
 
 void usage_error( const string & program_name )
 {
-    throw runtime_error( "Usage: " + program_name + " [--meter-uplink] [--meter-downlink] [COMMAND...]" );
+    throw runtime_error( "Usage: " + program_name + " [--meter-uplink] [--meter-downlink]"
+                         + " [--meter-output=DIRECTORY [--meter-format=png|svg|csv] [--meter-interval=MS]] [COMMAND...]" );
 }
 
 int main( int argc, char *argv[] )
 {
     try {
         const bool passthrough_until_signal = getenv( "MAHIMAHI_PASSTHROUGH_UNTIL_SIGNAL" );
+        SetupTrace::enable( "mm-meter" );
 
         /* clear environment while running as root */
         char ** const user_environment = environ;
@@ -26,10 +29,14 @@ int main( int argc, char *argv[] )
         const option command_line_options[] = {
             { "meter-uplink",   no_argument, nullptr, 'u' },
             { "meter-downlink", no_argument, nullptr, 'd' },
+            { "meter-output",   required_argument, nullptr, 'O' },
+            { "meter-format",   required_argument, nullptr, 'F' },
+            { "meter-interval", required_argument, nullptr, 'I' },
             { 0,                0,           nullptr, 0 }
         };
 
         bool meter_uplink = false, meter_downlink = false;
+        GraphOutput meter_output;
 
         while ( true ) {
             const int opt = getopt_long( argc, argv, "ud", command_line_options, nullptr );
@@ -44,6 +51,15 @@ int main( int argc, char *argv[] )
             case 'd':
                 meter_downlink = true;
                 break;
+            case 'O':
+                meter_output.directory = optarg;
+                break;
+            case 'F':
+                meter_output.format = optarg;
+                break;
+            case 'I':
+                meter_output.interval_ms = myatoi( optarg );
+                break;
             case '?':
                 usage_error( argv[ 0 ] );
                 break;
@@ -67,8 +83,8 @@ int main( int argc, char *argv[] )
         const string uplink_name = "Uplink", downlink_name = "Downlink";
 
         link_shell_app.start_uplink( "[meter] ", command,
-                                     uplink_name, meter_uplink );
-        link_shell_app.start_downlink( downlink_name, meter_downlink );
+                                     uplink_name, meter_uplink, meter_output );
+        link_shell_app.start_downlink( downlink_name, meter_downlink, meter_output );
         return link_shell_app.wait_for_exit();
     } catch ( const exception & e ) {
         print_exception( e );
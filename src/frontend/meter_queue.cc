@@ -1,19 +1,25 @@
 /* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
 
+#include <algorithm>
+
 #include "meter_queue.hh"
 #include "util.hh"
 #include "timestamp.hh"
 
 using namespace std;
 
-MeterQueue::MeterQueue( const string & name, const bool graph )
+MeterQueue::MeterQueue( const string & name, const bool graph, const GraphOutput & graph_output )
     : packet_queue_(),
       graph_( nullptr )
 {
     assert_not_root();
 
     if ( graph ) {
-        graph_.reset( new BinnedLiveGraph( name, { make_tuple( 0.0, 0.0, 0.4, 1.0, false ) }, "throughput (Mbps)", 8.0 / 1000000.0, true, 500, [] ( int, int & x ) { x = 0; } ) );
+        string file_name = name;
+        transform( file_name.begin(), file_name.end(), file_name.begin(), ::tolower );
+
+        graph_.reset( new BinnedLiveGraph( name, { make_tuple( 0.0, 0.0, 0.4, 1.0, false ) }, "throughput (Mbps)", 8.0 / 1000000.0, true, 500, [] ( int, int & x ) { x = 0; },
+                                           graph_output, file_name, { "throughput" } ) );
     }
 }
 
@@ -17,7 +17,7 @@ private:
     std::unique_ptr<BinnedLiveGraph> graph_;
 
 public:
-    MeterQueue( const std::string & name, const bool graph );
+    MeterQueue( const std::string & name, const bool graph, const GraphOutput & graph_output );
 
     void read_packet( const std::string & contents );
 
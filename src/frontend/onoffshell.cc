@@ -9,19 +9,22 @@
 #include "loss_queue.hh"
 #include "util.hh"
 #include "ezio.hh"
+#include "random.hh"
 #include "packetshell.cc"
 
 using namespace std;
 
 void usage( const string & program_name )
 {
-    throw runtime_error( "Usage: " + program_name + " uplink|downlink MEAN-ON-TIME MEAN-OFF-TIME [COMMAND...]" );
+    throw runtime_error( "Usage: " + program_name + " [--seed=N] uplink|downlink MEAN-ON-TIME MEAN-OFF-TIME [COMMAND...]" );
 }
 
 int main( int argc, char *argv[] )
 {
     try {
         const bool passthrough_until_signal = getenv( "MAHIMAHI_PASSTHROUGH_UNTIL_SIGNAL" );
+        SetupTrace::enable( "mm-onoff" );
+        Random::initialize();
 
         /* clear environment while running as root */
         char ** const user_environment = environ;
@@ -29,11 +32,39 @@ int main( int argc, char *argv[] )
 
         check_requirements( argc, argv );
 
-        if ( argc < 4 ) {
+        const option command_line_options[] = {
+            { "seed",         required_argument, nullptr, 's' },
+            { 0,                              0, nullptr, 0 }
+        };
+
+        while ( true ) {
+            /* (options come first; the command's own are left alone) */
+            const int opt = getopt_long( argc, argv, "+", command_line_options, nullptr );
+            if ( opt == -1 ) { /* end of options */
+                break;
+            }
+
+            switch ( opt ) {
+            case 's':
+                Random::set_seed( optarg );
+                break;
+            case '?':
+                usage( argv[ 0 ] );
+                break;
+            default:
+                throw runtime_error( "getopt_long: unexpected return value " + to_string( opt ) );
+            }
+        }
+
+        /* the arguments after the options */
+        char ** const arguments = argv + optind - 1;
+        const int argument_count = argc - optind + 1;
+
+        if ( argument_count < 4 ) {
             usage( argv[ 0 ] );
         }
 
-        const double on_time = myatof( argv[ 2 ] );
+        const double on_time = myatof( arguments[ 2 ] );
         if ( (0 <= on_time) ) {
             /* do nothing */
         } else {
@@ -41,7 +72,7 @@ int main( int argc, char *argv[] )
             usage( argv[ 0 ] );
         }
 
-        const double off_time = myatof( argv[ 3 ] );
+        const double off_time = myatof( arguments[ 3 ] );
         if ( (0 <= off_time) ) {
             /* do nothing */
         } else {
@@ -57,7 +88,7 @@ int main( int argc, char *argv[] )
         double uplink_on_time = numeric_limits<double>::max(), uplink_off_time = 0;
         double downlink_on_time = numeric_limits<double>::max(), downlink_off_time = 0;
 
-        const string link = argv[ 1 ];
+        const string link = arguments[ 1 ];
         if ( link == "uplink" ) {
             uplink_on_time = on_time;
             uplink_off_time = off_time;
@@ -70,11 +101,11 @@ int main( int argc, char *argv[] )
 
         vector<string> command;
 
-        if ( argc == 4 ) {
+        if ( argument_count == 4 ) {
             command.push_back( shell_path() );
         } else {
-            for ( int i = 4; i < argc; i++ ) {
-                command.push_back( argv[ i ] );
+            for ( int i = 4; i < argument_count; i++ ) {
+                command.push_back( arguments[ i ] );
             }
         }
 
@@ -86,9 +117,9 @@ int main( int argc, char *argv[] )
         } else {
             shell_prefix += "(down) on=";
         }
-        shell_prefix += argv[ 2 ];
+        shell_prefix += arguments[ 2 ];
         shell_prefix += "s off=";
-        shell_prefix += argv[ 3 ];
+        shell_prefix += arguments[ 3 ];
         shell_prefix += "s] ";
 
         onoff_app.start_uplink( shell_prefix,
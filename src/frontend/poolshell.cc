@@ -0,0 +1,360 @@
+/* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "warm_shell.hh"
+#include "event_loop.hh"
+#include "socketpair.hh"
+#include "timestamp.hh"
+#include "util.hh"
+#include "ezio.hh"
+#include "exception.hh"
+#include "random.hh"
+
+using namespace std;
+using namespace PollerShortNames;
+
+void usage( const string & program_name )
+{
+    throw runtime_error( "Usage: " + program_name + " serve SOCKET COUNT\n"
+                         + "       " + program_name + " run SOCKET delay|loss|link ARGUMENTS... [delay|loss|link ARGUMENTS...] [COMMAND...]\n"
+                         + "       " + program_name + " batch EXPERIMENTS RESULTS-DIRECTORY [JOBS]" );
+}
+
+/* removes the pool's socket when it shuts down, as the user (like the
+   bind), and relative to a descriptor on its directory opened when it
+   was made, so swapping the directory for a symlink can't redirect it */
+class SocketFile
+{
+private:
+    FileDescriptor directory_;
+    string name_;
+
+    static FileDescriptor open_directory( const string & path )
+    {
+        const auto slash = path.rfind( '/' );
+        const string directory = slash == string::npos ? "." : path.substr( 0, slash + 1 );
+
+        TemporarilyUnprivileged tu;
+        return FileDescriptor( SystemCall( "open " + directory,
+                                           open( directory.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC ) ) );
+    }
+
+public:
+    SocketFile( const string & path )
+        : directory_( open_directory( path ) ),
+          name_( path.substr( path.rfind( '/' ) + 1 ) )
+    {}
+
+    ~SocketFile()
+    {
+        /* (don't throw from destructor) */
+        try {
+            TemporarilyUnprivileged tu;
+            unlinkat( directory_.fd_num(), name_.c_str(), 0 );
+        } catch ( const exception & e ) {
+            print_exception( e );
+        }
+    }
+
+    SocketFile( const SocketFile & other ) = delete;
+    SocketFile & operator=( const SocketFile & other ) = delete;
+};
+
+/* keep count containers ready, and hand each client to the next free one */
+int serve( const string & path, const unsigned int count )
+{
+    /* initialize base timestamp value before any forking */
+    initial_timestamp();
+
+    EventLoop event_loop;
+
+    /* (owned by the user, so they can connect to it) */
+    UnixDomainSocket listener = [&] () {
+        TemporarilyUnprivileged tu;
+        return UnixDomainSocket::listen_at( path );
+    } ();
+    SocketFile socket_file( path );
+
+    /* (destroyed before the event loop, so containers quit before being waited for) */
+    WarmPool pool( event_loop, count, false,
+                   [&] () { cerr << "mm-pool: " << count << " shells ready at " << path << endl; } );
+
+    event_loop.add_simple_input_handler( listener, [&] () {
+            UnixDomainSocket client = listener.accept();
+
+            /* only the user who started the pool may use it */
+            if ( client.peer_uid() == getuid() ) {
+                pool.submit( move( client ), [] () { return ResultType::Continue; } );
+            }
+
+            return ResultType::Continue;
+        } );
+
+    return event_loop.loop();
+}
+
+/* ask the pool to run a command with the given stdin, stdout and stderr
+   (and, unless the arguments say otherwise, the given link logs) */
+void send_request( UnixDomainSocket & pool, const vector<string> & arguments, char ** const environment,
+                   FileDescriptor & input, FileDescriptor & output, FileDescriptor & error,
+                   const string & uplink_log = "", const string & downlink_log = "" )
+{
+    PoolRequest request;
+    request.arguments = arguments;
+    request.working_directory = get_working_directory();
+    for ( char ** x = environment; x and *x; x++ ) {
+        request.environment.emplace_back( *x );
+    }
+    request.uplink_log = uplink_log;
+    request.downlink_log = downlink_log;
+
+    pool.write( request.str() );
+
+    pool.send_fd( input );
+    pool.send_fd( output );
+    pool.send_fd( error );
+}
+
+/* run a command in one of the pool's containers, and return its status */
+int run( const string & path, const vector<string> & arguments )
+{
+    UnixDomainSocket pool = UnixDomainSocket::connect_to( path );
+
+    FileDescriptor input( SystemCall( "dup", dup( STDIN_FILENO ) ) );
+    FileDescriptor output( SystemCall( "dup", dup( STDOUT_FILENO ) ) );
+    FileDescriptor error( SystemCall( "dup", dup( STDERR_FILENO ) ) );
+    send_request( pool, arguments, environ, input, output, error );
+
+    /* wait for the command to finish */
+    const string status = pool.read();
+    if ( pool.eof() ) {
+        throw runtime_error( "mm-pool: the pool hung up" );
+    }
+
+    return myatoi( status );
+}
+
+/* split a line of the experiments file into arguments, as a shell would
+   (whitespace separates them; quotes and backslashes escape) */
+vector<string> split_arguments( const string & line )
+{
+    vector<string> ret;
+    string argument;
+    bool in_argument = false;
+    char quote = 0;
+
+    for ( size_t i = 0; i < line.size(); i++ ) {
+        const char c = line[ i ];
+
+        if ( quote ) {
+            if ( c == quote ) {
+                quote = 0;
+            } else if ( c == '\\' and quote == '"' and i + 1 < line.size() ) {
+                argument.push_back( line[ ++i ] );
+            } else {
+                argument.push_back( c );
+            }
+        } else if ( isspace( c ) ) {
+            if ( in_argument ) {
+                ret.push_back( argument );
+                argument.clear();
+                in_argument = false;
+            }
+        } else {
+            in_argument = true;
+            if ( c == '\'' or c == '"' ) {
+                quote = c;
+            } else if ( c == '\\' and i + 1 < line.size() ) {
+                argument.push_back( line[ ++i ] );
+            } else {
+                argument.push_back( c );
+            }
+        }
+    }
+
+    if ( quote ) {
+        throw runtime_error( "unterminated quote in experiment: " + line );
+    }
+
+    if ( in_argument ) {
+        ret.push_back( argument );
+    }
+
+    return ret;
+}
+
+/* run each experiment (a line of arguments, as for "mm-pool run") in its
+   own container, jobs at a time, each container on a CPU of its own.
+   Experiment n's output goes to RESULTS/n.stdout and RESULTS/n.stderr,
+   its link's logs (if it has a link) to RESULTS/n.uplink.log and
+   RESULTS/n.downlink.log, and its status and running time to a line of
+   RESULTS/summary. The commands run with the given environment. */
+int batch( const string & experiments_filename, const string & results, const unsigned int jobs,
+           char ** const environment )
+{
+    struct Experiment
+    {
+        string line;
+        vector<string> arguments;
+    };
+
+    vector<Experiment> experiments;
+    unique_ptr<ofstream> summary;
+
+    {
+        /* the files are the user's */
+        TemporarilyUnprivileged tu;
+
+        ifstream experiments_file( experiments_filename );
+        if ( not experiments_file.good() ) {
+            throw runtime_error( experiments_filename + ": error opening for reading" );
+        }
+
+        string line;
+        while ( getline( experiments_file, line ) ) {
+            vector<string> arguments = split_arguments( line );
+            if ( arguments.empty() or arguments.front().front() == '#' ) {
+                continue;
+            }
+            experiments.push_back( Experiment { line, move( arguments ) } );
+        }
+
+        if ( mkdir( results.c_str(), 0777 ) < 0 and errno != EEXIST ) {
+            throw unix_error( "mkdir " + results );
+        }
+
+        summary.reset( new ofstream( results + "/summary" ) );
+        if ( not summary->good() ) {
+            throw runtime_error( results + "/summary: error opening for writing" );
+        }
+    }
+
+    if ( experiments.empty() ) {
+        return EXIT_SUCCESS;
+    }
+
+    /* initialize base timestamp value before any forking */
+    initial_timestamp();
+
+    EventLoop event_loop;
+
+    WarmPool pool( event_loop, min( jobs, static_cast<unsigned int>( experiments.size() ) ), true );
+
+    size_t next = 0, finished = 0;
+    unsigned int failures = 0;
+
+    /* submit the next experiment (there are at most as many waiting as there
+       are shells, so the descriptors of the others needn't be held open) */
+    function<void(void)> submit_next = [&] () {
+        const size_t n = next++;
+        auto connection = make_shared< pair<UnixDomainSocket, UnixDomainSocket> >(
+            UnixDomainSocket::make_pair( SOCK_SEQPACKET ) );
+
+        {
+            TemporarilyUnprivileged tu;
+
+            FileDescriptor input( SystemCall( "open /dev/null", open( "/dev/null", O_RDONLY | O_CLOEXEC ) ) );
+            auto open_output = [&] ( const string & suffix ) {
+                const string filename = results + "/" + to_string( n ) + suffix;
+                return FileDescriptor( SystemCall( "open " + filename,
+                                                   open( filename.c_str(),
+                                                         O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666 ) ) );
+            };
+            FileDescriptor output = open_output( ".stdout" );
+            FileDescriptor error = open_output( ".stderr" );
+
+            const string prefix = results + "/" + to_string( n );
+            send_request( connection->first, experiments.at( n ).arguments, environment,
+                          input, output, error, prefix + ".uplink.log", prefix + ".downlink.log" );
+        }
+
+        const uint64_t start_time = fresh_timestamp();
+
+        pool.submit( move( connection->second ), [&, n, connection, start_time] () {
+                /* (the status is written before the shell says it's ready) */
+                const string status_string = connection->first.read();
+                const int status = connection->first.eof() ? EXIT_FAILURE : myatoi( status_string );
+
+                if ( status != EXIT_SUCCESS ) {
+                    failures++;
+                }
+
+                *summary << n << "\t" << status << "\t"
+                         << fixed << setprecision( 3 ) << ( fresh_timestamp() - start_time ) / 1000.0 << "\t"
+                         << experiments.at( n ).line << endl;
+
+                if ( next < experiments.size() ) {
+                    submit_next();
+                }
+
+                if ( ++finished == experiments.size() ) {
+                    cerr << "mm-pool: " << experiments.size() - failures << " of " << experiments.size()
+                         << " experiments succeeded (results in " << results << ")" << endl;
+                    return Result( ResultType::Exit, failures ? EXIT_FAILURE : EXIT_SUCCESS );
+                }
+
+                return Result( ResultType::Continue );
+            } );
+    };
+
+    for ( unsigned int i = 0; i < jobs and next < experiments.size(); i++ ) {
+        submit_next();
+    }
+
+    return event_loop.loop();
+}
+
+int main( int argc, char *argv[] )
+{
+    try {
+        Random::initialize();
+
+        /* clear environment while running as root */
+        char ** const user_environment = environ;
+        environ = nullptr;
+
+        check_requirements( argc, argv );
+
+        if ( argc < 4 ) {
+            usage( argv[ 0 ] );
+        }
+
+        const string mode = argv[ 1 ], path = argv[ 2 ];
+
+        if ( mode == "serve" and argc == 4 ) {
+            const long int count = myatoi( argv[ 3 ] );
+            if ( count <= 0 ) {
+                usage( argv[ 0 ] );
+            }
+
+            return serve( path, count );
+        } else if ( mode == "run" ) {
+            /* the client needs no privileges */
+            drop_privileges();
+            environ = user_environment;
+
+            return run( path, vector<string>( argv + 3, argv + argc ) );
+        } else if ( mode == "batch" and argc <= 5 ) {
+            const long int jobs = argc == 5 ? myatoi( argv[ 4 ] ) : WarmPool::available_cpus().size();
+            if ( jobs <= 0 ) {
+                usage( argv[ 0 ] );
+            }
+
+            return batch( path, argv[ 3 ], jobs, user_environment );
+        }
+
+        usage( argv[ 0 ] );
+        return EXIT_FAILURE;
+    } catch ( const exception & e ) {
+        print_exception( e );
+        return EXIT_FAILURE;
+    }
+}
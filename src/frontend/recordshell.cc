@@ -3,7 +3,7 @@
 #include <sys/socket.h>
 #include <sys/ioctl.h>
 #include <linux/if.h>
-#include <net/route.h>
+#include <getopt.h>
 
 #include "nat.hh"
 #include "util.hh"
@@ -12,29 +12,81 @@
 #include "dns_proxy.hh"
 #include "http_proxy.hh"
 #include "netdevice.hh"
+#include "netlink.hh"
+#include "system_runner.hh"
 #include "event_loop.hh"
 #include "socketpair.hh"
 #include "config.h"
 #include "backing_store.hh"
 #include "exception.hh"
+#include "ezio.hh"
+#include "setup_trace.hh"
 
 using namespace std;
 
+void usage_error( const string & program_name )
+{
+    throw runtime_error( "Usage: " + program_name + " [--spill-threshold=BYTES] [--workers=N] [--ca-dir=DIRECTORY] directory [command...]" );
+}
+
 int main( int argc, char *argv[] )
 {
     try {
+        SetupTrace::enable( "mm-webrecord" );
+
         /* clear environment */
         char **user_environment = environ;
         environ = nullptr;
 
         check_requirements( argc, argv );
 
-        if ( argc < 2 ) {
-            throw runtime_error( "Usage: " + string( argv[ 0 ] ) + " directory [command...]" );
+        const option command_line_options[] = {
+            { "spill-threshold",      required_argument, nullptr, 's' },
+            { "workers",              required_argument, nullptr, 'w' },
+            { "ca-dir",               required_argument, nullptr, 'c' },
+            { 0,                                      0, nullptr, 0 }
+        };
+
+        /* response bodies larger than this are recorded via a temporary file (0 = never) */
+        size_t body_spill_threshold = 0;
+
+        /* event-driven proxy worker threads (0 = a thread per connection) */
+        unsigned int worker_threads = 0;
+
+        /* local CA for per-server-name certificates ("" = one compiled-in certificate) */
+        string ca_directory;
+
+        while ( true ) {
+            /* "+": stop at the first non-option so the command keeps its own options */
+            const int opt = getopt_long( argc, argv, "+", command_line_options, nullptr );
+            if ( opt == -1 ) { /* end of options */
+                break;
+            }
+
+            switch ( opt ) {
+            case 's':
+                body_spill_threshold = myatoi( optarg );
+                break;
+            case 'w':
+                worker_threads = myatoi( optarg );
+                break;
+            case 'c':
+                ca_directory = optarg;
+                break;
+            case '?':
+                usage_error( argv[ 0 ] );
+                break;
+            default:
+                throw runtime_error( "getopt_long: unexpected return value " + to_string( opt ) );
+            }
+        }
+
+        if ( optind >= argc ) {
+            usage_error( argv[ 0 ] );
         }
 
         /* Make sure directory ends with '/' so we can prepend directory to file name for storage */
-        string directory( argv[ 1 ] );
+        string directory( argv[ optind ] );
 
         if ( directory.empty() ) {
             throw runtime_error( string( argv[ 0 ] ) + ": directory name must be non-empty" );
@@ -46,21 +98,24 @@ int main( int argc, char *argv[] )
 
         /* what command will we run inside the container? */
         vector < string > command;
-        if ( argc == 2 ) {
+        if ( optind + 1 == argc ) {
             command.push_back( shell_path() );
         } else {
-            for ( int i = 2; i < argc; i++ ) {
+            for ( int i = optind + 1; i < argc; i++ ) {
                 command.push_back( argv[ i ] );
             }
         }
 
+        SetupTrace::Phase phase( "nameserver" );
         const Address nameserver = first_nameserver();
 
         /* set egress and ingress ip addresses */
+        phase.next( "addresses" );
         Address egress_addr, ingress_addr;
         tie( egress_addr, ingress_addr ) = two_unassigned_addresses();
 
         /* make pair of devices */
+        phase.next( "veth devices" );
         string egress_name = "veth-" + to_string( getpid() ), ingress_name = "veth-i" + to_string( getpid() );
         VirtualEthernetPair veth_devices( egress_name, ingress_name );
 
@@ -68,47 +123,54 @@ int main( int argc, char *argv[] )
         assign_address( egress_name, egress_addr, ingress_addr );
 
         /* create DNS proxy */
+        phase.next( "DNS proxy" );
         DNSProxy dns_outside( egress_addr, nameserver, nameserver );
 
         /* set up NAT between egress and eth0 */
+        phase.next( "NAT" );
         NAT nat_rule( ingress_addr );
 
         /* set up http proxy for tcp */
-        HTTPProxy http_proxy( egress_addr );
+        phase.next( "HTTP proxy" );
+        HTTPProxy http_proxy( egress_addr, body_spill_threshold, worker_threads, ca_directory );
 
         /* set up dnat */
+        phase.next( "DNAT" );
         DNAT dnat( http_proxy.tcp_listener().local_address(), egress_name );
 
         /* prepare event loop */
         EventLoop outer_event_loop;
 
         /* Fork */
+        phase.next( "container" );
         {
             /* Make pipe for start signal */
             auto pipe = UnixDomainSocket::make_pair();
 
             ChildProcess container_process( "recordshell", [&]() {
+                    SetupTrace::forked( "container" );
+
                     /* wait for the go signal */
+                    SetupTrace::Phase container_phase( "wait for veth device" );
                     pipe.second.read();
 
+                    container_phase.next( "routes" );
+                    RTNetlink rtnetlink;
+
                     /* bring up localhost */
-                    interface_ioctl( SIOCSIFFLAGS, "lo",
-                                     [] ( ifreq &ifr ) { ifr.ifr_flags = IFF_UP; } );
+                    rtnetlink.set_link_up( "lo" );
 
                     /* bring up veth device */
-                    assign_address( ingress_name, ingress_addr, egress_addr );
+                    rtnetlink.add_address( ingress_name, ingress_addr, egress_addr );
+                    rtnetlink.set_link_up( ingress_name );
 
                     /* create default route */
-                    rtentry route;
-                    zero( route );
-
-                    route.rt_gateway = egress_addr.to_sockaddr();
-                    route.rt_dst = route.rt_genmask = Address().to_sockaddr();
-                    route.rt_flags = RTF_UP | RTF_GATEWAY;
+                    rtnetlink.add_default_route( egress_addr );
 
-                    SystemCall( "ioctl SIOCADDRT", ioctl( UDPSocket().fd_num(), SIOCADDRT, &route ) );
+                    rtnetlink.commit();
 
                     /* create DNS proxy if nameserver address is local */
+                    container_phase.next( "DNS proxy" );
                     auto dns_inside = DNSProxy::maybe_proxy( nameserver,
                                                              dns_outside.udp_listener().local_address(),
                                                              dns_outside.tcp_listener().local_address() );
@@ -119,10 +181,12 @@ int main( int argc, char *argv[] )
                     /* prepare child's event loop */
                     EventLoop shell_event_loop;
 
+                    container_phase.next( "command" );
                     shell_event_loop.add_child_process( join( command ), [&]() {
                             /* restore environment and tweak prompt */
                             environ = user_environment;
                             prepend_shell_prefix( "[record] " );
+                            SetupTrace::export_layer();
 
                             return ezexec( command, true );
                         } );
@@ -131,11 +195,16 @@ int main( int argc, char *argv[] )
                         dns_inside->register_handlers( shell_event_loop );
                     }
 
+                    container_phase.finish();
+                    SetupTrace::flush();
+
                     return shell_event_loop.loop();
                 }, true ); /* new network namespace */
 
             /* give ingress to container */
-            run( { IP, "link", "set", "dev", ingress_name, "netns", to_string( container_process.pid() ) } );
+            RTNetlink rtnetlink;
+            rtnetlink.move_link_to_namespace( ingress_name, container_process.pid() );
+            rtnetlink.commit();
             veth_devices.set_kernel_will_destroy();
 
             /* tell ChildProcess it's ok to proceed */
@@ -146,9 +215,13 @@ int main( int argc, char *argv[] )
         }
 
         /* do the actual recording in a different unprivileged child */
+        phase.next( "recorder" );
         outer_event_loop.add_child_process( "recorder", [&]() {
+                SetupTrace::forked( "recorder" );
+
                 drop_privileges();
 
+                SetupTrace::Phase recorder_phase( "backing store" );
                 make_directory( directory );
 
                 /* set up backing store to save to disk */
@@ -157,9 +230,16 @@ int main( int argc, char *argv[] )
                 EventLoop recordr_event_loop;
                 dns_outside.register_handlers( recordr_event_loop );
                 http_proxy.register_handlers( recordr_event_loop, disk_backing_store );
+
+                recorder_phase.finish();
+                SetupTrace::flush();
+
                 return recordr_event_loop.loop();
             } );
 
+        phase.finish();
+        SetupTrace::flush();
+
         return outer_event_loop.loop();
     } catch ( const exception & e ) {
         print_exception( e );
@@ -11,11 +11,10 @@
 
 #include "util.hh"
 #include "http_record.pb.h"
-#include "http_header.hh"
 #include "exception.hh"
-#include "http_request.hh"
 #include "http_response.hh"
 #include "file_descriptor.hh"
+#include "recording_index.hh"
 
 using namespace std;
 
@@ -28,43 +27,54 @@ string safe_getenv( const string & key )
     return value;
 }
 
+/* value of the stored request's first header with this name (nullptr if none) */
+const string * find_saved_header( const MahimahiProtobufs::HTTPMessage & saved_request,
+                                  const StringView & header_name )
+{
+    for ( const auto & header : saved_request.header() ) {
+        if ( HTTPMessage::equivalent_strings( header.key(), header_name ) ) {
+            return &header.value();
+        }
+    }
+
+    return nullptr;
+}
+
 /* does the actual HTTP header match this stored request? */
-bool header_match( const string & env_var_name,
-                   const string & header_name,
-                   const HTTPRequest & saved_request )
+bool header_match( const char * const env_var_name,
+                   const StringView & header_name,
+                   const MahimahiProtobufs::HTTPMessage & saved_request )
 {
-    const char * const env_value = getenv( env_var_name.c_str() );
+    const char * const env_value = getenv( env_var_name );
+    const string * const saved_value = find_saved_header( saved_request, header_name );
 
     /* case 1: neither header exists (OK) */
-    if ( (not env_value) and (not saved_request.has_header( header_name )) ) {
+    if ( (not env_value) and (not saved_value) ) {
         return true;
     }
 
     /* case 2: headers both exist (OK if values match) */
-    if ( env_value and saved_request.has_header( header_name ) ) {
-        return saved_request.get_header_value( header_name ) == string( env_value );
+    if ( env_value and saved_value ) {
+        return *saved_value == env_value;
     }
 
     /* case 3: one exists but the other doesn't (failure) */
     return false;
 }
 
-string strip_query( const string & request_line )
+StringView strip_query( const StringView & request_line )
 {
-    const auto index = request_line.find( "?" );
-    if ( index == string::npos ) {
-        return request_line;
-    } else {
-        return request_line.substr( 0, index );
-    }
+    return request_line.substr( 0, request_line.find( '?' ) );
 }
 
-/* compare request_line and certain headers of incoming request and stored request */
+/* compare request_line and certain headers of incoming request and stored request
+   (straight from the protobuf, which is scanned for every request) */
 unsigned int match_score( const MahimahiProtobufs::RequestResponse & saved_record,
                           const string & request_line,
                           const bool is_https )
 {
-    const HTTPRequest saved_request( saved_record.request() );
+    const MahimahiProtobufs::HTTPMessage & saved_request = saved_record.request();
+    const string & saved_first_line = saved_request.first_line();
 
     /* match HTTP/HTTPS */
     if ( is_https and (saved_record.scheme() != MahimahiProtobufs::RequestResponse_Scheme_HTTPS) ) {
@@ -86,14 +96,14 @@ unsigned int match_score( const MahimahiProtobufs::RequestResponse & saved_recor
     }
 
     /* must match first line up to "?" at least */
-    if ( strip_query( request_line ) != strip_query( saved_request.first_line() ) ) {
+    if ( strip_query( request_line ) != strip_query( saved_first_line ) ) {
         return 0;
     }
 
     /* success! return size of common prefix */
-    const auto max_match = min( request_line.size(), saved_request.first_line().size() );
+    const auto max_match = min( request_line.size(), saved_first_line.size() );
     for ( unsigned int i = 0; i < max_match; i++ ) {
-        if ( request_line.at( i ) != saved_request.first_line().at( i ) ) {
+        if ( request_line[ i ] != saved_first_line[ i ] ) {
             return i;
         }
     }
@@ -121,6 +131,10 @@ int main( void )
         MahimahiProtobufs::RequestResponse best_match;
 
         for ( const auto & filename : files ) {
+            if ( is_recording_index( filename ) ) {
+                continue;
+            }
+
             FileDescriptor fd( SystemCall( "open", open( filename.c_str(), O_RDONLY ) ) );
             MahimahiProtobufs::RequestResponse current_record;
             if ( not current_record.ParseFromFileDescriptor( fd.fd_num() ) ) {
@@ -1,6 +1,5 @@
 /* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
 
-#include <net/route.h>
 #include <fcntl.h>
 
 #include <vector>
@@ -8,34 +7,26 @@
 
 #include "util.hh"
 #include "netdevice.hh"
+#include "netlink.hh"
 #include "web_server.hh"
 #include "system_runner.hh"
 #include "socket.hh"
 #include "event_loop.hh"
-#include "temp_file.hh"
 #include "http_response.hh"
 #include "dns_server.hh"
+#include "recording_index.hh"
 #include "exception.hh"
-
-#include "http_record.pb.h"
+#include "setup_trace.hh"
 
 #include "config.h"
 
 using namespace std;
 
-void add_dummy_interface( const string & name, const Address & addr )
-{
-    run( { IP, "link", "add", name, "type", "dummy" } );
-
-    interface_ioctl( SIOCSIFFLAGS, name,
-                     [] ( ifreq &ifr ) { ifr.ifr_flags = IFF_UP; } );
-    interface_ioctl( SIOCSIFADDR, name,
-                     [&] ( ifreq &ifr ) { ifr.ifr_addr = addr.to_sockaddr(); } );
-}
-
 int main( int argc, char *argv[] )
 {
     try {
+        SetupTrace::enable( "mm-webreplay" );
+
         /* clear environment */
         char **user_environment = environ;
         environ = nullptr;
@@ -75,11 +66,9 @@ int main( int argc, char *argv[] )
         }
 
         /* create a new network namespace */
+        SetupTrace::Phase phase( "network namespace" );
         SystemCall( "unshare", unshare( CLONE_NEWNET ) );
 
-        /* bring up localhost */
-        interface_ioctl( SIOCSIFFLAGS, "lo",
-                         [] ( ifreq &ifr ) { ifr.ifr_flags = IFF_UP; } );
 
         /* provide seed for random number generator used to create apache pid files */
         srandom( time( NULL ) );
@@ -89,75 +78,77 @@ int main( int argc, char *argv[] )
         set< Address > unique_ip_and_port;
         vector< pair< string, Address > > hostname_to_ip;
 
+        phase.next( "recording index" );
         {
             TemporarilyUnprivileged tu;
             /* would be privilege escalation if we let the user read directories or open files as root */
 
-            const vector< string > files = list_directory_contents( directory  );
+            for ( const auto & record : summarize_recording( directory ) ) {
+                unique_ip.emplace( record.address.ip(), 0 );
+                unique_ip_and_port.emplace( record.address );
 
-            for ( const auto & filename : files ) {
-                FileDescriptor fd( SystemCall( "open", open( filename.c_str(), O_RDONLY ) ) );
-
-                MahimahiProtobufs::RequestResponse protobuf;
-                if ( not protobuf.ParseFromFileDescriptor( fd.fd_num() ) ) {
-                    throw runtime_error( filename + ": invalid HTTP request/response" );
-                }
-
-                const Address address( protobuf.ip(), protobuf.port() );
-
-                unique_ip.emplace( address.ip(), 0 );
-                unique_ip_and_port.emplace( address );
-
-                hostname_to_ip.emplace_back( HTTPRequest( protobuf.request() ).get_header_value( "Host" ),
-                                             address );
+                hostname_to_ip.emplace_back( record.host, record.address );
             }
         }
 
-        /* set up dummy interfaces */
-        unsigned int interface_counter = 0;
+        /* bring up localhost, and a dummy interface for each server and nameserver */
+        phase.next( "interfaces" );
+        const vector< Address > nameservers = all_nameservers();
+
+        vector< pair< string, Address > > dummy_interfaces;
         for ( const auto & ip : unique_ip ) {
-            add_dummy_interface( "sharded" + to_string( interface_counter ), ip );
-            interface_counter++;
+            dummy_interfaces.emplace_back( "sharded" + to_string( dummy_interfaces.size() ), ip );
         }
+        for ( unsigned int server_num = 0; server_num < nameservers.size(); server_num++ ) {
+            dummy_interfaces.emplace_back( "nameserver" + to_string( server_num ), nameservers.at( server_num ) );
+        }
+
+        RTNetlink rtnetlink;
+        rtnetlink.set_link_up( "lo" );
+        for ( const auto & interface : dummy_interfaces ) {
+            rtnetlink.add_dummy_link( interface.first );
+        }
+        for ( const auto & interface : dummy_interfaces ) {
+            rtnetlink.add_address( interface.first, interface.second, interface.second );
+        }
+        rtnetlink.commit();
 
         /* set up web servers */
+        phase.next( "web servers" );
         vector< WebServer > servers;
         for ( const auto & ip_port : unique_ip_and_port ) {
+            SetupTrace::Phase server_phase( "Apache on " + ip_port.str() );
             servers.emplace_back( ip_port, working_directory, directory );
         }
 
-        /* set up DNS server */
-        TempFile dnsmasq_hosts( "/tmp/replayshell_hosts" );
+        /* set up DNS server (a Host header may include a port) */
+        phase.next( "DNS server" );
+        DNSServer dns_server;
         for ( const auto & mapping : hostname_to_ip ) {
-            dnsmasq_hosts.write( mapping.second.ip() + " " + mapping.first + "\n" );
+            dns_server.add_host( mapping.first.substr( 0, mapping.first.find( ':' ) ), mapping.second );
         }
 
         /* initialize event loop */
         EventLoop event_loop;
 
-        /* create dummy interface for each nameserver */
-        vector< Address > nameservers = all_nameservers();
-        vector< string > dnsmasq_args = { "-H", dnsmasq_hosts.name() };
-
-        for ( unsigned int server_num = 0; server_num < nameservers.size(); server_num++ ) {
-            const string interface_name = "nameserver" + to_string( server_num );
-            add_dummy_interface( interface_name, nameservers.at( server_num ) );
-        }
-
-        /* start dnsmasq */
-        event_loop.add_child_process( start_dnsmasq( dnsmasq_args ) );
+        dns_server.register_handlers( event_loop );
 
         /* start shell */
+        phase.next( "command" );
         event_loop.add_child_process( join( command ), [&]() {
                 drop_privileges();
 
                 /* restore environment and tweak bash prompt */
                 environ = user_environment;
                 prepend_shell_prefix( "[replay] " );
+                SetupTrace::export_layer();
 
                 return ezexec( command, true );
         } );
 
+        phase.finish();
+        SetupTrace::flush();
+
         return event_loop.loop();
     } catch ( const exception & e ) {
         print_exception( e );
@@ -0,0 +1,134 @@
+/* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <algorithm>
+#include <limits>
+
+#include "timing_wheel.hh"
+
+using namespace std;
+
+TimingWheel::TimingWheel( const uint64_t start_time, const unsigned int slots_log2 )
+    : slots_( uint64_t( 1 ) << slots_log2 ),
+      mask_( ( uint64_t( 1 ) << slots_log2 ) - 1 ),
+      cursor_( start_time ),
+      size_( 0 ),
+      next_release_( 0 ),
+      next_release_known_( false )
+{}
+
+void TimingWheel::insert( const uint64_t release_time, string && contents )
+{
+    const uint64_t time = max( release_time, cursor_ );
+
+    slot( time ).push_back( Entry { time, move( contents ) } );
+
+    if ( size_ == 0 or ( next_release_known_ and time < next_release_ ) ) {
+        next_release_ = time;
+        next_release_known_ = true;
+    }
+
+    size_++;
+}
+
+void TimingWheel::release( const uint64_t now, const function<void(const string &)> & deliver )
+{
+    if ( now < cursor_ ) {
+        return;
+    }
+
+    if ( size_ == 0 ) {
+        cursor_ = now;
+        return;
+    }
+
+    if ( now - cursor_ >= slots_.size() ) {
+        /* more than a turn has passed, so a slot may hold packets due at
+           different times: gather them all and put them in order */
+        vector<Entry> due;
+        for ( auto & packets : slots_ ) {
+            deque<Entry> later;
+            for ( auto & entry : packets ) {
+                if ( entry.release_time <= now ) {
+                    due.push_back( move( entry ) );
+                } else {
+                    later.push_back( move( entry ) );
+                }
+            }
+            packets.swap( later );
+        }
+
+        stable_sort( due.begin(), due.end(),
+                     [] ( const Entry & a, const Entry & b ) { return a.release_time < b.release_time; } );
+
+        size_ -= due.size();
+        for ( const auto & entry : due ) {
+            deliver( entry.contents );
+        }
+    } else {
+        /* each slot visited now holds this turn's packets (all due) and later turns' */
+        for ( uint64_t time = cursor_; time <= now; time++ ) {
+            auto & packets = slot( time );
+            if ( packets.empty() ) {
+                continue;
+            }
+
+            const bool all_due = all_of( packets.begin(), packets.end(),
+                                         [&] ( const Entry & entry ) { return entry.release_time <= now; } );
+
+            if ( all_due ) {
+                size_ -= packets.size();
+                for ( const auto & entry : packets ) {
+                    deliver( entry.contents );
+                }
+                packets.clear();
+            } else {
+                deque<Entry> later;
+                for ( auto & entry : packets ) {
+                    if ( entry.release_time <= now ) {
+                        size_--;
+                        deliver( entry.contents );
+                    } else {
+                        later.push_back( move( entry ) );
+                    }
+                }
+                packets.swap( later );
+            }
+        }
+    }
+
+    cursor_ = now;
+
+    if ( next_release_known_ and next_release_ <= now ) {
+        next_release_known_ = false;
+    }
+}
+
+uint64_t TimingWheel::next_release_time( void ) const
+{
+    if ( next_release_known_ ) {
+        return next_release_;
+    }
+
+    /* the first slot ahead holding a packet due in this turn */
+    for ( uint64_t time = cursor_; time < cursor_ + slots_.size(); time++ ) {
+        for ( const auto & entry : slot( time ) ) {
+            if ( entry.release_time == time ) {
+                next_release_ = time;
+                next_release_known_ = true;
+                return next_release_;
+            }
+        }
+    }
+
+    /* every packet is more than a turn away */
+    uint64_t earliest = numeric_limits<uint64_t>::max();
+    for ( const auto & packets : slots_ ) {
+        for ( const auto & entry : packets ) {
+            earliest = min( earliest, entry.release_time );
+        }
+    }
+
+    next_release_ = earliest;
+    next_release_known_ = true;
+    return next_release_;
+}
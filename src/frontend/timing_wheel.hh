@@ -0,0 +1,58 @@
+/* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef TIMING_WHEEL_HH
+#define TIMING_WHEEL_HH
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <cstdint>
+#include <functional>
+
+/* packets held until a release time (in ms), in any order of release
+   times: a ring of one-millisecond slots, each holding the packets due at
+   the times that map to it. Inserting a packet is O(1); releasing visits
+   each slot once per elapsed millisecond, so both stay O(1) amortized
+   however many packets are in flight. Packets due at the same time leave
+   in the order they arrived. */
+class TimingWheel
+{
+private:
+    struct Entry
+    {
+        uint64_t release_time;
+        std::string contents;
+    };
+
+    std::vector<std::deque<Entry>> slots_;
+    uint64_t mask_;
+
+    /* every packet due before this time has been released */
+    uint64_t cursor_;
+    size_t size_;
+
+    /* the earliest release time, when known */
+    mutable uint64_t next_release_;
+    mutable bool next_release_known_;
+
+    std::deque<Entry> & slot( const uint64_t time ) { return slots_[ time & mask_ ]; }
+    const std::deque<Entry> & slot( const uint64_t time ) const { return slots_[ time & mask_ ]; }
+
+public:
+    /* the ring spans 2^slots_log2 ms; later packets wait for the ring to come round */
+    TimingWheel( const uint64_t start_time, const unsigned int slots_log2 = 12 );
+
+    /* a time already released is taken as the current time */
+    void insert( const uint64_t release_time, std::string && contents );
+
+    /* deliver every packet due by now, earliest first */
+    void release( const uint64_t now, const std::function<void(const std::string &)> & deliver );
+
+    bool empty( void ) const { return size_ == 0; }
+    size_t size( void ) const { return size_; }
+
+    /* the earliest release time of a packet held (the wheel must not be empty) */
+    uint64_t next_release_time( void ) const;
+};
+
+#endif /* TIMING_WHEEL_HH */
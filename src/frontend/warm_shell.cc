@@ -0,0 +1,567 @@
+/* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <sstream>
+#include <fstream>
+#include <algorithm>
+#include <csignal>
+
+#include <unistd.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+
+#include "warm_shell.hh"
+#include "any_ferry_queue.hh"
+#include "delay_queue.hh"
+#include "loss_queue.hh"
+#include "link_queue.hh"
+#include "dns_server.hh"
+#include "netlink.hh"
+#include "interfaces.hh"
+#include "system_runner.hh"
+#include "util.hh"
+#include "ezio.hh"
+#include "exception.hh"
+
+using namespace std;
+using namespace PollerShortNames;
+
+/* requests are lists of strings, each list a count and then the strings,
+   all null-terminated */
+
+static void append_list( string & message, const vector<string> & list )
+{
+    message.append( to_string( list.size() ) ).push_back( 0 );
+    for ( const auto & x : list ) {
+        message.append( x ).push_back( 0 );
+    }
+}
+
+static string next_string( const string & message, size_t & offset )
+{
+    const size_t end = message.find( char( 0 ), offset );
+    if ( end == string::npos ) {
+        throw runtime_error( "PoolRequest: truncated message" );
+    }
+
+    const string ret = message.substr( offset, end - offset );
+    offset = end + 1;
+    return ret;
+}
+
+static vector<string> next_list( const string & message, size_t & offset )
+{
+    vector<string> ret( myatoi( next_string( message, offset ) ) );
+    for ( auto & x : ret ) {
+        x = next_string( message, offset );
+    }
+    return ret;
+}
+
+PoolRequest::PoolRequest( const string & message )
+{
+    size_t offset = 0;
+    arguments = next_list( message, offset );
+    working_directory = next_string( message, offset );
+    environment = next_list( message, offset );
+    uplink_log = next_string( message, offset );
+    downlink_log = next_string( message, offset );
+}
+
+string PoolRequest::str( void ) const
+{
+    string ret;
+    append_list( ret, arguments );
+    ret.append( working_directory ).push_back( 0 );
+    append_list( ret, environment );
+    ret.append( uplink_log ).push_back( 0 );
+    ret.append( downlink_log ).push_back( 0 );
+    return ret;
+}
+
+/* the queues each way, as the corresponding mm- shells would have them */
+struct Emulation
+{
+    AnyFerryQueue uplink, downlink;
+    string shell_prefix;
+};
+
+static runtime_error usage_error( void )
+{
+    return runtime_error( "Usage: one or more of delay DELAY-MS | loss uplink|downlink RATE"
+                         " | link UPLINK-TRACE DOWNLINK-TRACE [--once]"
+                         " [--uplink-log=FILENAME] [--downlink-log=FILENAME]"
+                         " [--uplink-queue=QUEUE_TYPE] [--uplink-queue-args=QUEUE_ARGS]"
+                         " [--downlink-queue=QUEUE_TYPE] [--downlink-queue-args=QUEUE_ARGS]"
+                         ", then [--] [COMMAND...]" );
+}
+
+/* the queues of the link given by the first of the arguments (which are
+   removed), appended to the stages each way */
+static void add_link( vector<string> & arguments, const string & command_line,
+                      const PoolRequest & request,
+                      vector<AnyFerryQueue> & uplink, vector<AnyFerryQueue> & downlink,
+                      string & shell_prefix )
+{
+    const string kind = arguments.front();
+
+    if ( kind == "delay" and arguments.size() >= 2 ) {
+        const uint64_t delay_ms = myatoi( arguments.at( 1 ) );
+        arguments.erase( arguments.begin(), arguments.begin() + 2 );
+
+        uplink.push_back( AnyFerryQueue::make<DelayQueue>( delay_ms ) );
+        downlink.push_back( AnyFerryQueue::make<DelayQueue>( delay_ms ) );
+        shell_prefix += "[delay " + to_string( delay_ms ) + " ms] ";
+    } else if ( kind == "loss" and arguments.size() >= 3 ) {
+        const string link = arguments.at( 1 ), rate = arguments.at( 2 );
+        const double loss_rate = myatof( rate );
+        arguments.erase( arguments.begin(), arguments.begin() + 3 );
+
+        if ( not ( (0 <= loss_rate) and (loss_rate <= 1) ) ) {
+            throw runtime_error( "loss rate must be between 0 and 1" );
+        }
+
+        if ( link != "uplink" and link != "downlink" ) {
+            throw usage_error();
+        }
+
+        const bool is_uplink = link == "uplink";
+        uplink.push_back( AnyFerryQueue::make<IIDLoss>( is_uplink ? loss_rate : 0 ) );
+        downlink.push_back( AnyFerryQueue::make<IIDLoss>( is_uplink ? 0 : loss_rate ) );
+        shell_prefix += string( "[loss " ) + ( is_uplink ? "up=" : "down=" ) + rate + "] ";
+    } else if ( kind == "link" and arguments.size() >= 3 ) {
+        const string uplink_filename = arguments.at( 1 ), downlink_filename = arguments.at( 2 );
+        arguments.erase( arguments.begin(), arguments.begin() + 3 );
+
+        bool repeat = true;
+        string uplink_logfile = request.uplink_log, downlink_logfile = request.downlink_log;
+        string uplink_queue_type = "infinite", downlink_queue_type = "infinite",
+            uplink_queue_args, downlink_queue_args;
+        GraphOutput graph_output; /* (there's no display, so only to files) */
+
+        /* (a "--" is left to end the links) */
+        while ( not arguments.empty() and arguments.front().substr( 0, 2 ) == "--"
+                and arguments.front() != "--" ) {
+            const string option = arguments.front();
+            arguments.erase( arguments.begin() );
+
+            const size_t equals = option.find( '=' );
+            const string name = option.substr( 0, equals );
+            const string value = equals == string::npos ? "" : option.substr( equals + 1 );
+
+            if ( option == "--once" ) {
+                repeat = false;
+            } else if ( name == "--uplink-log" ) {
+                uplink_logfile = value;
+            } else if ( name == "--downlink-log" ) {
+                downlink_logfile = value;
+            } else if ( name == "--uplink-queue" ) {
+                uplink_queue_type = value;
+            } else if ( name == "--downlink-queue" ) {
+                downlink_queue_type = value;
+            } else if ( name == "--uplink-queue-args" ) {
+                uplink_queue_args = value;
+            } else if ( name == "--downlink-queue-args" ) {
+                downlink_queue_args = value;
+            } else if ( name == "--meter-output" ) {
+                graph_output.directory = value;
+            } else if ( name == "--meter-format" ) {
+                graph_output.format = value;
+            } else if ( name == "--meter-interval" ) {
+                graph_output.interval_ms = myatoi( value );
+            } else {
+                throw runtime_error( "unknown option " + option );
+            }
+        }
+
+        /* meter both directions, if there's somewhere for the meters to go */
+        const bool meter = graph_output.headless();
+
+        uplink.push_back( make_link_queue( uplink_queue_type, uplink_queue_args,
+                                           "Uplink", uplink_filename, uplink_logfile, repeat, meter, meter,
+                                           graph_output, command_line ) );
+        downlink.push_back( make_link_queue( downlink_queue_type, downlink_queue_args,
+                                             "Downlink", downlink_filename, downlink_logfile, repeat, meter, meter,
+                                             graph_output, command_line ) );
+        shell_prefix += "[link] ";
+    } else {
+        throw usage_error();
+    }
+}
+
+static AnyFerryQueue in_series( vector<AnyFerryQueue> && stages )
+{
+    if ( stages.size() == 1 ) {
+        return move( stages.front() );
+    }
+
+    return AnyFerryQueue::make<FerryQueueSeries>( move( stages ) );
+}
+
+/* the links asked for by the first of the arguments (which are removed,
+   leaving the command), combined as if each were a shell nested in the
+   one before: packets from the command cross the last link first, and
+   packets to it the first */
+static Emulation make_emulation( vector<string> & arguments, const PoolRequest & request )
+{
+    const string command_line = join( arguments ); /* for the log files */
+
+    vector<AnyFerryQueue> uplink, downlink;
+    string shell_prefix;
+
+    while ( not arguments.empty() ) {
+        const string kind = arguments.front();
+
+        if ( kind == "--" ) {
+            arguments.erase( arguments.begin() );
+            break;
+        } else if ( kind != "delay" and kind != "loss" and kind != "link" ) {
+            break;
+        }
+
+        add_link( arguments, command_line, request, uplink, downlink, shell_prefix );
+    }
+
+    if ( uplink.empty() ) {
+        throw usage_error();
+    }
+
+    reverse( uplink.begin(), uplink.end() );
+
+    return Emulation { in_series( move( uplink ) ), in_series( move( downlink ) ), shell_prefix };
+}
+
+/* the event loop for one command, ferrying packets both ways */
+class JobFerry : public EventLoop
+{
+public:
+    int loop( Emulation & emulation, FileDescriptor & ingress_tun, FileDescriptor & egress_tun,
+              FileDescriptor & client, FileDescriptor & control );
+};
+
+int JobFerry::loop( Emulation & emulation, FileDescriptor & ingress_tun, FileDescriptor & egress_tun,
+                    FileDescriptor & client, FileDescriptor & control )
+{
+    /* uplink: ingress TUN -> queue -> egress TUN */
+    add_simple_input_handler( ingress_tun,
+                              [&] () {
+                                  emulation.uplink.read_packet( ingress_tun.read() );
+                                  return ResultType::Continue;
+                              } );
+
+    add_action( Poller::Action( egress_tun, Direction::Out,
+                                [&] () {
+                                    emulation.uplink.write_packets( egress_tun );
+                                    return ResultType::Continue;
+                                },
+                                [&] () { return emulation.uplink.pending_output(); } ) );
+
+    /* downlink: egress TUN -> queue -> ingress TUN */
+    add_simple_input_handler( egress_tun,
+                              [&] () {
+                                  emulation.downlink.read_packet( egress_tun.read() );
+                                  return ResultType::Continue;
+                              } );
+
+    add_action( Poller::Action( ingress_tun, Direction::Out,
+                                [&] () {
+                                    emulation.downlink.write_packets( ingress_tun );
+                                    return ResultType::Continue;
+                                },
+                                [&] () { return emulation.downlink.pending_output(); } ) );
+
+    /* exit if a trace has run out */
+    add_action( Poller::Action( egress_tun, Direction::Out,
+                                [&] () { return ResultType::Exit; },
+                                [&] () { return emulation.uplink.finished() or emulation.downlink.finished(); } ) );
+
+    /* the client and the pool shouldn't send anything now, but if either
+       hangs up, the poller quits, and the command is killed */
+    add_simple_input_handler( client, [&] () { client.read(); return ResultType::Continue; } );
+    add_simple_input_handler( control, [&] () { control.read(); return ResultType::Continue; } );
+
+    return internal_loop( [&] () { return min( emulation.uplink.wait_time(),
+                                               emulation.downlink.wait_time() ); } );
+}
+
+/* the processes whose parent is this one */
+static vector<pid_t> children( void )
+{
+    vector<pid_t> ret;
+
+    for ( const auto & directory : list_directory_contents( "/proc/" ) ) {
+        const string name = directory.substr( 6 );
+        if ( name.find_first_not_of( "0123456789" ) != string::npos ) {
+            continue;
+        }
+
+        /* "PID (COMMAND) STATE PPID ...", where COMMAND may hold anything */
+        ifstream stat_file( directory + "/stat" );
+        string stat;
+        if ( not getline( stat_file, stat ) ) {
+            continue; /* (it has gone away) */
+        }
+
+        istringstream fields( stat.substr( stat.rfind( ')' ) + 1 ) );
+        string state;
+        pid_t parent;
+        if ( fields >> state >> parent and parent == getpid() ) {
+            ret.push_back( myatoi( name ) );
+        }
+    }
+
+    return ret;
+}
+
+/* kill whatever a command left running (in the background, or in a
+   session of its own): as a child subreaper, the container inherits
+   each of the command's processes whose parent has gone, so killing its
+   children until it has none gets them all */
+static void kill_descendants( void )
+{
+    for ( vector<pid_t> pids = children(); not pids.empty(); pids = children() ) {
+        for ( const pid_t pid : pids ) {
+            kill( pid, SIGKILL );
+        }
+
+        for ( const pid_t pid : pids ) {
+            waitpid( pid, nullptr, 0 );
+        }
+    }
+}
+
+WarmShell::WarmShell( const string & device_name )
+    : egress_ingress_( two_unassigned_addresses() ),
+      nameserver_( first_nameserver() ),
+      egress_tun_( device_name, egress_addr(), ingress_addr() ),
+      dns_outside_( egress_addr(), nameserver_, nameserver_ ),
+      nat_rule_( ingress_addr() ),
+      control_( UnixDomainSocket::make_pair( SOCK_SEQPACKET ) )
+{}
+
+void WarmShell::start( EventLoop & event_loop, const int cpu )
+{
+    event_loop.add_child_process( "warm shell", [&, cpu] () {
+            if ( cpu >= 0 ) {
+                cpu_set_t cpus;
+                CPU_ZERO( &cpus );
+                CPU_SET( cpu, &cpus );
+                SystemCall( "sched_setaffinity", sched_setaffinity( 0, sizeof( cpus ), &cpus ) );
+            }
+
+            TunDevice ingress_tun( "ingress", ingress_addr(), egress_addr() );
+
+            /* bring up localhost and create default route */
+            RTNetlink rtnetlink;
+            rtnetlink.set_link_up( "lo" );
+            rtnetlink.add_default_route( egress_addr() );
+            rtnetlink.commit();
+
+            /* run a local caching nameserver, forwarding to the DNS proxy outside */
+            DNSServer dns_server;
+            dns_server.forward_to( dns_outside_.udp_listener().local_address(),
+                                   dns_outside_.tcp_listener().local_address() );
+
+            drop_privileges();
+
+            /* a client that has gone away shouldn't take the container with it */
+            if ( signal( SIGPIPE, SIG_IGN ) == SIG_ERR ) {
+                throw unix_error( "signal" );
+            }
+
+            /* adopt the commands' orphans, so they can be killed along with the command */
+            SystemCall( "prctl", prctl( PR_SET_CHILD_SUBREAPER, 1 ) );
+
+            return serve( ingress_tun, dns_server );
+        }, true );  /* new network namespace */
+}
+
+int WarmShell::serve( FileDescriptor & ingress_tun, DNSServer & dns_server )
+{
+    EventLoop event_loop;
+
+    sigset_t sigchld;
+    SystemCall( "sigemptyset", sigemptyset( &sigchld ) );
+    SystemCall( "sigaddset", sigaddset( &sigchld, SIGCHLD ) );
+
+    event_loop.add_simple_input_handler( control_.second, [&] () {
+            UnixDomainSocket client( control_.second.recv_fd() );
+
+            try {
+                const int status = run( client, ingress_tun, dns_server );
+                client.write( to_string( status ) );
+            } catch ( const exception & e ) {
+                /* (e.g., the client has gone away) */
+                print_exception( e );
+            }
+
+            /* leave nothing of this experiment to the next */
+            kill_descendants();
+            dns_server.forget();
+
+            /* the command has been waited for, but its SIGCHLD (and those of
+               what it left behind) may still be pending, and this loop has
+               no children to expect them */
+            const timespec no_wait { 0, 0 };
+            while ( sigtimedwait( &sigchld, nullptr, &no_wait ) == SIGCHLD ) {}
+
+            try {
+                control_.second.write( "ready" );
+            } catch ( const exception & ) {
+                return ResultType::Exit; /* the pool has gone away */
+            }
+
+            return ResultType::Continue;
+        } );
+
+    control_.second.write( "ready" );
+
+    /* until the pool hangs up */
+    return event_loop.loop();
+}
+
+int WarmShell::run( UnixDomainSocket & client, FileDescriptor & ingress_tun, DNSServer & dns_server )
+{
+    /* the request, then the client's stdin, stdout and stderr */
+    const PoolRequest request( client.read() );
+    FileDescriptor standard_input = client.recv_fd(), standard_output = client.recv_fd(),
+        standard_error = client.recv_fd();
+
+    try {
+        SystemCall( "chdir", chdir( request.working_directory.c_str() ) );
+
+        vector<string> command = request.arguments;
+        Emulation emulation = make_emulation( command, request );
+
+        if ( command.empty() ) {
+            command.push_back( shell_path() );
+        }
+
+        JobFerry ferry;
+
+        dns_server.register_handlers( ferry );
+        dns_outside_.register_handlers( ferry );
+
+        ferry.add_child_process( join( command ), [&] () {
+                SystemCall( "dup2", dup2( standard_input.fd_num(), STDIN_FILENO ) );
+                SystemCall( "dup2", dup2( standard_output.fd_num(), STDOUT_FILENO ) );
+                SystemCall( "dup2", dup2( standard_error.fd_num(), STDERR_FILENO ) );
+
+                /* away from the pool's terminal */
+                SystemCall( "setsid", setsid() );
+
+                if ( signal( SIGPIPE, SIG_DFL ) == SIG_ERR ) {
+                    throw unix_error( "signal" );
+                }
+
+                /* the client's environment */
+                vector<string> environment = request.environment;
+                vector<char *> env;
+                for ( auto & x : environment ) {
+                    env.push_back( &x[ 0 ] );
+                }
+                env.push_back( nullptr );
+                environ = &env[ 0 ];
+
+                SystemCall( "setenv", setenv( "MAHIMAHI_BASE",
+                                              egress_addr().ip().c_str(),
+                                              false /* don't override */ ) );
+
+                prepend_shell_prefix( emulation.shell_prefix );
+
+                return ezexec( command, true );
+            } );
+
+        return ferry.loop( emulation, ingress_tun, egress_tun_, client, control_.second );
+    } catch ( const exception & e ) {
+        ostringstream message;
+        print_exception( e, message );
+
+        try {
+            standard_error.write( message.str() );
+        } catch ( const exception & ) {}
+
+        return EXIT_FAILURE;
+    }
+}
+
+WarmShell::~WarmShell()
+{
+    /* the container quits when it sees its end hang up
+       (this affects its copies in other containers too) */
+    shutdown( control_.first.fd_num(), SHUT_RDWR );
+}
+
+WarmPool::WarmPool( EventLoop & event_loop, const unsigned int count, const bool pin_to_cpus,
+                    const function<void(void)> & started )
+    : starting_( count ),
+      started_( started )
+{
+    const vector<int> cpus = available_cpus();
+
+    for ( unsigned int i = 0; i < count; i++ ) {
+        shells_.emplace_back( new WarmShell( "pool-" + to_string( getpid() ) + "-" + to_string( i ) ) );
+        WarmShell * const shell = shells_.back().get();
+
+        shell->start( event_loop, pin_to_cpus ? cpus.at( i % cpus.size() ) : -1 );
+
+        event_loop.add_simple_input_handler( shell->control(), [&, shell] () {
+                shell->control().read(); /* "ready" */
+
+                const auto running = running_.find( shell );
+                Poller::Action::CallbackType done;
+                if ( running != running_.end() ) {
+                    done = running->second;
+                    running_.erase( running );
+                }
+
+                ready_.push_back( shell );
+                dispatch();
+
+                if ( done ) {
+                    return done();
+                }
+
+                /* it has just started */
+                if ( --starting_ == 0 ) {
+                    started_();
+                }
+                return Result( ResultType::Continue );
+            } );
+    }
+}
+
+void WarmPool::dispatch( void )
+{
+    while ( not ready_.empty() and not waiting_.empty() ) {
+        WarmShell * const shell = ready_.front();
+        shell->dispatch( waiting_.front().first );
+        running_[ shell ] = waiting_.front().second;
+
+        ready_.pop_front();
+        waiting_.pop_front();
+    }
+}
+
+void WarmPool::submit( UnixDomainSocket && connection, const Poller::Action::CallbackType & done )
+{
+    waiting_.emplace_back( move( connection ), done );
+    dispatch();
+}
+
+vector<int> WarmPool::available_cpus( void )
+{
+    cpu_set_t cpus;
+    CPU_ZERO( &cpus );
+    SystemCall( "sched_getaffinity", sched_getaffinity( 0, sizeof( cpus ), &cpus ) );
+
+    vector<int> ret;
+    for ( int i = 0; i < CPU_SETSIZE; i++ ) {
+        if ( CPU_ISSET( i, &cpus ) ) {
+            ret.push_back( i );
+        }
+    }
+
+    return ret;
+}
@@ -0,0 +1,110 @@
+/* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef WARM_SHELL_HH
+#define WARM_SHELL_HH
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <functional>
+
+#include "netdevice.hh"
+#include "nat.hh"
+#include "address.hh"
+#include "dns_proxy.hh"
+#include "event_loop.hh"
+#include "socketpair.hh"
+
+class DNSServer;
+
+/* what a client asks of the pool: the arguments of one or more mm-
+   shells ("delay 50 [command...]", "delay 50 link UPLINK DOWNLINK
+   [options] [command...]") plus the client's working directory and
+   environment, and where a link should log each way unless its options
+   say (nowhere, if empty) */
+struct PoolRequest
+{
+    std::vector<std::string> arguments {};
+    std::string working_directory {};
+    std::vector<std::string> environment {};
+    std::string uplink_log {}, downlink_log {};
+
+    PoolRequest() {}
+    PoolRequest( const std::string & message );
+
+    std::string str( void ) const;
+};
+
+/* a container set up as PacketShell sets one up (addresses, TUN devices,
+   NAT and DNS), but kept around to run one command after another, each
+   over a link configured for it. Between commands, it waits for the
+   pool to hand it a client's connection. */
+class WarmShell
+{
+private:
+    std::pair<Address, Address> egress_ingress_;
+    Address nameserver_;
+    TunDevice egress_tun_;
+    DNSProxy dns_outside_;
+    NAT nat_rule_;
+
+    /* first is the pool's end, second the container's */
+    std::pair<UnixDomainSocket, UnixDomainSocket> control_;
+
+    const Address & egress_addr( void ) const { return egress_ingress_.first; }
+    const Address & ingress_addr( void ) const { return egress_ingress_.second; }
+
+    /* in the container */
+    int serve( FileDescriptor & ingress_tun, DNSServer & dns_server );
+    int run( UnixDomainSocket & client, FileDescriptor & ingress_tun, DNSServer & dns_server );
+
+public:
+    WarmShell( const std::string & device_name );
+
+    /* start the container (it writes to control() when ready for a client),
+       on the given CPU if cpu isn't negative */
+    void start( EventLoop & event_loop, const int cpu = -1 );
+
+    /* hand a client's connection to the (ready) container */
+    void dispatch( UnixDomainSocket & client ) { control_.first.send_fd( client ); }
+
+    UnixDomainSocket & control( void ) { return control_.first; }
+
+    /* tells the container to quit */
+    ~WarmShell();
+
+    WarmShell( const WarmShell & other ) = delete;
+    WarmShell & operator=( const WarmShell & other ) = delete;
+};
+
+/* WarmShells, each given the next client waiting when it's free */
+class WarmPool
+{
+private:
+    std::vector< std::unique_ptr<WarmShell> > shells_ {};
+    std::deque< WarmShell * > ready_ {};
+    std::deque< std::pair<UnixDomainSocket, Poller::Action::CallbackType> > waiting_ {};
+    std::map< WarmShell *, Poller::Action::CallbackType > running_ {};
+    unsigned int starting_;
+    std::function<void(void)> started_;
+
+    void dispatch( void );
+
+public:
+    /* with pin_to_cpus, each shell (and its commands) gets a CPU of its own,
+       as far as there are CPUs to go around; started is called once all
+       the shells are first ready */
+    WarmPool( EventLoop & event_loop, const unsigned int count, const bool pin_to_cpus,
+              const std::function<void(void)> & started = [] () {} );
+
+    /* run the request on the connection in the next free shell, and call
+       done when it has finished (and written its status to the client) */
+    void submit( UnixDomainSocket && connection, const Poller::Action::CallbackType & done );
+
+    /* the CPUs this process may run on */
+    static std::vector<int> available_cpus( void );
+};
+
+#endif /* WARM_SHELL_HH */
@@ -2,6 +2,8 @@
 
 #include <cmath>
 #include <cassert>
+#include <chrono>
+#include <stdexcept>
 
 #include "binned_livegraph.hh"
 #include "timestamp.hh"
@@ -9,121 +11,311 @@
 
 using namespace std;
 
+/* completed bins the animation thread can fall behind by (more are dropped) */
+static const size_t RING_SIZE = 1024;
+
+/* enough for the renderer to sleep through a couple of intervals (bins
+   written straight to a file don't use the ring) */
+static size_t ring_size( const GraphOutput & output, const unsigned int bin_width_ms )
+{
+    if ( not output.headless() ) {
+        return RING_SIZE;
+    } else if ( output.format == "csv" or not output.interval_ms ) {
+        return 1;
+    }
+
+    return max( RING_SIZE, size_t( 2 * output.interval_ms / bin_width_ms + 1 ) );
+}
+
 BinnedLiveGraph::BinnedLiveGraph( const string & name,
                                   const Graph::StylesType & styles,
                                   const string & y_label,
                                   const double multiplier,
                                   const bool rate_quantity,
                                   const unsigned int bin_width_ms,
-                                  const function<void(int,int&)> initialize_new_bin )
-    : graph_( 640, 480, name, 0, 1, styles, "time (s)", y_label ),
+                                  const function<void(int,int&)> initialize_new_bin,
+                                  const GraphOutput & output,
+                                  const string & file_name,
+                                  const vector<string> & series_names )
+    : graph_(),
       bin_width_ms_( bin_width_ms ),
-      value_this_bin_( styles.size() ),
+      num_series_( styles.size() ),
+      value_this_bin_( new atomic<int>[ num_series_ ] ),
       current_bin_( timestamp() / bin_width_ms_ ),
       multiplier_( multiplier ),
       rate_quantity_( rate_quantity ),
-      mutex_(),
+      completed_bins_( ring_size( output, bin_width_ms ),
+                       CompletedBin { 0, vector<float>( num_series_ ) } ),
+      dropped_bins_( 0 ),
+      image_graph_(),
+      lines_( styles.size() ),
+      filename_( output.directory + "/" + file_name + "." + output.format ),
+      render_interval_ms_( output.interval_ms ),
+      csv_(),
       halt_( false ),
+      render_mutex_(),
+      render_wakeup_(),
       animation_thread_exception_(),
-      animation_thread_( [&] () {
-              try {
-                  animation_loop();
-              } catch ( ... ) {
-                  animation_thread_exception_ = current_exception();
-              } } ),
+      animation_thread_(),
       initialize_new_bin_( initialize_new_bin )
 {
-    for ( unsigned int i = 0; i < value_this_bin_.size(); i++ ) {
-        graph_.add_data_point( i, 0, 0 );
+    for ( unsigned int i = 0; i < num_series_; i++ ) {
+        value_this_bin_[ i ] = 0;
+    }
+
+    if ( not output.headless() ) {
+        graph_.reset( new Graph( 640, 480, name, 0, 1, styles, "time (s)", y_label ) );
+
+        for ( unsigned int i = 0; i < num_series_; i++ ) {
+            graph_->add_data_point( i, 0, 0 );
+        }
+
+        animation_thread_ = thread( [&] () {
+                try {
+                    animation_loop();
+                } catch ( ... ) {
+                    animation_thread_exception_ = current_exception();
+                } } );
+    } else if ( output.format == "png" or output.format == "svg" ) {
+        image_graph_.reset( new ImageGraph( name, styles, "time (s)", y_label ) );
+
+        if ( render_interval_ms_ ) {
+            animation_thread_ = thread( [&] () {
+                    try {
+                        render_loop();
+                    } catch ( ... ) {
+                        animation_thread_exception_ = current_exception();
+                    } } );
+        }
+    } else if ( output.format == "csv" ) {
+        csv_.reset( new ofstream( filename_ ) );
+        if ( not csv_->good() ) {
+            throw runtime_error( filename_ + ": error opening for writing" );
+        }
+
+        *csv_ << "# " << name << ": " << y_label << " per " << bin_width_ms_ << " ms bin" << endl;
+        *csv_ << "time (s)";
+        for ( unsigned int i = 0; i < num_series_; i++ ) {
+            *csv_ << "," << ( i < series_names.size() ? series_names.at( i ) : "series " + to_string( i ) );
+        }
+        *csv_ << endl;
+    } else {
+        throw runtime_error( "BinnedLiveGraph: unknown output format " + output.format + " (need png, svg or csv)" );
     }
 }
 
 double BinnedLiveGraph::logical_width( void ) const
 {
-    return max( 5.0, graph_.size().first / 100.0 );
+    return max( 5.0, graph_->size().first / 100.0 );
 }
 
 void BinnedLiveGraph::animation_loop( void )
 {
+    vector<float> current_estimates( num_series_ );
+
     while ( not halt_ ) {
-        const uint64_t ts = advance();
+        take_completed_bins();
 
-        /* calculate "current" estimate based on partial bin */
+        const uint64_t ts = timestamp();
+        const uint64_t now_bin = ts / bin_width_ms_;
+
+        /* calculate "current" estimate based on partial bin (if the producer
+           has been idle since an earlier bin, what the bin would start with) */
+        const bool bin_is_current = current_bin_.load( memory_order_acquire ) == now_bin;
         const double bin_width_so_far = ts % bin_width_ms_;
-        vector<float> current_estimates;
-        current_estimates.reserve( value_this_bin_.size() );
-        for ( const auto & x : value_this_bin_ ) {
+        for ( unsigned int i = 0; i < num_series_; i++ ) {
+            int x = value_this_bin_[ i ].load( memory_order_relaxed );
+            if ( not bin_is_current ) {
+                initialize_new_bin_( bin_width_ms_, x );
+            }
+
             double current_estimate = x * multiplier_;
             if ( rate_quantity_ ) {
                 current_estimate /= (bin_width_so_far / 1000.0);
             }
-            current_estimates.emplace_back( current_estimate );
+            current_estimates.at( i ) = current_estimate;
         }
 
         const double bin_fraction = bin_width_so_far / double( bin_width_ms_ );
         const double confidence = pow( 1 - cos( bin_fraction * 3.14159 / 2.0 ), 2 );
 
-        graph_.blocking_draw( ts / 1000.0, logical_width(),
+        graph_->blocking_draw( ts / 1000.0, logical_width(),
                               current_estimates,
                               confidence );
     }
 }
 
-uint64_t BinnedLiveGraph::advance( void )
+void BinnedLiveGraph::render_loop( void )
 {
-    unique_lock<mutex> ul { mutex_ };
+    unique_lock<mutex> lock( render_mutex_ );
 
-    const uint64_t now = timestamp();
+    while ( not render_wakeup_.wait_for( lock, chrono::milliseconds( render_interval_ms_ ),
+                                         [&] () { return halt_.load(); } ) ) {
+        take_completed_bins();
+        render();
+    }
+}
+
+void BinnedLiveGraph::take_completed_bins( void )
+{
+    for ( const CompletedBin * bin = completed_bins_.front(); bin; bin = completed_bins_.front() ) {
+        add_data_points( *bin );
+        completed_bins_.pop();
+    }
+}
 
+void BinnedLiveGraph::advance( const uint64_t now )
+{
     const uint64_t now_bin = now / bin_width_ms_;
 
-    while ( current_bin_ < now_bin ) {
-        for ( unsigned int i = 0; i < value_this_bin_.size(); i++ ) {
-            double value = value_this_bin_[ i ] * multiplier_;
+    uint64_t bin = current_bin_.load( memory_order_relaxed );
+    while ( bin < now_bin ) {
+        /* fill in the ring's next slot, or (when this thread adds the points) a local one */
+        CompletedBin * completed = completed_bins_.next_to_push();
+        if ( not completed ) { /* the animation thread (or renderer) is far behind */
+            dropped_bins_++;
+        }
+
+        CompletedBin local { 0, {} };
+        CompletedBin & out = ( uses_ring() and completed ) ? *completed : local;
+        out.t = (bin + 1) * bin_width_ms_ / 1000.0;
+        out.values.resize( num_series_ );
+
+        for ( unsigned int i = 0; i < num_series_; i++ ) {
+            int x = value_this_bin_[ i ].load( memory_order_relaxed );
+            double value = x * multiplier_;
             if ( rate_quantity_ ) {
                 value /= (bin_width_ms_ / 1000.0);
             }
-            graph_.add_data_point( i,
-                                   (current_bin_ + 1) * bin_width_ms_ / 1000.0,
-                                   value );
-            initialize_new_bin_( bin_width_ms_, value_this_bin_[ i ] );
+            out.values.at( i ) = value;
+
+            initialize_new_bin_( bin_width_ms_, x );
+            value_this_bin_[ i ].store( x, memory_order_relaxed );
+        }
+
+        if ( uses_ring() ) {
+            if ( completed ) {
+                completed_bins_.push();
+            }
+        } else {
+            add_data_points( out );
         }
-        current_bin_++;
+
+        bin++;
     }
 
-    return now;
+    current_bin_.store( bin, memory_order_release );
 }
 
-void BinnedLiveGraph::add_value_now( const unsigned int num, const unsigned int amount )
+void BinnedLiveGraph::add_data_points( const CompletedBin & bin )
+{
+    if ( csv_ ) {
+        *csv_ << bin.t;
+    }
+
+    for ( unsigned int i = 0; i < num_series_; i++ ) {
+        const float y = bin.values.at( i );
+
+        if ( graph_ ) {
+            graph_->add_data_point( i, bin.t, y );
+        } else {
+            lines_.at( i ).emplace_back( bin.t, y );
+        }
+
+        if ( csv_ ) {
+            *csv_ << ",";
+            if ( y >= 0 ) { /* (negative values mean no value) */
+                *csv_ << y;
+            }
+        }
+    }
+
+    if ( csv_ ) {
+        *csv_ << "\n";
+    }
+}
+
+void BinnedLiveGraph::render( void )
 {
-    advance();
+    image_graph_->render( filename_, lines_ );
+}
 
-    unique_lock<mutex> ul { mutex_ };
+void BinnedLiveGraph::add_value( const unsigned int num, const unsigned int amount, const uint64_t time )
+{
+    advance( time );
 
-    if ( value_this_bin_.at( num ) < 0 ) {
+    if ( num >= num_series_ ) {
+        throw out_of_range( "BinnedLiveGraph: no series " + to_string( num ) );
+    }
+
+    const int x = value_this_bin_[ num ].load( memory_order_relaxed );
+    if ( x < 0 ) {
         throw runtime_error( "BinnedLiveGraph: attempt to add to a default value" );
     }
 
-    value_this_bin_.at( num ) += amount;
+    value_this_bin_[ num ].store( x + amount, memory_order_relaxed );
 }
 
-void BinnedLiveGraph::set_max_value_now( const unsigned int num, const unsigned int amount )
+void BinnedLiveGraph::set_max_value( const unsigned int num, const unsigned int amount, const uint64_t time )
 {
-    advance();
+    advance( time );
 
-    unique_lock<mutex> ul { mutex_ };
+    if ( num >= num_series_ ) {
+        throw out_of_range( "BinnedLiveGraph: no series " + to_string( num ) );
+    }
 
-    if ( value_this_bin_.at( num ) < 0 ) {
-        value_this_bin_.at( num ) = amount;
-    } else {
-        value_this_bin_.at( num ) = max( unsigned( value_this_bin_.at( num ) ), amount );
+    const int x = value_this_bin_[ num ].load( memory_order_relaxed );
+    if ( x < 0 or unsigned( x ) < amount ) {
+        value_this_bin_[ num ].store( amount, memory_order_relaxed );
     }
 }
 
+void BinnedLiveGraph::add_value_now( const unsigned int num, const unsigned int amount )
+{
+    add_value( num, amount, timestamp() );
+}
+
+void BinnedLiveGraph::set_max_value_now( const unsigned int num, const unsigned int amount )
+{
+    set_max_value( num, amount, timestamp() );
+}
+
 BinnedLiveGraph::~BinnedLiveGraph()
 {
-    halt_ = true;
-    animation_thread_.join();
+    {
+        lock_guard<mutex> lock( render_mutex_ );
+        halt_ = true;
+    }
+    render_wakeup_.notify_all();
+
+    if ( animation_thread_.joinable() ) {
+        animation_thread_.join();
+    }
+
+    if ( not graph_ ) {
+        /* finish the files (don't throw from destructor) */
+        try {
+            /* (making room in the ring for the last bins) */
+            take_completed_bins();
+            advance( timestamp() );
+            take_completed_bins();
+
+            if ( image_graph_ ) {
+                render();
+            }
+
+            if ( csv_ ) {
+                csv_->flush();
+            }
+        } catch ( const exception & e ) {
+            print_exception( e );
+        }
+    }
+
+    if ( dropped_bins_ ) {
+        cerr << "BinnedLiveGraph: " << ( graph_ ? "display" : "renderer" ) << " fell behind, dropped "
+             << dropped_bins_ << " bins" << endl;
+    }
 
     if ( animation_thread_exception_ != exception_ptr() ) {
         try {
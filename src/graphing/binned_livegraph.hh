@@ -7,47 +7,116 @@
 #include <string>
 #include <atomic>
 #include <thread>
-#include <exception>
 #include <mutex>
+#include <condition_variable>
+#include <exception>
 #include <functional>
+#include <memory>
+#include <fstream>
 
 #include "graph.hh"
+#include "image_graph.hh"
+#include "spsc_ring.hh"
+
+/* where graphs go: a window on the display (the default), or, without a
+   display, files in a directory: images (png or svg) redrawn every
+   interval_ms as the data arrives (0 = only at exit), or the binned
+   series as comma-separated values (csv) */
+struct GraphOutput
+{
+    std::string directory {};
+    std::string format { "png" };
+    unsigned int interval_ms = 0;
 
+    bool headless( void ) const { return not directory.empty(); }
+};
+
+/* The packet path (the "producer" thread that adds values) never blocks
+   on the display: it adds to per-bin atomic accumulators and, as each
+   bin closes, hands the bin's values to the animation thread through a
+   ring. The animation thread owns the Graph and copies only those new
+   points into it each frame. Images redrawn at an interval are drawn the
+   same way, by a renderer thread that sleeps between frames. */
 class BinnedLiveGraph
 {
 private:
-    Graph graph_;
+    struct CompletedBin
+    {
+        float t;
+        std::vector<float> values;
+    };
+
+    std::unique_ptr<Graph> graph_;
 
     unsigned int bin_width_ms_;
-    std::vector<int> value_this_bin_;
-    uint64_t current_bin_;
+    unsigned int num_series_;
+    std::unique_ptr<std::atomic<int>[]> value_this_bin_; /* written by the producer only */
+    std::atomic<uint64_t> current_bin_;
     double multiplier_;
     bool rate_quantity_;
 
-    uint64_t advance( void );
+    /* completed bins on their way to the animation thread (or renderer) */
+    SPSCRing<CompletedBin> completed_bins_;
+    uint64_t dropped_bins_;
+
+    /* without a display */
+    std::unique_ptr<ImageGraph> image_graph_;
+    ImageGraph::LinesType lines_;
+    std::string filename_;
+    unsigned int render_interval_ms_;
+    std::unique_ptr<std::ofstream> csv_;
+
+    /* whether completed bins go through the ring to another thread */
+    bool uses_ring( void ) const { return graph_ or ( image_graph_ and render_interval_ms_ ); }
+
+    /* producer: close the bins before the one holding this time */
+    void advance( const uint64_t now );
+
+    void add_data_points( const CompletedBin & bin );
+
+    /* consumer: add the bins the producer has finished */
+    void take_completed_bins( void );
+
+    void render( void );
 
     double logical_width( void ) const;
 
     void animation_loop( void );
 
-    std::mutex mutex_;
+    void render_loop( void );
+
+    /* the renderer waits on render_wakeup_ between frames, so halting wakes it */
     std::atomic<bool> halt_;
+    std::mutex render_mutex_;
+    std::condition_variable render_wakeup_;
 
     std::exception_ptr animation_thread_exception_;
     std::thread animation_thread_;
 
+    /* (called by both threads, so it should not keep state of its own) */
     std::function<void(int,int&)> initialize_new_bin_;
 
 public:
+    /* file_name names the output files (the name itself goes on a window) */
     BinnedLiveGraph( const std::string & name, const Graph::StylesType & styles,
                      const std::string & y_label,
                      const double multiplier, const bool rate_quantity,
                      const unsigned int bin_width_ms,
-                     const std::function<void(int,int&)> initialize_new_bin );
+                     const std::function<void(int,int&)> initialize_new_bin,
+                     const GraphOutput & output = GraphOutput(),
+                     const std::string & file_name = "",
+                     const std::vector<std::string> & series_names = {} );
     ~BinnedLiveGraph();
 
+    /* from one thread only; a time (in ms) before the current bin counts in the current bin */
+    void add_value( const unsigned int num, const unsigned int amount, const uint64_t time );
+    void set_max_value( const unsigned int num, const unsigned int amount, const uint64_t time );
+
     void add_value_now( const unsigned int num, const unsigned int amount );
     void set_max_value_now( const unsigned int num, const unsigned int amount );
+
+    BinnedLiveGraph( const BinnedLiveGraph & other ) = delete;
+    BinnedLiveGraph & operator=( const BinnedLiveGraph & other ) = delete;
 };
 
 #endif /* BINNED_LIVEGRAPH_HH */
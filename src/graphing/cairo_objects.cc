@@ -41,6 +41,13 @@ Cairo::Cairo( XPixmap & pixmap )
   check_error();
 }
 
+Cairo::Cairo( cairo_surface_t * surface, const pair<unsigned int, unsigned int> & size )
+  : surface_( surface, size ),
+    context_( surface_ )
+{
+  check_error();
+}
+
 const pair<unsigned int, unsigned int> & Cairo::size( void ) const
 {
   return surface_.size;
@@ -57,6 +64,13 @@ Cairo::Surface::Surface( XPixmap & pixmap )
   check_error();
 }
 
+Cairo::Surface::Surface( cairo_surface_t * s_surface, const pair<unsigned int, unsigned int> & s_size )
+  : size( s_size ),
+    surface( s_surface )
+{
+  check_error();
+}
+
 Cairo::Context::Context( Surface & surface )
   : context( cairo_create( surface.surface.get() ) )
 {
@@ -23,6 +23,7 @@ class Cairo
     std::unique_ptr<cairo_surface_t, Deleter> surface;
 
     Surface( XPixmap & pixmap );
+    Surface( cairo_surface_t * s_surface, const std::pair<unsigned int, unsigned int> & s_size );
 
     void check_error( void );
   } surface_;
@@ -46,6 +47,11 @@ class Cairo
 public:
   Cairo( XPixmap & pixmap );
 
+  /* draw on an image or SVG surface (which Cairo takes ownership of) */
+  Cairo( cairo_surface_t * surface, const std::pair<unsigned int, unsigned int> & size );
+
+  cairo_surface_t * surface( void ) { return surface_.surface.get(); }
+
   const std::pair<unsigned int, unsigned int> & size( void ) const;
 
   operator cairo_t * () { return context_.context.get(); }
@@ -46,8 +46,7 @@ Graph::Graph( const unsigned int initial_width, const unsigned int initial_heigh
     target_max_y_( max_y ),
     bottom_( min_y ),
     top_( max_y ),
-    horizontal_fadeout_( cairo_pattern_create_linear( 0, 0, 190, 0 ) ),
-    data_mutex_()
+    horizontal_fadeout_( cairo_pattern_create_linear( 0, 0, 190, 0 ) )
 {
   cairo_pattern_add_color_stop_rgba( horizontal_fadeout_, 0.0, 1, 1, 1, 1 );
   cairo_pattern_add_color_stop_rgba( horizontal_fadeout_, 0.67, 1, 1, 1, 1 );
@@ -66,7 +65,6 @@ static int to_int( const float x )
 bool Graph::blocking_draw( const float t, const float logical_width,
 			   const vector<float> & current_values, const double current_weight )
 {
-  unique_lock<mutex> ul { data_mutex_ }; /* going to read and write data_points_ */
   for ( auto & line : data_points_ ) {
     while ( (line.size() >= 2) and (line.front().first < t - logical_width - 1)
 	    and (line.at( 1 ).first < t - logical_width - 1) ) {
@@ -74,10 +72,7 @@ bool Graph::blocking_draw( const float t, const float logical_width,
     }
   }
 
-  const vector<deque<pair<float, float>>> data_points_snapshot = data_points_;
-  ul.unlock();
-
-  assert( data_points_snapshot.size() == current_values.size() );
+  assert( data_points_.size() == current_values.size() );
   assert( current_weight >= 0 );
   assert( current_weight <= 1 );
 
@@ -85,11 +80,11 @@ bool Graph::blocking_draw( const float t, const float logical_width,
   float max_value = numeric_limits<float>::min();
 
   /* look at historical data points */
-  for ( unsigned int i = 0; i < data_points_snapshot.size(); i++ ) {
+  for ( unsigned int i = 0; i < data_points_.size(); i++ ) {
     if ( get<4>( styles_.at( i ) ) ) { /* skip filled areas */
       continue;
     }
-    for ( const auto & point : data_points_snapshot.at( i ) ) {
+    for ( const auto & point : data_points_.at( i ) ) {
       if ( point.second > max_value ) {
 	max_value = point.second;
       }
@@ -180,8 +175,8 @@ bool Graph::blocking_draw( const float t, const float logical_width,
   cairo_fill( cairo_ );
 
   /* draw the data */
-  for ( unsigned int line_no = 0; line_no < data_points_snapshot.size(); line_no++ ) {
-    const auto & line = data_points_snapshot.at( line_no );
+  for ( unsigned int line_no = 0; line_no < data_points_.size(); line_no++ ) {
+    const auto & line = data_points_.at( line_no );
 
     if ( line.empty() ) {
       continue;
@@ -3,7 +3,6 @@
 
 #include <deque>
 #include <vector>
-#include <mutex>
 #include <array>
 
 #include "display.hh"
@@ -58,8 +57,6 @@ class Graph
 
   Cairo::Pattern horizontal_fadeout_;
 
-  std::mutex data_mutex_;
-
   void begin_line( const float t, const float x, const float y, const float logical_width );
   void add_segment( const float t, const float x, const float y, const float logical_width );
   void end_line( const float t, const float x, const float logical_width, const bool fill );
@@ -74,9 +71,8 @@ public:
 	 const std::string & x_label,
 	 const std::string & y_label );
 
+  /* (a Graph is used from one thread: the one that draws it) */
   void add_data_point( const unsigned int num, const float t, const float y ) {
-    std::unique_lock<std::mutex> ul { data_mutex_ };
-
     data_points_.at( num ).emplace_back( t, y );
   }
 
@@ -0,0 +1,207 @@
+/* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <cmath>
+#include <sstream>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+#include <cstdio>
+#include <cairo-svg.h>
+
+#include "image_graph.hh"
+#include "cairo_objects.hh"
+#include "exception.hh"
+
+using namespace std;
+
+static const unsigned int WIDTH = 640, HEIGHT = 480;
+
+/* plot area */
+static const double LEFT = 130, RIGHT = WIDTH - 20, TOP = 50, BOTTOM = HEIGHT - 80;
+
+ImageGraph::ImageGraph( const string & title,
+                        const Graph::StylesType & styles,
+                        const string & x_label,
+                        const string & y_label )
+    : title_( title ),
+      styles_( styles ),
+      x_label_( x_label ),
+      y_label_( y_label )
+{}
+
+static bool ends_with( const string & str, const string & suffix )
+{
+    return str.size() >= suffix.size()
+        and str.compare( str.size() - suffix.size(), suffix.size(), suffix ) == 0;
+}
+
+/* 1, 2 or 5 times a power of ten, so there are at most max_ticks ticks */
+static double tick_spacing( const double range, const unsigned int max_ticks )
+{
+    double spacing = pow( 10, floor( log10( max( range, 1e-6 ) / max_ticks ) ) );
+    for ( const double multiple : { 1, 2, 5, 10 } ) {
+        if ( range / ( spacing * multiple ) <= max_ticks ) {
+            return spacing * multiple;
+        }
+    }
+    return spacing * 10;
+}
+
+static string tick_text( const double value )
+{
+    ostringstream ss;
+    ss << value;
+    return ss.str();
+}
+
+void ImageGraph::render( const string & filename, const LinesType & lines ) const
+{
+    if ( lines.size() != styles_.size() ) {
+        throw runtime_error( "ImageGraph: wrong number of lines" );
+    }
+
+    const bool svg = ends_with( filename, ".svg" );
+    if ( not svg and not ends_with( filename, ".png" ) ) {
+        throw runtime_error( filename + ": graph file names must end in .png or .svg" );
+    }
+
+    /* the extent of the data (only lines, not filled areas, set the scale) */
+    double t_min = numeric_limits<double>::max(), t_max = numeric_limits<double>::lowest();
+    double y_max = 0;
+    for ( unsigned int i = 0; i < lines.size(); i++ ) {
+        for ( const auto & point : lines.at( i ) ) {
+            t_min = min( t_min, double( point.first ) );
+            t_max = max( t_max, double( point.first ) );
+            if ( not get<4>( styles_.at( i ) ) ) {
+                y_max = max( y_max, double( point.second ) );
+            }
+        }
+    }
+
+    if ( t_min > t_max ) { /* no data yet */
+        t_min = t_max = 0;
+    }
+    t_max = max( t_max, t_min + 1 );
+
+    const double y_spacing = tick_spacing( max( y_max * 1.2, 1.0 ), 6 );
+    const double y_top = ceil( max( y_max * 1.2, 1.0 ) / y_spacing ) * y_spacing;
+    const double t_spacing = tick_spacing( t_max - t_min, 10 );
+
+    auto x_position = [&] ( const double t ) { return LEFT + ( t - t_min ) / ( t_max - t_min ) * ( RIGHT - LEFT ); };
+    auto y_position = [&] ( const double y ) { return BOTTOM - min( y, y_top ) / y_top * ( BOTTOM - TOP ); };
+
+    /* write to a temporary file, then rename it over the old one */
+    const string temp_filename = filename + ".tmp";
+
+    Cairo cairo( svg
+                 ? cairo_svg_surface_create( temp_filename.c_str(), WIDTH, HEIGHT )
+                 : cairo_image_surface_create( CAIRO_FORMAT_ARGB32, WIDTH, HEIGHT ),
+                 make_pair( WIDTH, HEIGHT ) );
+    Pango pango( cairo );
+
+    const Pango::Font tick_font( "Open Sans Condensed Bold 14" );
+    const Pango::Font label_font( "Open Sans Condensed Bold 20" );
+
+    /* background */
+    cairo_new_path( cairo );
+    cairo_identity_matrix( cairo );
+    cairo_rectangle( cairo, 0, 0, WIDTH, HEIGHT );
+    cairo_set_source_rgba( cairo, 1, 1, 1, 1 );
+    cairo_fill( cairo );
+
+    /* vertical grid and time labels */
+    for ( double t = ceil( t_min / t_spacing ) * t_spacing; t <= t_max; t += t_spacing ) {
+        Pango::Text( cairo, pango, tick_font, tick_text( t ) ).draw_centered_at( cairo, x_position( t ), BOTTOM + 20 );
+        cairo_set_source_rgba( cairo, 0, 0, 0.4, 1 );
+        cairo_fill( cairo );
+
+        cairo_identity_matrix( cairo );
+        cairo_set_line_width( cairo, 2 );
+        cairo_move_to( cairo, x_position( t ), BOTTOM );
+        cairo_line_to( cairo, x_position( t ), TOP );
+        cairo_set_source_rgba( cairo, 0, 0, 0.4, 0.25 );
+        cairo_stroke( cairo );
+    }
+
+    /* horizontal grid and value labels */
+    for ( double y = 0; y <= y_top + y_spacing / 2; y += y_spacing ) {
+        Pango::Text( cairo, pango, tick_font, tick_text( y ) ).draw_centered_at( cairo, LEFT - 35, y_position( y ) );
+        cairo_set_source_rgba( cairo, 0, 0, 0.4, 1 );
+        cairo_fill( cairo );
+
+        cairo_identity_matrix( cairo );
+        cairo_set_line_width( cairo, 1 );
+        cairo_move_to( cairo, LEFT, y_position( y ) );
+        cairo_line_to( cairo, RIGHT, y_position( y ) );
+        cairo_set_source_rgba( cairo, 0, 0, 0.4, 0.25 );
+        cairo_stroke( cairo );
+    }
+
+    /* the data */
+    cairo_identity_matrix( cairo );
+    cairo_set_line_width( cairo, 2 );
+
+    for ( unsigned int i = 0; i < lines.size(); i++ ) {
+        const auto & style = styles_.at( i );
+        const bool fill = get<4>( style );
+        cairo_set_source_rgba( cairo, get<0>( style ), get<1>( style ), get<2>( style ), get<3>( style ) );
+
+        /* each run of points with values is a separate line (or area) */
+        const auto & line = lines.at( i );
+        for ( auto start = line.begin(); start != line.end(); ) {
+            if ( start->second < 0 ) {
+                start++;
+                continue;
+            }
+
+            auto end = start;
+            cairo_new_path( cairo );
+            cairo_move_to( cairo, x_position( start->first ), y_position( start->second ) );
+            while ( end != line.end() and end->second >= 0 ) {
+                cairo_line_to( cairo, x_position( end->first ), y_position( end->second ) );
+                end++;
+            }
+
+            if ( fill ) {
+                cairo_line_to( cairo, x_position( prev( end )->first ), y_position( 0 ) );
+                cairo_line_to( cairo, x_position( start->first ), y_position( 0 ) );
+                cairo_fill( cairo );
+            } else {
+                cairo_stroke( cairo );
+            }
+
+            start = end;
+        }
+    }
+
+    /* title and axis labels */
+    Pango::Text( cairo, pango, label_font, title_ ).draw_centered_at( cairo, WIDTH / 2, 22, WIDTH - 40 );
+    cairo_set_source_rgba( cairo, 0.4, 0, 0, 1 );
+    cairo_fill( cairo );
+
+    Pango::Text( cairo, pango, label_font, x_label_ ).draw_centered_at( cairo, ( LEFT + RIGHT ) / 2, HEIGHT - 25 );
+    cairo_set_source_rgba( cairo, 0, 0, 0.4, 1 );
+    cairo_fill( cairo );
+
+    Pango::Text( cairo, pango, label_font, y_label_ ).draw_centered_rotated_at( cairo, 25, ( TOP + BOTTOM ) / 2 );
+    cairo_set_source_rgba( cairo, 0, 0, 0.4, 1 );
+    cairo_fill( cairo );
+
+    /* write it out */
+    if ( svg ) {
+        cairo_surface_finish( cairo.surface() );
+    } else {
+        const cairo_status_t result = cairo_surface_write_to_png( cairo.surface(), temp_filename.c_str() );
+        if ( result ) {
+            throw runtime_error( temp_filename + ": " + cairo_status_to_string( result ) );
+        }
+    }
+
+    const cairo_status_t result = cairo_surface_status( cairo.surface() );
+    if ( result ) {
+        throw runtime_error( temp_filename + ": " + cairo_status_to_string( result ) );
+    }
+
+    SystemCall( "rename " + temp_filename, rename( temp_filename.c_str(), filename.c_str() ) );
+}
@@ -0,0 +1,33 @@
+/* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef IMAGE_GRAPH_HH
+#define IMAGE_GRAPH_HH
+
+#include <vector>
+#include <string>
+
+#include "graph.hh"
+
+/* draws the whole history of a Graph's lines to a PNG or SVG file
+   (chosen by the file's extension), without a display */
+class ImageGraph
+{
+private:
+    std::string title_;
+    Graph::StylesType styles_;
+    std::string x_label_, y_label_;
+
+public:
+    typedef std::vector< std::vector< std::pair<float, float> > > LinesType;
+
+    ImageGraph( const std::string & title,
+                const Graph::StylesType & styles,
+                const std::string & x_label,
+                const std::string & y_label );
+
+    /* each line is a series of (t, y) points, broken where y is negative;
+       the file is replaced atomically, so it can be watched as it changes */
+    void render( const std::string & filename, const LinesType & lines ) const;
+};
+
+#endif /* IMAGE_GRAPH_HH */
@@ -6,6 +6,33 @@
 
 using namespace std;
 
+static string varint( uint64_t value )
+{
+    string ret;
+    while ( value >= 0x80 ) {
+        ret.push_back( char( ( value & 0x7f ) | 0x80 ) );
+        value >>= 7;
+    }
+    ret.push_back( char( value ) );
+    return ret;
+}
+
+/* Append the response body as a second occurrence of the
+   RequestResponse.response field holding only HTTPMessage.body.
+   Protobuf parsers merge repeated occurrences of a singular
+   message field, so readers see one complete response, but the
+   body never has to be in memory at once. */
+static void append_spilled_body( FileDescriptor & fd, const BodySpool & body )
+{
+    const string body_key = varint( ( 3 << 3 ) | 2 ); /* HTTPMessage.body, length-delimited */
+    const string body_header = body_key + varint( body.size() );
+
+    const string response_key = varint( ( 5 << 3 ) | 2 ); /* RequestResponse.response, length-delimited */
+    fd.write( response_key + varint( body_header.size() + body.size() ) + body_header );
+
+    body.write_to( fd );
+}
+
 HTTPDiskStore::HTTPDiskStore( const string & record_folder )
     : record_folder_( record_folder ),
       mutex_()
@@ -27,10 +54,14 @@ void HTTPDiskStore::save( const HTTPResponse & response, const Address & server_
                        ? MahimahiProtobufs::RequestResponse_Scheme_HTTPS
                        : MahimahiProtobufs::RequestResponse_Scheme_HTTP );
     output.mutable_request()->CopyFrom( response.request().toprotobuf() );
-    output.mutable_response()->CopyFrom( response.toprotobuf() );
+    output.mutable_response()->CopyFrom( response.toprotobuf( not response.body_is_spilled() ) );
 
     if ( not output.SerializeToFileDescriptor( file.fd().fd_num() ) ) {
         throw runtime_error( "save_to_disk: failure to serialize HTTP request/response pair" );
     }
 
+    if ( response.body_is_spilled() ) {
+        append_spilled_body( file.fd(), response.body_spool() );
+    }
+
 }
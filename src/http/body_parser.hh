@@ -3,6 +3,8 @@
 #ifndef BODY_PARSER_HH
 #define BODY_PARSER_HH
 
+#include "string_view.hh"
+
 class BodyParser
 {
 public:
@@ -10,7 +12,7 @@ public:
         - entire string belongs to body
         - only some of string (0 bytes to n bytes) belongs to body */
 
-    virtual std::string::size_type read( const std::string & str ) = 0;
+    virtual std::string::size_type read( const StringView & str ) = 0;
 
     /* does message become complete upon EOF in body? */
     virtual bool eof( void ) const = 0;
@@ -23,7 +25,7 @@ class Rule5BodyParser : public BodyParser
 {
 public:
     /* all of buffer always belongs to body */
-    std::string::size_type read( const std::string & ) override
+    std::string::size_type read( const StringView & ) override
     {
         return std::string::npos;
     }
@@ -0,0 +1,50 @@
+/* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <fcntl.h>
+
+#include "body_spool.hh"
+#include "exception.hh"
+
+using namespace std;
+
+void BodySpool::append( const string & str )
+{
+    if ( str.empty() ) {
+        return;
+    }
+
+    file_.write( str );
+    size_ += str.size();
+}
+
+string BodySpool::str( void ) const
+{
+    string ret;
+    ret.reserve( size_ );
+
+    FileDescriptor in( SystemCall( "open " + file_.name(), open( file_.name().c_str(), O_RDONLY ) ) );
+    while ( ret.size() < size_ ) {
+        const string chunk = in.read( size_ - ret.size() );
+        if ( chunk.empty() ) {
+            throw runtime_error( "BodySpool: " + file_.name() + " is shorter than expected" );
+        }
+        ret.append( chunk );
+    }
+
+    return ret;
+}
+
+void BodySpool::write_to( FileDescriptor & fd ) const
+{
+    FileDescriptor in( SystemCall( "open " + file_.name(), open( file_.name().c_str(), O_RDONLY ) ) );
+
+    size_t bytes_left = size_;
+    while ( bytes_left > 0 ) {
+        const string chunk = in.read( bytes_left );
+        if ( chunk.empty() ) {
+            throw runtime_error( "BodySpool: " + file_.name() + " is shorter than expected" );
+        }
+        fd.write( chunk );
+        bytes_left -= chunk.size();
+    }
+}
@@ -0,0 +1,33 @@
+/* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef BODY_SPOOL_HH
+#define BODY_SPOOL_HH
+
+#include <string>
+
+#include "temp_file.hh"
+#include "file_descriptor.hh"
+
+/* holds the body of a large HTTP message in a temporary file
+   instead of in memory (the file is deleted with the spool) */
+class BodySpool
+{
+private:
+    TempFile file_;
+    size_t size_ { 0 };
+
+public:
+    BodySpool( const std::string & filename_template ) : file_( filename_template ) {}
+
+    void append( const std::string & str );
+
+    size_t size( void ) const { return size_; }
+
+    /* read the whole body back into memory */
+    std::string str( void ) const;
+
+    /* copy the body to fd, a chunk at a time */
+    void write_to( FileDescriptor & fd ) const;
+};
+
+#endif /* BODY_SPOOL_HH */
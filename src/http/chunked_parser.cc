@@ -1,123 +1,139 @@
 /* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
 
 #include <cassert>
+#include <algorithm>
 
-#include "ezio.hh"
 #include "chunked_parser.hh"
 
 using namespace std;
 
-/* Take a chunk header and parse it assuming no folding */
-uint32_t ChunkedBodyParser::get_chunk_size( const string & chunk_hdr ) const
-{
-    /* Check that the chunk header ends with a CRLF */
-    assert(chunk_hdr.substr( chunk_hdr.length() - 2, 2 ) == "\r\n" );
-
-    /* If there are chunk extensions, ';' terminates chunk size */
-    auto pos = chunk_hdr.find( ";" );
+/* larger chunk sizes are surely an error (and would overflow) */
+static const uint64_t MAX_CHUNK_SIZE = uint64_t( 1 ) << 48;
 
-    /* There are no ';'s, and hence no chunk externsions, CRLF terminates chunk size */
-    if ( pos == string::npos ) {
-        pos = chunk_hdr.find( "\r\n" );
+static int hex_digit_value( const char c )
+{
+    if ( c >= '0' and c <= '9' ) {
+        return c - '0';
+    } else if ( c >= 'a' and c <= 'f' ) {
+        return c - 'a' + 10;
+    } else if ( c >= 'A' and c <= 'F' ) {
+        return c - 'A' + 10;
+    } else {
+        return -1;
     }
+}
 
-    /* Can't be npos even now */
-    assert( pos != string::npos );
-
-    /* Parse hex string, after removing trailing spaces (RFC 2616 Section 2.1) */
-    auto hex_string = chunk_hdr.substr( 0, pos );
-    auto space_loc = hex_string.find( " " );
-    if ( space_loc != string::npos ) hex_string.erase( space_loc, hex_string.length() - space_loc );
-    return myatoi( hex_string, 16 );
+static void expect( const char actual, const char expected )
+{
+    if ( actual != expected ) {
+        throw runtime_error( "ChunkedBodyParser: malformed chunked encoding" );
+    }
 }
 
-string::size_type ChunkedBodyParser::read( const std::string & input_buffer )
+string::size_type ChunkedBodyParser::read( const StringView & input_buffer )
 {
-    parser_buffer_ += input_buffer;
-
-    while ( !parser_buffer_.empty() ) {
-        switch (state_) {
-        case CHUNK_HDR: {
-            auto it = parser_buffer_.find( "\r\n" );
-            if (it != string::npos) {
-                /* if you have CRLF, get chunk size & transition to CHUNK/TRAILER */
-                current_chunk_size_ = get_chunk_size( parser_buffer_.substr( 0, it + 2 ) );
-
-                /* Transition appropriately */
-                state_ = ( current_chunk_size_ == 0 ) ? TRAILER : CHUNK;
-
-                /* shrink parser_buffer_ */
-                parsed_so_far_ += ( it + 2 );
-                parser_buffer_ = parser_buffer_.substr( it + 2 );
-                break;
+    size_t pos = 0;
+
+    while ( pos < input_buffer.size() ) {
+        switch ( state_ ) {
+        case State::SIZE: {
+            const char c = input_buffer[ pos++ ];
+            const int digit = hex_digit_value( c );
+
+            if ( digit >= 0 ) {
+                chunk_size_ = chunk_size_ * 16 + digit;
+                have_size_digit_ = true;
+                if ( chunk_size_ > MAX_CHUNK_SIZE ) {
+                    throw runtime_error( "ChunkedBodyParser: chunk size too large" );
+                }
+            } else if ( not have_size_digit_ ) {
+                throw runtime_error( "ChunkedBodyParser: missing chunk size" );
+            } else if ( c == '\r' ) {
+                state_ = State::SIZE_LF;
+            } else if ( c == ';' or c == ' ' or c == '\t' ) {
+                /* chunk extensions (and whitespace before them) are ignored */
+                state_ = State::EXTENSION;
             } else {
-                /* if you haven't seen a CRLF so far, do nothing */
-                acked_so_far_ += input_buffer.length();
-                return string::npos;
+                throw runtime_error( "ChunkedBodyParser: invalid chunk size" );
             }
+            break;
         }
 
-        case CHUNK: {
-            if ( parser_buffer_.length() >= current_chunk_size_ + 2 ) {
-                /* accumulated enough bytes, check CRLF at the end of the chunk */
-                assert( parser_buffer_.substr( current_chunk_size_, 2 ) == "\r\n" );
+        case State::EXTENSION: {
+            const size_t cr = input_buffer.find( '\r', pos );
+            if ( cr == StringView::npos ) {
+                pos = input_buffer.size();
+            } else {
+                pos = cr + 1;
+                state_ = State::SIZE_LF;
+            }
+            break;
+        }
 
-                /* Transition to next state */
-                state_ = CHUNK_HDR;
+        case State::SIZE_LF:
+            expect( input_buffer[ pos++ ], '\n' );
+            have_size_digit_ = false;
+            state_ = ( chunk_size_ == 0 ) ? State::TRAILER_START : State::DATA;
+            break;
+
+        case State::DATA: {
+            /* skip over the data without looking at it */
+            const uint64_t amount = min( chunk_size_, uint64_t( input_buffer.size() - pos ) );
+            pos += amount;
+            chunk_size_ -= amount;
+            if ( chunk_size_ == 0 ) {
+                state_ = State::DATA_CR;
+            }
+            break;
+        }
 
-                /* shrink parser_buffer_ */
-                parsed_so_far_ += current_chunk_size_ + 2;
-                parser_buffer_ = parser_buffer_.substr( current_chunk_size_ + 2 );
-                break;
+        case State::DATA_CR:
+            expect( input_buffer[ pos++ ], '\r' );
+            state_ = State::DATA_LF;
+            break;
+
+        case State::DATA_LF:
+            expect( input_buffer[ pos++ ], '\n' );
+            state_ = State::SIZE;
+            break;
+
+        case State::TRAILER_START:
+            if ( input_buffer[ pos ] == '\r' ) {
+                pos++;
+                state_ = State::LAST_LF;
             } else {
-                /* Haven't seen enough bytes so far, do nothing */
-                acked_so_far_ += input_buffer.length();
-                return string::npos;
+                state_ = State::TRAILER;
             }
-        }
+            break;
 
-        case TRAILER: {
-            if ( trailers_enabled_) {
-                /* We need two consecutive CRLFs */
-                return compute_ack_size( parser_buffer_,
-                                         "\r\n\r\n",
-                                         input_buffer.length() );
+        case State::TRAILER: {
+            const size_t cr = input_buffer.find( '\r', pos );
+            if ( cr == StringView::npos ) {
+                pos = input_buffer.size();
             } else {
-                /* We need only one CRLF now */
-                return compute_ack_size( parser_buffer_,
-                                         "\r\n",
-                                         input_buffer.length() );
+                pos = cr + 1;
+                state_ = State::TRAILER_LF;
             }
+            break;
         }
 
-        default: {
-            assert( false );
-            return false;
-        }
+        case State::TRAILER_LF:
+            expect( input_buffer[ pos++ ], '\n' );
+            state_ = State::TRAILER_START;
+            break;
+
+        case State::LAST_LF:
+            expect( input_buffer[ pos++ ], '\n' );
+            state_ = State::DONE;
+            /* the rest of the input isn't part of this body */
+            return pos;
+
+        case State::DONE:
+            assert( false ); /* nobody should be calling read on a complete body */
+            return 0;
         }
     }
-    acked_so_far_ += input_buffer.length();
-    return string::npos;
-}
 
-/*
-   Computes the acknowledgement from the BodyParser to its caller,
-   telling it how much of the current input_buffer has been
-   successfully parsed.
-*/
-string::size_type ChunkedBodyParser::compute_ack_size( const string & haystack,
-                                                       const string & needle,
-                                                       const string::size_type input_size )
-{
-    auto loc = haystack.find( needle );
-    if ( loc != string::npos ) {
-        /* Found it, eat up the whole buffer */
-        parsed_so_far_ += loc + needle.length();
-        assert( parsed_so_far_ > acked_so_far_ );
-        return ( parsed_so_far_ - acked_so_far_ );
-    } else {
-        /* Find unacknowledged buffer so far, ack it, and be done */
-        acked_so_far_ += input_size;
-        return loc;
-    }
+    /* all of it belongs to the body */
+    return string::npos;
 }
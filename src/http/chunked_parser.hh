@@ -7,27 +7,34 @@
 #include "body_parser.hh"
 #include "exception.hh"
 
+/* incremental decoder for the chunked transfer coding (RFC 7230 section 4.1):
+   it keeps no copy of its input, only where it is in the encoding, so each
+   byte is looked at once however the body is split across reads */
 class ChunkedBodyParser : public BodyParser
 {
 private:
-    std::string::size_type compute_ack_size(const std::string & haystack,
-                                            const std::string & needle,
-                                            std::string::size_type input_size);
-    uint32_t get_chunk_size(const std::string & chunk_hdr) const;
-    std::string parser_buffer_ {""};
-    uint32_t current_chunk_size_ {0};
-    std::string::size_type acked_so_far_ {0};
-    std::string::size_type parsed_so_far_ {0};
-    enum {CHUNK_HDR, CHUNK, TRAILER} state_ {CHUNK_HDR};
-    const bool trailers_enabled_ {false};
+    enum class State { SIZE,          /* chunk size (hex digits) */
+                       EXTENSION,     /* rest of the chunk-size line */
+                       SIZE_LF,       /* LF ending the chunk-size line */
+                       DATA,          /* chunk data */
+                       DATA_CR,       /* CRLF after the chunk data */
+                       DATA_LF,
+                       TRAILER_START, /* start of a trailer line, or of the final CRLF */
+                       TRAILER,       /* rest of a trailer line */
+                       TRAILER_LF,    /* LF ending a trailer line */
+                       LAST_LF,       /* LF ending the body */
+                       DONE };
+    State state_ { State::SIZE };
+
+    /* size of the chunk while it's being parsed, then bytes of it still to come */
+    uint64_t chunk_size_ { 0 };
+    bool have_size_digit_ { false };
 
 public:
-    std::string::size_type read( const std::string & ) override;
+    std::string::size_type read( const StringView & ) override;
 
     /* Follow item 2, Section 4.4 of RFC 2616 */
     bool eof( void ) const override { return true; }
-
-    ChunkedBodyParser(bool t_trailers_enabled) : trailers_enabled_( t_trailers_enabled ) {}
 };
 
 #endif /* CHUNKED_BODY_PARSER_HH */
@@ -10,28 +10,26 @@
 using namespace std;
 
 /* parse a header line into a key and a value */
-HTTPHeader::HTTPHeader( const string & buf )
+HTTPHeader::HTTPHeader( const StringView & buf )
   : key_(), value_()
 {
-    const string separator = ":";
-
     /* step 1: does buffer contain colon? */
-    size_t colon_location = buf.find( separator );
-    if ( colon_location == std::string::npos ) {
-        fprintf( stderr, "Buffer: %s\n", buf.c_str() );
+    size_t colon_location = buf.find( ':' );
+    if ( colon_location == StringView::npos ) {
+        fprintf( stderr, "Buffer: %s\n", buf.str().c_str() );
         throw runtime_error( "HTTPHeader: buffer does not contain colon" ); 
     }
 
     /* step 2: split buffer */
-    key_ = buf.substr( 0, colon_location );
-    string value_temp = buf.substr( colon_location + separator.size() );
+    key_ = buf.substr( 0, colon_location ).str();
+    const StringView value_temp = buf.substr( colon_location + 1 );
 
     /* strip whitespace */
-    size_t first_nonspace = value_temp.find_first_not_of( " " );
-    if ( first_nonspace == std::string::npos ) { /* handle case where value is only space */
-        value_ = value_temp;
+    size_t first_nonspace = value_temp.find_first_not_of( ' ' );
+    if ( first_nonspace == StringView::npos ) { /* handle case where value is only space */
+        value_ = value_temp.str();
     } else {
-        value_ = value_temp.substr( first_nonspace );
+        value_ = value_temp.substr( first_nonspace ).str();
     }
 
     /*
@@ -6,6 +6,7 @@
 #include <string>
 
 #include "http_record.pb.h"
+#include "string_view.hh"
 
 class HTTPHeader
 {
@@ -13,7 +14,7 @@ private:
     std::string key_, value_;
 
 public:
-    HTTPHeader( const std::string & buf );
+    HTTPHeader( const StringView & buf );
 
     const std::string & key( void ) const { return key_; }
     const std::string & value( void ) const { return value_; }
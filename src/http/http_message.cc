@@ -1,5 +1,7 @@
 /* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
 
+#include <algorithm>
+
 #include "http_message.hh"
 #include "exception.hh"
 #include "http_record.pb.h"
@@ -7,14 +9,14 @@
 using namespace std;
 
 /* methods called by an external parser */
-void HTTPMessage::set_first_line( const string & str )
+void HTTPMessage::set_first_line( const StringView & str )
 {
     assert( state_ == FIRST_LINE_PENDING );
-    first_line_ = str;
+    first_line_ = str.str();
     state_ = HEADERS_PENDING;
 }
 
-void HTTPMessage::add_header( const std::string & str )
+void HTTPMessage::add_header( const StringView & str )
 {
     assert( state_ == HEADERS_PENDING );
     headers_.emplace_back( str );
@@ -25,6 +27,8 @@ void HTTPMessage::done_with_headers( void )
     assert( state_ == HEADERS_PENDING );
     state_ = BODY_PENDING;
 
+    index_headers();
+
     calculate_expected_body_size();
 }
 
@@ -35,19 +39,19 @@ void HTTPMessage::set_expected_body_size( const bool is_known, const size_t valu
     expected_body_size_ = make_pair( is_known, value );
 }
 
-size_t HTTPMessage::read_in_body( const std::string & str )
+size_t HTTPMessage::read_in_body( const StringView & str )
 {
     assert( state_ == BODY_PENDING );
 
     if ( body_size_is_known() ) {
         /* body size known in advance */
 
-        assert( body_.size() <= expected_body_size() );
-        const size_t amount_to_append = min( expected_body_size() - body_.size(),
+        assert( body_size() <= expected_body_size() );
+        const size_t amount_to_append = min( expected_body_size() - body_size(),
                                              str.size() );
 
-        body_.append( str.substr( 0, amount_to_append ) );
-        if ( body_.size() == expected_body_size() ) {
+        append_to_body( str.substr( 0, amount_to_append ) );
+        if ( body_size() == expected_body_size() ) {
             state_ = COMPLETE;
         }
 
@@ -76,6 +80,42 @@ void HTTPMessage::eof( void )
     }
 }
 
+void HTTPMessage::spill_body_over( const size_t threshold, const string & filename_template )
+{
+    assert( state_ < BODY_PENDING );
+
+    body_spill_threshold_ = threshold;
+    body_spill_template_ = filename_template;
+}
+
+void HTTPMessage::append_to_body( const StringView & str )
+{
+    if ( body_spool_ ) {
+        body_spool_->append( str.str() );
+        return;
+    }
+
+    body_.append( str.data(), str.size() );
+
+    if ( body_spill_threshold_ and body_.size() > body_spill_threshold_ ) {
+        body_spool_ = make_shared< BodySpool >( body_spill_template_ );
+        body_spool_->append( body_ );
+        body_.clear();
+        body_.shrink_to_fit();
+    }
+}
+
+size_t HTTPMessage::body_size( void ) const
+{
+    return body_spool_ ? body_spool_->size() : body_.size();
+}
+
+const BodySpool & HTTPMessage::body_spool( void ) const
+{
+    assert( body_spool_ );
+    return *body_spool_;
+}
+
 bool HTTPMessage::body_size_is_known( void ) const
 {
     assert( state_ > HEADERS_PENDING );
@@ -98,28 +138,28 @@ static char http_to_lower( char c )
     return c;
 }
 
-static string strip_initial_whitespace( const string & str )
+static StringView strip_initial_whitespace( const StringView & str )
 {
-    size_t first_nonspace = str.find_first_not_of( " " );
-    if ( first_nonspace == std::string::npos ) {
-        return "";
+    size_t first_nonspace = str.find_first_not_of( ' ' );
+    if ( first_nonspace == StringView::npos ) {
+        return StringView();
     } else {
         return str.substr( first_nonspace );
     }
 }
 
 /* check if two strings are equivalent per HTTP 1.1 comparison (case-insensitive) */
-bool HTTPMessage::equivalent_strings( const string & a, const string & b )
+bool HTTPMessage::equivalent_strings( const StringView & a, const StringView & b )
 {
-    const string new_a = strip_initial_whitespace( a ),
+    const StringView new_a = strip_initial_whitespace( a ),
         new_b = strip_initial_whitespace( b );
 
     if ( new_a.size() != new_b.size() ) {
         return false;
     }
 
-    for ( auto it_a = new_a.begin(), it_b = new_b.begin(); it_a < new_a.end(); it_a++, it_b++ ) {
-        if ( http_to_lower( *it_a ) != http_to_lower( *it_b ) ) {
+    for ( size_t i = 0; i < new_a.size(); i++ ) {
+        if ( http_to_lower( new_a[ i ] ) != http_to_lower( new_b[ i ] ) ) {
             return false;
         }
     }
@@ -127,28 +167,80 @@ bool HTTPMessage::equivalent_strings( const string & a, const string & b )
     return true;
 }
 
-bool HTTPMessage::has_header( const string & header_name ) const
+/* FNV-1a hash of a header name, canonicalized as in equivalent_strings */
+static uint64_t header_name_hash( const StringView & name )
 {
-    for ( const auto & header : headers_ ) {
+    const StringView stripped = strip_initial_whitespace( name );
+
+    uint64_t hash = 14695981039346656037ULL;
+    for ( size_t i = 0; i < stripped.size(); i++ ) {
+        hash ^= static_cast<unsigned char>( http_to_lower( stripped[ i ] ) );
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+void HTTPMessage::index_headers( void )
+{
+    header_index_.clear();
+    header_index_.reserve( headers_.size() );
+
+    for ( size_t i = 0; i < headers_.size(); i++ ) {
+        header_index_.emplace_back( header_name_hash( headers_[ i ].key() ), i );
+    }
+
+    /* headers with the same name stay in their original order */
+    sort( header_index_.begin(), header_index_.end() );
+}
+
+const HTTPHeader * HTTPMessage::find_header( const StringView & header_name ) const
+{
+    assert( state_ > HEADERS_PENDING );
+
+    const uint64_t hash = header_name_hash( header_name );
+
+    for ( auto it = lower_bound( header_index_.begin(), header_index_.end(), make_pair( hash, size_t( 0 ) ) );
+          it != header_index_.end() and it->first == hash;
+          it++ ) {
         /* canonicalize header name per RFC 2616 section 2.1 */
+        const HTTPHeader & header = headers_.at( it->second );
         if ( equivalent_strings( header.key(), header_name ) ) {
-            return true;
+            return &header;
         }
     }
 
-    return false;
+    return nullptr;
 }
 
-const string & HTTPMessage::get_header_value( const std::string & header_name ) const
+vector< const HTTPHeader * > HTTPMessage::find_headers( const StringView & header_name ) const
 {
-    for ( const auto & header : headers_ ) {
-        /* canonicalize header name per RFC 2616 section 2.1 */
+    assert( state_ > HEADERS_PENDING );
+
+    vector< const HTTPHeader * > ret;
+
+    const uint64_t hash = header_name_hash( header_name );
+
+    for ( auto it = lower_bound( header_index_.begin(), header_index_.end(), make_pair( hash, size_t( 0 ) ) );
+          it != header_index_.end() and it->first == hash;
+          it++ ) {
+        const HTTPHeader & header = headers_.at( it->second );
         if ( equivalent_strings( header.key(), header_name ) ) {
-            return header.value();
+            ret.push_back( &header );
         }
     }
 
-    throw runtime_error( "HTTPMessage header not found: " + header_name );
+    return ret;
+}
+
+const string & HTTPMessage::get_header_value( const StringView & header_name ) const
+{
+    const HTTPHeader * const header = find_header( header_name );
+    if ( not header ) {
+        throw runtime_error( "HTTPMessage header not found: " + header_name.str() );
+    }
+
+    return header->value();
 }
 
 /* serialize the request or response as one string */
@@ -168,12 +260,16 @@ std::string HTTPMessage::str( void ) const
     ret.append( CRLF );
 
     /* add body to request */
-    ret.append( body_ );
+    if ( body_spool_ ) {
+        ret.append( body_spool_->str() );
+    } else {
+        ret.append( body_ );
+    }
 
     return ret;
 }
 
-MahimahiProtobufs::HTTPMessage HTTPMessage::toprotobuf( void ) const
+MahimahiProtobufs::HTTPMessage HTTPMessage::toprotobuf( const bool include_body ) const
 {
     assert( state_ == COMPLETE );
 
@@ -185,7 +281,9 @@ MahimahiProtobufs::HTTPMessage HTTPMessage::toprotobuf( void ) const
         ret.add_header()->CopyFrom( header.toprotobuf() );
     }
 
-    ret.set_body( body_ );
+    if ( include_body ) {
+        ret.set_body( body_spool_ ? body_spool_->str() : body_ );
+    }
 
     return ret;
 }
@@ -198,4 +296,6 @@ HTTPMessage::HTTPMessage( const MahimahiProtobufs::HTTPMessage & proto )
     for ( const auto & header : proto.header() ) {
         headers_.emplace_back( header );
     }
+
+    index_headers();
 }
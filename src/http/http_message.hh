@@ -5,8 +5,12 @@
 
 #include <string>
 #include <vector>
+#include <memory>
+#include <cstdint>
 
 #include "http_header.hh"
+#include "body_spool.hh"
+#include "string_view.hh"
 #include "http_record.pb.h"
 
 enum HTTPMessageState { FIRST_LINE_PENDING, HEADERS_PENDING, BODY_PENDING, COMPLETE };
@@ -26,7 +30,7 @@ private:
     virtual void calculate_expected_body_size( void ) = 0;
 
     /* bodies with size not known in advance must be handled by subclass */
-    virtual size_t read_in_complex_body( const std::string & str ) = 0;
+    virtual size_t read_in_complex_body( const StringView & str ) = 0;
 
     /* does message become complete upon EOF in body? */
     virtual bool eof_in_body( void ) const = 0;
@@ -38,9 +42,25 @@ protected:
     /* request/response headers */
     std::vector< HTTPHeader > headers_ {};
 
+    /* (hash of canonicalized name, position in headers_) for each header,
+       sorted, so lookups by name are a binary search with no allocation */
+    std::vector< std::pair< uint64_t, size_t > > header_index_ {};
+
+    /* build header_index_ once headers_ is complete */
+    void index_headers( void );
+
     /* body may be empty */
     std::string body_ {};
 
+    /* once the body grows past body_spill_threshold_ bytes (if nonzero),
+       it is moved out of body_ and into a temporary file */
+    size_t body_spill_threshold_ { 0 };
+    std::string body_spill_template_ {};
+    std::shared_ptr< BodySpool > body_spool_ {};
+
+    /* append to the body, spilling it to disk if called for */
+    void append_to_body( const StringView & str );
+
     /* state of an in-progress request or response */
     HTTPMessageState state_ { FIRST_LINE_PENDING };
 
@@ -52,31 +72,44 @@ public:
     virtual ~HTTPMessage() {}
 
     /* methods called by an external parser */
-    void set_first_line( const std::string & str );
-    void add_header( const std::string & str );
+    void set_first_line( const StringView & str );
+    void add_header( const StringView & str );
     void done_with_headers( void );
-    size_t read_in_body( const std::string & str );
+    size_t read_in_body( const StringView & str );
     void eof( void );
 
+    /* keep bodies larger than threshold in a temporary file instead of in memory */
+    void spill_body_over( const size_t threshold, const std::string & filename_template );
+
     /* getters */
     bool body_size_is_known( void ) const;
     size_t expected_body_size( void ) const;
     const HTTPMessageState & state( void ) const { return state_; }
     const std::string & first_line( void ) const { return first_line_; }
+    size_t body_size( void ) const;
+    bool body_is_spilled( void ) const { return body_spool_ != nullptr; }
+    const BodySpool & body_spool( void ) const;
+
+    /* troll through the headers (by name, compared case-insensitively) */
+    bool has_header( const StringView & header_name ) const { return find_header( header_name ) != nullptr; }
+    const std::string & get_header_value( const StringView & header_name ) const;
+
+    /* first header with this name, or nullptr if there is none */
+    const HTTPHeader * find_header( const StringView & header_name ) const;
 
-    /* troll through the headers */
-    bool has_header( const std::string & header_name ) const;
-    const std::string & get_header_value( const std::string & header_name ) const;
+    /* all headers with this name, in order */
+    std::vector< const HTTPHeader * > find_headers( const StringView & header_name ) const;
 
     /* serialize the request or response as one string */
     std::string str( void ) const;
 
-    /* return complete request or response as http_message protobuf */
-    MahimahiProtobufs::HTTPMessage toprotobuf( void ) const;
+    /* return complete request or response as http_message protobuf
+       (optionally leaving out the body, e.g. so a spilled body can be streamed) */
+    MahimahiProtobufs::HTTPMessage toprotobuf( const bool include_body = true ) const;
 
     /* compare two strings for (case-insensitive) equality,
        in ASCII without sensitivity to locale */
-    static bool equivalent_strings( const std::string & a, const std::string & b );
+    static bool equivalent_strings( const StringView & a, const StringView & b );
 
     /* construct from protobuf */
     HTTPMessage( const MahimahiProtobufs::HTTPMessage & proto );
@@ -5,30 +5,51 @@
 
 #include <string>
 #include <queue>
+#include <algorithm>
 
 #include "http_message.hh"
+#include "string_view.hh"
 
 template <class MessageType>
 class HTTPMessageSequence
 {
 private:
+    /* unparsed bytes, consumed through a cursor rather than by erasing
+       from the front, so parsing is linear in the bytes received */
     class InternalBuffer
     {
     private:
-        std::string buffer_ {};
-    
+        /* bytes left over between calls to parse(), from storage_start_ on */
+        std::string storage_ {};
+        size_t storage_start_ {};
+
+        /* the bytes being parsed: the leftovers plus the new input, or (when
+           there were no leftovers) borrowed straight from parse()'s caller */
+        StringView input_ {};
+        bool borrowed_ {};
+
+        /* no CRLF begins before this offset in input_ */
+        size_t line_scan_ {};
+
+        size_t find_line_ending( void );
+
     public:
-        bool have_complete_line( void ) const;
+        /* start parsing buf (after any leftovers) */
+        void begin( const std::string & buf );
 
-        std::string get_and_pop_line( void );
+        /* done with this buf: hold on to a copy of whatever wasn't consumed */
+        void end( void );
 
-        void pop_bytes( const size_t n );
+        bool have_complete_line( void ) { return find_line_ending() != StringView::npos; }
+
+        /* the view is good until the next call to begin() */
+        StringView get_and_pop_line( void );
 
-        bool empty( void ) const { return buffer_.empty(); }
+        void pop_bytes( const size_t n );
 
-        void append( const std::string & str ) { buffer_.append( str ); }
+        bool empty( void ) const { return input_.empty(); }
 
-        const std::string & str( void ) const { return buffer_; }
+        const StringView & unparsed( void ) const { return input_; }
     };
 
     /* bytes that haven't been parsed yet */
@@ -65,19 +86,64 @@ public:
 };
 
 template <class MessageType>
-bool HTTPMessageSequence<MessageType>::InternalBuffer::have_complete_line( void ) const
+void HTTPMessageSequence<MessageType>::InternalBuffer::begin( const std::string & buf )
 {
-    size_t first_line_ending = buffer_.find( CRLF );
-    return first_line_ending != std::string::npos;
+    assert( input_.empty() );
+
+    if ( storage_start_ == storage_.size() ) {
+        /* nothing left over, so no need to copy buf */
+        storage_.clear();
+        storage_start_ = 0;
+        input_ = StringView( buf );
+        borrowed_ = true;
+        return;
+    }
+
+    /* compact only once the consumed prefix is at least half the storage */
+    if ( storage_start_ > storage_.size() / 2 ) {
+        storage_.erase( 0, storage_start_ );
+        storage_start_ = 0;
+    }
+
+    storage_.append( buf );
+    input_ = StringView( storage_ ).substr( storage_start_ );
+    borrowed_ = false;
 }
 
 template <class MessageType>
-std::string HTTPMessageSequence<MessageType>::InternalBuffer::get_and_pop_line( void )
+void HTTPMessageSequence<MessageType>::InternalBuffer::end( void )
 {
-    size_t first_line_ending = buffer_.find( CRLF );
-    assert( first_line_ending != std::string::npos );
+    if ( borrowed_ ) {
+        storage_.assign( input_.data(), input_.size() );
+        storage_start_ = 0;
+        borrowed_ = false;
+    }
 
-    std::string first_line( buffer_.substr( 0, first_line_ending ) );
+    input_ = StringView();
+}
+
+template <class MessageType>
+size_t HTTPMessageSequence<MessageType>::InternalBuffer::find_line_ending( void )
+{
+    const size_t line_ending = input_.find( CRLF, line_scan_ );
+
+    if ( line_ending == StringView::npos ) {
+        /* don't rescan these bytes when more arrive (but a trailing CR may start a CRLF) */
+        line_scan_ = std::max( line_scan_, input_.size() - std::min( input_.size(), CRLF.size() - 1 ) );
+    } else {
+        line_scan_ = line_ending;
+    }
+
+    return line_ending;
+}
+
+template <class MessageType>
+StringView HTTPMessageSequence<MessageType>::InternalBuffer::get_and_pop_line( void )
+{
+    const size_t first_line_ending = find_line_ending();
+    assert( first_line_ending != StringView::npos );
+
+    const StringView first_line = input_.substr( 0, first_line_ending );
     pop_bytes( first_line_ending + CRLF.size() );
 
     return first_line;
@@ -86,8 +152,14 @@ std::string HTTPMessageSequence<MessageType>::InternalBuffer::get_and_pop_line(
 template <class MessageType>
 void HTTPMessageSequence<MessageType>::InternalBuffer::pop_bytes( const size_t num )
 {
-    assert( buffer_.size() >= num );
-    buffer_.replace( 0, num, std::string() );
+    assert( input_.size() >= num );
+
+    input_ = input_.substr( num );
+    line_scan_ = line_scan_ > num ? line_scan_ - num : 0;
+
+    if ( not borrowed_ ) {
+        storage_start_ += num;
+    }
 }
 
 template <class MessageType>
@@ -110,7 +182,7 @@ bool HTTPMessageSequence<MessageType>::parsing_step( void )
 
         /* is line blank? */
         {
-            std::string line( buffer_.get_and_pop_line() );
+            const StringView line = buffer_.get_and_pop_line();
             if ( line.empty() ) {
                 message_in_progress_.done_with_headers();
             } else {
@@ -121,8 +193,8 @@ bool HTTPMessageSequence<MessageType>::parsing_step( void )
 
     case BODY_PENDING:
         {
-            size_t bytes_read = message_in_progress_.read_in_body( buffer_.str() );
-            assert( bytes_read == buffer_.str().size() or message_in_progress_.state() == COMPLETE );
+            size_t bytes_read = message_in_progress_.read_in_body( buffer_.unparsed() );
+            assert( bytes_read == buffer_.unparsed().size() or message_in_progress_.state() == COMPLETE );
             buffer_.pop_bytes( bytes_read );
         }
         return message_in_progress_.state() == COMPLETE;
@@ -144,11 +216,17 @@ void HTTPMessageSequence<MessageType>::parse( const std::string & buf )
         message_in_progress_.eof();
     }
 
-    /* append buf to internal buffer */
-    buffer_.append( buf );
+    /* parse as much as we can, keeping only what's left of buf */
+    buffer_.begin( buf );
+
+    try {
+        while ( parsing_step() ) {}
+    } catch ( ... ) {
+        buffer_.end();
+        throw;
+    }
 
-    /* parse as much as we can */
-    while ( parsing_step() ) {}
+    buffer_.end();
 }
 
 #endif /* HTTP_MESSAGE_SEQUENCE */
@@ -14,17 +14,18 @@ void HTTPRequest::calculate_expected_body_size( void )
          or first_line_.substr( 0, 5 ) == "HEAD " ) {
         set_expected_body_size( true, 0 );
     } else if ( first_line_.substr( 0, 5 ) == "POST " ) {
-        if ( !has_header( "Content-Length" ) ) {
+        const HTTPHeader * const content_length = find_header( "Content-Length" );
+        if ( not content_length ) {
             throw runtime_error( "HTTPRequest: does not support chunked requests" );
         }
 
-        set_expected_body_size( true, myatoi( get_header_value( "Content-Length" ) ) );
+        set_expected_body_size( true, myatoi( content_length->value() ) );
     } else {
         throw runtime_error( "Cannot handle HTTP method: " + first_line_ );
     }
 }
 
-size_t HTTPRequest::read_in_complex_body( const std::string & )
+size_t HTTPRequest::read_in_complex_body( const StringView & )
 {
     /* we don't support complex bodies */
     throw runtime_error( "HTTPRequest: does not support chunked requests" );
@@ -27,15 +27,20 @@ void HTTPResponse::calculate_expected_body_size( void )
 
     /* implement rules of RFC 2616 section 4.4 ("Message Length") */
 
-    if ( status_code().at( 0 ) == '1'
-         or status_code() == "204"
-         or status_code() == "304"
+    const string status = status_code();
+    const HTTPHeader * const transfer_encoding = find_header( "Transfer-Encoding" );
+    const HTTPHeader * const content_length = find_header( "Content-Length" );
+    const HTTPHeader * const content_type = find_header( "Content-Type" );
+
+    if ( status.at( 0 ) == '1'
+         or status == "204"
+         or status == "304"
          or request_.is_head() ) {
 
         /* Rule 1: size known to be zero */
         set_expected_body_size( true, 0 );
-    } else if ( has_header( "Transfer-Encoding" )
-                and equivalent_strings( split( get_header_value( "Transfer-Encoding" ), "," ).back(),
+    } else if ( transfer_encoding
+                and equivalent_strings( split( transfer_encoding->value(), "," ).back(),
                                         "chunked" ) ) {
 
         /* Rule 2: size dictated by chunked encoding */
@@ -43,15 +48,15 @@ void HTTPResponse::calculate_expected_body_size( void )
 
         set_expected_body_size( false );
 
-        /* Create body_parser_ with trailers_enabled if requied (RFC 2616 section 14.40) */
-        body_parser_ = unique_ptr< BodyParser >( new ChunkedBodyParser( has_header( "Trailer" ) ) );
-    } else if ( (not has_header( "Transfer-Encoding" ) )
-                and has_header( "Content-Length" ) ) {
+        /* (trailers, announced by a Trailer header or not, are handled by the parser) */
+        body_parser_ = unique_ptr< BodyParser >( new ChunkedBodyParser() );
+    } else if ( (not transfer_encoding)
+                and content_length ) {
 
         /* Rule 3: content-length header present to specify size */
-        set_expected_body_size( true, myatoi( get_header_value( "Content-Length" ) ) );
-    } else if ( has_header( "Content-Type" )
-                and equivalent_strings( MIMEType( get_header_value( "Content-Type" ) ).type(),
+        set_expected_body_size( true, myatoi( content_length->value() ) );
+    } else if ( content_type
+                and equivalent_strings( MIMEType( content_type->value() ).type(),
                                         "multipart/byteranges" ) ) {
 
         /* Rule 4 */
@@ -65,7 +70,7 @@ void HTTPResponse::calculate_expected_body_size( void )
     }
 }
 
-size_t HTTPResponse::read_in_complex_body( const std::string & str )
+size_t HTTPResponse::read_in_complex_body( const StringView & str )
 {
     assert( state_ == BODY_PENDING );
     assert( body_parser_ );
@@ -73,11 +78,11 @@ size_t HTTPResponse::read_in_complex_body( const std::string & str )
     auto amount_parsed = body_parser_->read( str );
     if ( amount_parsed == std::string::npos ) {
         /* all of it belongs to the body */
-        body_.append( str );
+        append_to_body( str );
         return str.size();
     } else {
         /* body is now complete */
-        body_.append( str.substr( 0, amount_parsed ) );
+        append_to_body( str.substr( 0, amount_parsed ) );
         state_ = COMPLETE;
         return amount_parsed;
     }
@@ -19,6 +19,16 @@ void HTTPResponseParser::initialize_new_message( void )
     message_in_progress_.set_request( requests_.front() );
 
     requests_.pop();
+
+    if ( body_spill_threshold_ ) {
+        message_in_progress_.spill_body_over( body_spill_threshold_, body_spill_template_ );
+    }
+}
+
+void HTTPResponseParser::spill_bodies_over( const size_t threshold, const string & filename_template )
+{
+    body_spill_threshold_ = threshold;
+    body_spill_template_ = filename_template;
 }
 
 void HTTPResponseParser::new_request_arrived( const HTTPRequest & request )
@@ -13,10 +13,17 @@ private:
     /* Need this to handle RFC 2616 section 4.4 rule 1 */
     std::queue< HTTPRequest > requests_ {};
 
+    /* response bodies larger than this many bytes (if nonzero) are spilled to disk */
+    size_t body_spill_threshold_ { 0 };
+    std::string body_spill_template_ {};
+
     void initialize_new_message( void ) override;
 
 public:
     void new_request_arrived( const HTTPRequest & request );
+
+    /* keep response bodies larger than threshold in temporary files named after filename_template */
+    void spill_bodies_over( const size_t threshold, const std::string & filename_template );
 };
 
 #endif /* HTTP_RESPONSE_PARSER_HH */
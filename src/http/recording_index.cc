@@ -0,0 +1,350 @@
+/* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <functional>
+#include <unordered_map>
+#include <algorithm>
+
+#include "recording_index.hh"
+#include "http_message.hh"
+#include "file_descriptor.hh"
+#include "temp_file.hh"
+#include "util.hh"
+#include "exception.hh"
+
+#include "http_record.pb.h"
+
+using namespace std;
+
+/* kept in the recording directory next to the records */
+static const string INDEX_NAME = ".mahimahi-index";
+
+/* protobuf wire types */
+enum WireType { VARINT = 0, FIXED64 = 1, LENGTH_DELIMITED = 2, FIXED32 = 5 };
+
+/* field numbers in RequestResponse and HTTPMessage */
+static const uint64_t RECORD_IP = 1, RECORD_PORT = 2, RECORD_REQUEST = 4;
+static const uint64_t MESSAGE_HEADER = 2;
+
+/* reads a file in the protobuf wire format, seeking past (rather than
+   reading) the fields that aren't wanted */
+class WireReader
+{
+private:
+    std::string filename_;
+    FileDescriptor fd_;
+    uint64_t size_;
+
+    std::string buffer_ {};
+    size_t buffer_pos_ {};
+    uint64_t offset_ {};        /* bytes of the file consumed so far */
+
+    bool fill( void )
+    {
+        if ( offset_ >= size_ ) {
+            return false;
+        }
+
+        buffer_ = fd_.read( 65536 );
+        buffer_pos_ = 0;
+        return not buffer_.empty();
+    }
+
+    [[noreturn]] void malformed( void ) const
+    {
+        throw runtime_error( filename_ + ": invalid HTTP request/response" );
+    }
+
+public:
+    WireReader( const string & filename )
+        : filename_( filename ),
+          fd_( SystemCall( "open " + filename, open( filename.c_str(), O_RDONLY ) ) ),
+          size_()
+    {
+        struct stat st;
+        SystemCall( "fstat", fstat( fd_.fd_num(), &st ) );
+        size_ = st.st_size;
+    }
+
+    uint64_t offset( void ) const { return offset_; }
+
+    bool at_end( void ) { return buffer_pos_ == buffer_.size() and not fill(); }
+
+    uint8_t read_byte( void )
+    {
+        if ( at_end() ) {
+            malformed();
+        }
+
+        offset_++;
+        return buffer_[ buffer_pos_++ ];
+    }
+
+    uint64_t read_varint( void )
+    {
+        uint64_t ret = 0;
+        for ( unsigned int shift = 0; shift < 64; shift += 7 ) {
+            const uint8_t byte = read_byte();
+            ret |= uint64_t( byte & 0x7f ) << shift;
+            if ( not ( byte & 0x80 ) ) {
+                return ret;
+            }
+        }
+
+        malformed();
+    }
+
+    /* a length-delimited field's contents */
+    string read_bytes( void )
+    {
+        const uint64_t length = read_varint();
+        if ( length > size_ - offset_ ) {
+            malformed();
+        }
+
+        string ret;
+        ret.reserve( length );
+        while ( ret.size() < length ) {
+            if ( at_end() ) {
+                malformed();
+            }
+            const size_t count = min( buffer_.size() - buffer_pos_, size_t( length - ret.size() ) );
+            ret.append( buffer_, buffer_pos_, count );
+            buffer_pos_ += count;
+            offset_ += count;
+        }
+
+        return ret;
+    }
+
+    void skip( const uint64_t length )
+    {
+        if ( length > size_ - offset_ ) {
+            malformed();
+        }
+
+        const size_t buffered = buffer_.size() - buffer_pos_;
+        if ( length <= buffered ) {
+            buffer_pos_ += length;
+        } else {
+            SystemCall( "lseek", lseek( fd_.fd_num(), length - buffered, SEEK_CUR ) );
+            buffer_.clear();
+            buffer_pos_ = 0;
+        }
+
+        offset_ += length;
+    }
+
+    void skip_field( const uint64_t wire_type )
+    {
+        switch ( wire_type ) {
+        case VARINT: read_varint(); break;
+        case FIXED64: skip( 8 ); break;
+        case LENGTH_DELIMITED: skip( read_varint() ); break;
+        case FIXED32: skip( 4 ); break;
+        default: malformed(); /* groups never appear in our records */
+        }
+    }
+
+    const string & filename( void ) const { return filename_; }
+};
+
+/* the first Host header in the HTTPMessage starting at input's position */
+static void find_host( WireReader & input, string & host, bool & have_host )
+{
+    const uint64_t length = input.read_varint();
+    const uint64_t end = input.offset() + length;
+
+    while ( input.offset() < end ) {
+        const uint64_t tag = input.read_varint();
+
+        if ( ( tag >> 3 ) == MESSAGE_HEADER and ( tag & 7 ) == LENGTH_DELIMITED ) {
+            MahimahiProtobufs::HTTPHeader header;
+            if ( not header.ParseFromString( input.read_bytes() ) ) {
+                throw runtime_error( input.filename() + ": invalid HTTP header" );
+            }
+
+            if ( not have_host and HTTPMessage::equivalent_strings( header.key(), "Host" ) ) {
+                host = header.value();
+                have_host = true;
+            }
+        } else {
+            input.skip_field( tag & 7 ); /* first line and body */
+        }
+    }
+
+    if ( input.offset() != end ) {
+        throw runtime_error( input.filename() + ": invalid HTTP request/response" );
+    }
+}
+
+RecordSummary summarize_record( const string & filename )
+{
+    WireReader input( filename );
+
+    string ip;
+    uint32_t port = 0;
+    string host;
+    bool have_host = false;
+
+    /* a field may repeat (the last ip or port wins, and requests
+       merge), so read to the end even after finding everything */
+    while ( not input.at_end() ) {
+        const uint64_t tag = input.read_varint();
+        const uint64_t field = tag >> 3, wire_type = tag & 7;
+
+        if ( field == RECORD_IP and wire_type == LENGTH_DELIMITED ) {
+            ip = input.read_bytes();
+        } else if ( field == RECORD_PORT and wire_type == VARINT ) {
+            port = input.read_varint();
+        } else if ( field == RECORD_REQUEST and wire_type == LENGTH_DELIMITED ) {
+            find_host( input, host, have_host );
+        } else {
+            input.skip_field( wire_type ); /* the response */
+        }
+    }
+
+    if ( not have_host ) {
+        throw runtime_error( filename + ": HTTPHeader \"Host\" not found" );
+    }
+
+    RecordSummary ret;
+    ret.address = Address( ip, port );
+    ret.host = host;
+    return ret;
+}
+
+bool is_recording_index( const string & filename )
+{
+    const size_t slash = filename.rfind( '/' );
+    const string basename = filename.substr( slash == string::npos ? 0 : slash + 1 );
+
+    /* includes a temporary file left by an interrupted update */
+    return basename.compare( 0, INDEX_NAME.size(), INDEX_NAME ) == 0;
+}
+
+/* run job( 0 ) through job( count - 1 ) on a few threads,
+   rethrowing the first exception any of them throws */
+static void parallel_for( const size_t count, const function<void(size_t)> & job )
+{
+    const size_t thread_count = min( count, size_t( max( 1u, thread::hardware_concurrency() ) ) );
+
+    atomic<size_t> next( 0 );
+    mutex error_mutex;
+    exception_ptr error;
+
+    auto worker = [&] () {
+        try {
+            for ( size_t i = next++; i < count; i = next++ ) {
+                job( i );
+            }
+        } catch ( ... ) {
+            unique_lock<mutex> ul( error_mutex );
+            if ( not error ) {
+                error = current_exception();
+            }
+            next = count; /* stop the other threads early */
+        }
+    };
+
+    vector< thread > threads;
+    for ( size_t i = 0; i < thread_count; i++ ) {
+        threads.emplace_back( worker );
+    }
+
+    for ( auto & thread : threads ) {
+        thread.join();
+    }
+
+    if ( error ) {
+        rethrow_exception( error );
+    }
+}
+
+static MahimahiProtobufs::RecordingIndex read_index( const string & filename )
+{
+    MahimahiProtobufs::RecordingIndex index;
+
+    const int fd_num = open( filename.c_str(), O_RDONLY );
+    if ( fd_num < 0 ) {
+        return index; /* no index yet */
+    }
+
+    FileDescriptor fd( fd_num );
+    if ( not index.ParseFromFileDescriptor( fd.fd_num() ) ) {
+        index.Clear(); /* start over */
+    }
+
+    return index;
+}
+
+vector< RecordSummary > summarize_recording( const string & directory )
+{
+    vector< string > files = list_directory_contents( directory );
+    files.erase( remove_if( files.begin(), files.end(), is_recording_index ), files.end() );
+
+    /* what the index says about each record, by file name */
+    const MahimahiProtobufs::RecordingIndex old_index = read_index( directory + INDEX_NAME );
+    unordered_map< string, const MahimahiProtobufs::RecordingIndex::Entry * > cached;
+    for ( const auto & entry : old_index.entry() ) {
+        cached.emplace( entry.filename(), &entry );
+    }
+
+    vector< RecordSummary > ret( files.size() );
+    MahimahiProtobufs::RecordingIndex new_index;
+    vector< size_t > stale;
+
+    for ( size_t i = 0; i < files.size(); i++ ) {
+        struct stat st;
+        SystemCall( "stat " + files.at( i ), stat( files.at( i ).c_str(), &st ) );
+
+        auto & entry = *new_index.add_entry();
+        entry.set_filename( files.at( i ).substr( directory.size() ) );
+        entry.set_size( st.st_size );
+        entry.set_mtime_ns( int64_t( st.st_mtim.tv_sec ) * 1000000000 + st.st_mtim.tv_nsec );
+
+        const auto it = cached.find( entry.filename() );
+        if ( it != cached.end()
+             and it->second->size() == entry.size()
+             and it->second->mtime_ns() == entry.mtime_ns() ) {
+            entry = *it->second;
+            ret.at( i ).address = Address( entry.ip(), entry.port() );
+            ret.at( i ).host = entry.host();
+        } else {
+            stale.push_back( i );
+        }
+    }
+
+    /* read the new or changed records */
+    parallel_for( stale.size(), [&] ( const size_t j ) {
+            const size_t i = stale.at( j );
+            ret.at( i ) = summarize_record( files.at( i ) );
+
+            auto & entry = *new_index.mutable_entry( i );
+            entry.set_ip( ret.at( i ).address.ip() );
+            entry.set_port( ret.at( i ).address.port() );
+            entry.set_host( ret.at( i ).host );
+        } );
+
+    /* save the index for next time, if the directory is writable */
+    if ( not stale.empty() or new_index.entry_size() != old_index.entry_size() ) {
+        try {
+            string serialized;
+            if ( not new_index.SerializeToString( &serialized ) ) {
+                throw runtime_error( "failure to serialize recording index" );
+            }
+
+            UniqueFile file( directory + INDEX_NAME );
+            file.write( serialized );
+            SystemCall( "rename " + file.name(), rename( file.name().c_str(), ( directory + INDEX_NAME ).c_str() ) );
+        } catch ( const unix_error & ) {}
+    }
+
+    return ret;
+}
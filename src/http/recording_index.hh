@@ -0,0 +1,30 @@
+/* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef RECORDING_INDEX_HH
+#define RECORDING_INDEX_HH
+
+#include <string>
+#include <vector>
+
+#include "address.hh"
+
+/* what mm-webreplay needs to know to serve one stored request/response */
+struct RecordSummary
+{
+    Address address {};
+    std::string host {};
+};
+
+/* read just the server address and Host header of a stored record,
+   skipping over the request and response bodies */
+RecordSummary summarize_record( const std::string & filename );
+
+/* summarize every record in directory (which ends in '/'), in parallel,
+   reusing the summaries cached in the directory's index file for records
+   that haven't changed, and updating the index if it can */
+std::vector< RecordSummary > summarize_recording( const std::string & directory );
+
+/* is this file in a recording directory its index, rather than a record? */
+bool is_recording_index( const std::string & filename );
+
+#endif /* RECORDING_INDEX_HH */
@@ -0,0 +1,321 @@
+/* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <climits>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include <openssl/pem.h>
+#include <openssl/x509v3.h>
+#include <openssl/rsa.h>
+#include <openssl/rand.h>
+
+#include "certificate_authority.hh"
+#include "secure_socket.hh"
+#include "temp_file.hh"
+#include "file_descriptor.hh"
+#include "exception.hh"
+
+using namespace std;
+
+static const long DAY = 24 * 60 * 60;
+static const long CA_VALIDITY_DAYS = 3650;
+static const long LEAF_VALIDITY_DAYS = 365;
+
+struct BIO_deleter { void operator()( BIO * x ) const { BIO_free( x ); } };
+typedef unique_ptr<BIO, BIO_deleter> BIO_handle;
+
+struct PKEY_CTX_deleter { void operator()( EVP_PKEY_CTX * x ) const { EVP_PKEY_CTX_free( x ); } };
+
+/* contents of a file, or "" if it doesn't exist */
+static string read_file( const string & filename )
+{
+    const int fd_num = open( filename.c_str(), O_RDONLY );
+    if ( fd_num < 0 ) {
+        if ( errno == ENOENT ) {
+            return string();
+        }
+        throw unix_error( "open " + filename );
+    }
+
+    FileDescriptor fd( fd_num );
+    string ret;
+    while ( not fd.eof() ) {
+        ret.append( fd.read() );
+    }
+
+    return ret;
+}
+
+/* replace a file all at once, so nobody sees it half-written */
+static void write_file( const string & filename, const string & contents )
+{
+    UniqueFile file( filename );
+    file.write( contents );
+    SystemCall( "rename " + file.name(), rename( file.name().c_str(), filename.c_str() ) );
+}
+
+static void make_directory_if_missing( const string & directory )
+{
+    if ( mkdir( directory.c_str(), 00700 ) < 0 and errno != EEXIST ) {
+        throw unix_error( "mkdir " + directory );
+    }
+}
+
+static BIO_handle pem_source( const string & pem )
+{
+    BIO_handle ret( BIO_new_mem_buf( const_cast<char *>( pem.data() ), pem.size() ) );
+    if ( not ret ) {
+        throw ssl_error( "BIO_new_mem_buf" );
+    }
+    return ret;
+}
+
+static BIO_handle pem_sink( void )
+{
+    BIO_handle ret( BIO_new( BIO_s_mem() ) );
+    if ( not ret ) {
+        throw ssl_error( "BIO_new" );
+    }
+    return ret;
+}
+
+static string pem_contents( BIO * bio )
+{
+    char * data;
+    const long length = BIO_get_mem_data( bio, &data );
+    return string( data, length );
+}
+
+static EVP_PKEY * generate_key( void )
+{
+    unique_ptr<EVP_PKEY_CTX, PKEY_CTX_deleter> ctx( EVP_PKEY_CTX_new_id( EVP_PKEY_RSA, nullptr ) );
+    EVP_PKEY * key = nullptr;
+
+    if ( not ctx
+         or EVP_PKEY_keygen_init( ctx.get() ) <= 0
+         or EVP_PKEY_CTX_set_rsa_keygen_bits( ctx.get(), 2048 ) <= 0
+         or EVP_PKEY_keygen( ctx.get(), &key ) <= 0 ) {
+        throw ssl_error( "EVP_PKEY_keygen" );
+    }
+
+    return key;
+}
+
+static void add_extension( X509 * certificate, X509 * issuer, const int nid, const string & value )
+{
+    X509V3_CTX ctx;
+    X509V3_set_ctx( &ctx, issuer, certificate, nullptr, nullptr, 0 );
+
+    X509_EXTENSION * extension = X509V3_EXT_conf_nid( nullptr, &ctx, nid, const_cast<char *>( value.c_str() ) );
+    if ( not extension ) {
+        throw ssl_error( "X509V3_EXT_conf_nid" );
+    }
+
+    const int ok = X509_add_ext( certificate, extension, -1 );
+    X509_EXTENSION_free( extension );
+    if ( not ok ) {
+        throw ssl_error( "X509_add_ext" );
+    }
+}
+
+/* DNS names only (anything else keeps the compiled-in certificate),
+   which also makes them safe to use as file names */
+static bool usable_hostname( const string & hostname )
+{
+    if ( hostname.empty() or hostname.size() > 253 or hostname.front() == '.' ) {
+        return false;
+    }
+
+    for ( const char c : hostname ) {
+        if ( not ( isalnum( static_cast<unsigned char>( c ) ) or c == '.' or c == '-' or c == '_' ) ) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+CertificateAuthority::CertificateAuthority( const string & directory )
+    : directory_( directory.empty() or directory.back() == '/' ? directory : directory + "/" ),
+      ca_key_(),
+      ca_certificate_(),
+      leaf_key_(),
+      mutex_(),
+      certificates_()
+{
+    make_directory_if_missing( directory_ );
+    make_directory_if_missing( directory_ + "certs" );
+
+    load_or_create_ca();
+    leaf_key_ = load_or_create_key( directory_ + "leaf.key" );
+}
+
+CertificateAuthority::PKEY_handle CertificateAuthority::load_or_create_key( const string & filename )
+{
+    const string pem = read_file( filename );
+
+    if ( not pem.empty() ) {
+        PKEY_handle key( PEM_read_bio_PrivateKey( pem_source( pem ).get(), nullptr, nullptr, nullptr ) );
+        if ( not key ) {
+            throw ssl_error( "PEM_read_bio_PrivateKey " + filename );
+        }
+        return key;
+    }
+
+    PKEY_handle key( generate_key() );
+
+    BIO_handle bio( pem_sink() );
+    if ( not PEM_write_bio_PrivateKey( bio.get(), key.get(), nullptr, nullptr, 0, nullptr, nullptr ) ) {
+        throw ssl_error( "PEM_write_bio_PrivateKey" );
+    }
+    write_file( filename, pem_contents( bio.get() ) );
+
+    return key;
+}
+
+/* unsigned certificate for key, named common_name, valid (from a day ago) for days */
+static X509 * new_certificate( const string & common_name, EVP_PKEY * key, const long days )
+{
+    X509 * certificate = X509_new();
+    if ( not certificate ) {
+        throw ssl_error( "X509_new" );
+    }
+
+    /* a random serial number, so a re-minted certificate never repeats one */
+    long serial;
+    if ( RAND_bytes( reinterpret_cast<unsigned char *>( &serial ), sizeof( serial ) ) != 1 ) {
+        X509_free( certificate );
+        throw ssl_error( "RAND_bytes" );
+    }
+
+    X509_NAME * const name = X509_get_subject_name( certificate );
+
+    if ( not X509_set_version( certificate, 2 ) /* X.509 v3 */
+         or not ASN1_INTEGER_set( X509_get_serialNumber( certificate ), serial & LONG_MAX )
+         or not X509_gmtime_adj( X509_get_notBefore( certificate ), -DAY )
+         or not X509_gmtime_adj( X509_get_notAfter( certificate ), days * DAY )
+         or not X509_set_pubkey( certificate, key )
+         or not X509_NAME_add_entry_by_txt( name, "CN", MBSTRING_ASC,
+                                            reinterpret_cast<const unsigned char *>( common_name.c_str() ),
+                                            -1, -1, 0 ) ) {
+        X509_free( certificate );
+        throw ssl_error( "new certificate" );
+    }
+
+    return certificate;
+}
+
+void CertificateAuthority::load_or_create_ca( void )
+{
+    ca_key_ = load_or_create_key( directory_ + "ca.key" );
+
+    const string filename = directory_ + "ca.pem";
+    const string pem = read_file( filename );
+
+    if ( not pem.empty() ) {
+        ca_certificate_.reset( PEM_read_bio_X509( pem_source( pem ).get(), nullptr, nullptr, nullptr ) );
+        if ( not ca_certificate_ ) {
+            throw ssl_error( "PEM_read_bio_X509 " + filename );
+        }
+
+        if ( not X509_check_private_key( ca_certificate_.get(), ca_key_.get() ) ) {
+            throw runtime_error( filename + " does not match " + directory_ + "ca.key" );
+        }
+
+        return;
+    }
+
+    X509_handle certificate( new_certificate( "Mahimahi recording CA", ca_key_.get(), CA_VALIDITY_DAYS ) );
+    X509 * const ca = certificate.get();
+
+    if ( not X509_set_issuer_name( ca, X509_get_subject_name( ca ) ) ) {
+        throw ssl_error( "X509_set_issuer_name" );
+    }
+
+    add_extension( ca, ca, NID_basic_constraints, "critical,CA:TRUE" );
+    add_extension( ca, ca, NID_key_usage, "critical,keyCertSign,cRLSign" );
+    add_extension( ca, ca, NID_subject_key_identifier, "hash" );
+
+    if ( not X509_sign( ca, ca_key_.get(), EVP_sha256() ) ) {
+        throw ssl_error( "X509_sign" );
+    }
+
+    BIO_handle bio( pem_sink() );
+    if ( not PEM_write_bio_X509( bio.get(), ca ) ) {
+        throw ssl_error( "PEM_write_bio_X509" );
+    }
+    write_file( filename, pem_contents( bio.get() ) );
+
+    ca_certificate_ = move( certificate );
+}
+
+CertificateAuthority::X509_handle CertificateAuthority::mint( const string & hostname ) const
+{
+    X509_handle certificate( new_certificate( hostname, leaf_key_.get(), LEAF_VALIDITY_DAYS ) );
+    X509 * const leaf = certificate.get();
+
+    if ( not X509_set_issuer_name( leaf, X509_get_subject_name( ca_certificate_.get() ) ) ) {
+        throw ssl_error( "X509_set_issuer_name" );
+    }
+
+    add_extension( leaf, ca_certificate_.get(), NID_basic_constraints, "critical,CA:FALSE" );
+    add_extension( leaf, ca_certificate_.get(), NID_ext_key_usage, "serverAuth" );
+    add_extension( leaf, ca_certificate_.get(), NID_subject_alt_name, "DNS:" + hostname );
+    add_extension( leaf, ca_certificate_.get(), NID_authority_key_identifier, "keyid" );
+
+    if ( not X509_sign( leaf, ca_key_.get(), EVP_sha256() ) ) {
+        throw ssl_error( "X509_sign" );
+    }
+
+    return certificate;
+}
+
+X509 * CertificateAuthority::certificate_for( const string & hostname )
+{
+    if ( not usable_hostname( hostname ) ) {
+        return nullptr;
+    }
+
+    /* DNS names are case-insensitive */
+    string name( hostname );
+    for ( auto & c : name ) {
+        c = tolower( static_cast<unsigned char>( c ) );
+    }
+
+    unique_lock<mutex> ul( mutex_ );
+
+    /* minted (or loaded) earlier in this run? */
+    const auto it = certificates_.find( name );
+    if ( it != certificates_.end() ) {
+        return it->second.get();
+    }
+
+    /* minted in an earlier run? (use it only if still valid and from this CA) */
+    const string filename = directory_ + "certs/" + name + ".pem";
+    const string pem = read_file( filename );
+
+    X509_handle certificate;
+    if ( not pem.empty() ) {
+        certificate.reset( PEM_read_bio_X509( pem_source( pem ).get(), nullptr, nullptr, nullptr ) );
+        if ( certificate
+             and ( X509_cmp_current_time( X509_get_notAfter( certificate.get() ) ) <= 0
+                   or X509_verify( certificate.get(), ca_key_.get() ) != 1 ) ) {
+            certificate.reset();
+        }
+        ERR_clear_error();
+    }
+
+    if ( not certificate ) {
+        certificate = mint( name );
+
+        BIO_handle bio( pem_sink() );
+        if ( not PEM_write_bio_X509( bio.get(), certificate.get() ) ) {
+            throw ssl_error( "PEM_write_bio_X509" );
+        }
+        write_file( filename, pem_contents( bio.get() ) );
+    }
+
+    X509 * const ret = certificate.get();
+    certificates_.emplace( name, move( certificate ) );
+    return ret;
+}
@@ -0,0 +1,58 @@
+/* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef CERTIFICATE_AUTHORITY_HH
+#define CERTIFICATE_AUTHORITY_HH
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include <openssl/x509.h>
+#include <openssl/evp.h>
+
+/* a local certificate authority that mints a leaf certificate for each
+   server name, so a client that trusts the CA sees a matching certificate.
+
+   The CA's key and certificate (ca.key, ca.pem) and the key shared by all
+   leaf certificates (leaf.key) live in a directory, and are created there
+   if missing; minted certificates are cached in memory and in its certs/
+   subdirectory. */
+class CertificateAuthority
+{
+private:
+    struct X509_deleter { void operator()( X509 * x ) const { X509_free( x ); } };
+    typedef std::unique_ptr<X509, X509_deleter> X509_handle;
+
+    struct PKEY_deleter { void operator()( EVP_PKEY * x ) const { EVP_PKEY_free( x ); } };
+    typedef std::unique_ptr<EVP_PKEY, PKEY_deleter> PKEY_handle;
+
+    std::string directory_;
+
+    PKEY_handle ca_key_;
+    X509_handle ca_certificate_;
+    PKEY_handle leaf_key_;
+
+    std::mutex mutex_;
+    std::unordered_map< std::string, X509_handle > certificates_; /* protected by mutex_ */
+
+    void load_or_create_ca( void );
+    PKEY_handle load_or_create_key( const std::string & filename );
+    X509_handle mint( const std::string & hostname ) const;
+
+public:
+    CertificateAuthority( const std::string & directory );
+
+    /* certificate for hostname (good as long as the CA is), or nullptr if
+       the name can't be given one (e.g. it contains odd characters) */
+    X509 * certificate_for( const std::string & hostname );
+
+    /* private key of every leaf certificate */
+    EVP_PKEY * leaf_key( void ) const { return leaf_key_.get(); }
+
+    /* forbid copying */
+    CertificateAuthority( const CertificateAuthority & other ) = delete;
+    CertificateAuthority & operator=( const CertificateAuthority & other ) = delete;
+};
+
+#endif /* CERTIFICATE_AUTHORITY_HH */
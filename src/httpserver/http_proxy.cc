@@ -24,10 +24,17 @@
 using namespace std;
 using namespace PollerShortNames;
 
-HTTPProxy::HTTPProxy( const Address & listener_addr )
+HTTPProxy::HTTPProxy( const Address & listener_addr, const size_t body_spill_threshold,
+                      const unsigned int worker_threads,
+                      const string & ca_directory )
     : listener_socket_(),
       server_context_( SERVER ),
-      client_context_( CLIENT )
+      client_context_( CLIENT ),
+      body_spill_threshold_( body_spill_threshold ),
+      worker_threads_( worker_threads ),
+      worker_pool_(),
+      ca_directory_( ca_directory ),
+      certificate_authority_()
 {
     listener_socket_.bind( listener_addr );
     listener_socket_.listen();
@@ -43,12 +50,24 @@ void HTTPProxy::loop( SocketType & server, SocketType & client, HTTPBackingStore
 
     const Address server_addr = client.original_dest();
 
+    response_parser.spill_bodies_over( body_spill_threshold_, "/tmp/mm-webrecord_body" );
+
     /* poll on original connect socket and new connection socket to ferry packets */
-    /* responses from server go to response parser */
+    /* responses from server are passed through to the client as they arrive,
+       and a copy goes to the response parser to be recorded */
     poller.add_action( Poller::Action( server, Direction::In,
                                        [&] () {
                                            string buffer = server.read();
+                                           if ( not buffer.empty() ) {
+                                               client.write( buffer );
+                                           }
                                            response_parser.parse( buffer );
+
+                                           /* save completed responses */
+                                           while ( not response_parser.empty() ) {
+                                               backing_store.save( response_parser.front(), server_addr );
+                                               response_parser.pop();
+                                           }
                                            return ResultType::Continue;
                                        },
                                        [&] () { return not client.eof(); } ) );
@@ -72,16 +91,6 @@ void HTTPProxy::loop( SocketType & server, SocketType & client, HTTPBackingStore
                                        },
                                        [&] () { return not request_parser.empty(); } ) );
 
-    /* completed responses from server are serialized and sent to client */
-    poller.add_action( Poller::Action( client, Direction::Out,
-                                       [&] () {
-                                           client.write( response_parser.front().str() );
-                                           backing_store.save( response_parser.front(), server_addr );
-                                           response_parser.pop();
-                                           return ResultType::Continue;
-                                       },
-                                       [&] () { return not response_parser.empty(); } ) );
-
     while ( true ) {
         if ( poller.poll( -1 ).result == Poller::Result::Type::Exit ) {
             return;
@@ -91,6 +100,11 @@ void HTTPProxy::loop( SocketType & server, SocketType & client, HTTPBackingStore
 
 void HTTPProxy::handle_tcp( HTTPBackingStore & backing_store )
 {
+    if ( worker_pool_ ) {
+        worker_pool_->dispatch( listener_socket_.accept() );
+        return;
+    }
+
     thread newthread( [&] ( TCPSocket client ) {
             try {
                 /* get original destination for connection request */
@@ -126,6 +140,19 @@ void HTTPProxy::handle_tcp( HTTPBackingStore & backing_store )
    backing_store (which is captured and must continue to persist) */
 void HTTPProxy::register_handlers( EventLoop & event_loop, HTTPBackingStore & backing_store )
 {
+    /* the CA's files are created by the (unprivileged) process that serves */
+    if ( not ca_directory_.empty() and not certificate_authority_ ) {
+        certificate_authority_.reset( new CertificateAuthority( ca_directory_ ) );
+        server_context_.mint_certificates_with( *certificate_authority_ );
+    }
+
+    /* workers are started here (not in the constructor) so that they
+       run in the process that serves, with its signal mask */
+    if ( worker_threads_ and not worker_pool_ ) {
+        worker_pool_.reset( new ProxyWorkerPool( worker_threads_, server_context_, client_context_,
+                                                 backing_store, body_spill_threshold_ ) );
+    }
+
     event_loop.add_simple_input_handler( tcp_listener(),
                                          [&] () {
                                              handle_tcp( backing_store );
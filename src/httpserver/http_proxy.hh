@@ -4,10 +4,13 @@
 #define HTTP_PROXY_HH
 
 #include <string>
+#include <memory>
 
 #include "socket.hh"
 #include "secure_socket.hh"
 #include "http_response.hh"
+#include "proxy_worker_pool.hh"
+#include "certificate_authority.hh"
 
 class HTTPBackingStore;
 class EventLoop;
@@ -25,8 +28,22 @@ private:
 
     SSLContext server_context_, client_context_;
 
+    /* recorded response bodies larger than this (if nonzero) are spilled to disk */
+    size_t body_spill_threshold_;
+
+    /* if nonzero, connections are handled by this many event-driven
+       worker threads instead of a thread per connection */
+    unsigned int worker_threads_;
+    std::unique_ptr<ProxyWorkerPool> worker_pool_;
+
+    /* if not empty, directory of the local CA used to mint a certificate per server name */
+    std::string ca_directory_;
+    std::unique_ptr<CertificateAuthority> certificate_authority_;
+
 public:
-    HTTPProxy( const Address & listener_addr );
+    HTTPProxy( const Address & listener_addr, const size_t body_spill_threshold = 0,
+               const unsigned int worker_threads = 0,
+               const std::string & ca_directory = "" );
 
     TCPSocket & tcp_listener( void ) { return listener_socket_; }
 
@@ -0,0 +1,528 @@
+/* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <queue>
+#include <unordered_map>
+
+#include "proxy_worker_pool.hh"
+#include "secure_socket.hh"
+#include "socketpair.hh"
+#include "epoller.hh"
+#include "http_request_parser.hh"
+#include "http_response_parser.hh"
+#include "backing_store.hh"
+#include "exception.hh"
+
+using namespace std;
+
+/* stop reading from one side while this much is waiting to be written to the other */
+static const size_t MAX_PENDING = 1024 * 1024;
+
+/* one side of a proxied connection, operated without blocking */
+class Endpoint
+{
+public:
+    virtual FileDescriptor & fd( void ) = 0;
+
+    /* advance the TLS handshake, if any; true when done */
+    virtual bool handshake( void ) { return true; }
+
+    /* "" if nothing available yet (check fd().eof()) */
+    virtual string read( void ) = 0;
+
+    /* returns number of bytes taken (possibly 0) */
+    virtual size_t write( const string & buffer, const size_t offset ) = 0;
+
+    /* does the last call that couldn't finish need the fd to become writable? */
+    virtual bool wants_write( void ) const { return false; }
+
+    virtual ~Endpoint() {}
+};
+
+class PlainEndpoint : public Endpoint
+{
+private:
+    TCPSocket socket_;
+
+public:
+    PlainEndpoint( TCPSocket && socket ) : socket_( move( socket ) ) {}
+
+    TCPSocket & socket( void ) { return socket_; }
+
+    FileDescriptor & fd( void ) override { return socket_; }
+
+    string read( void ) override { return socket_.read( MAX_PENDING ); }
+
+    size_t write( const string & buffer, const size_t offset ) override
+    {
+        const auto begin = buffer.cbegin() + offset;
+        return socket_.write( begin, buffer.cend() ) - begin;
+    }
+};
+
+class TLSEndpoint : public Endpoint
+{
+private:
+    SecureSocket socket_;
+    SSL_MODE mode_; /* CLIENT towards the server, SERVER towards the client */
+
+public:
+    TLSEndpoint( SecureSocket && socket, const SSL_MODE mode )
+        : socket_( move( socket ) ), mode_( mode )
+    {}
+
+    FileDescriptor & fd( void ) override { return socket_; }
+
+    bool handshake( void ) override
+    {
+        return mode_ == CLIENT ? socket_.connect_nonblocking() : socket_.accept_nonblocking();
+    }
+
+    string read( void ) override { return socket_.read_nonblocking( MAX_PENDING ); }
+
+    size_t write( const string & buffer, const size_t offset ) override
+    {
+        return socket_.write_nonblocking( buffer.data() + offset, buffer.size() - offset );
+    }
+
+    bool wants_write( void ) const override { return socket_.wants_write(); }
+};
+
+/* bytes waiting to be written to one side */
+class PendingOutput
+{
+private:
+    queue< string > chunks_ {};
+    size_t offset_ {}; /* into the front chunk */
+    size_t bytes_ {};
+
+public:
+    void push( string && chunk )
+    {
+        bytes_ += chunk.size();
+        chunks_.push( move( chunk ) );
+    }
+
+    /* write as much as the endpoint will take */
+    void write_to( Endpoint & endpoint )
+    {
+        while ( not chunks_.empty() ) {
+            const size_t bytes_written = endpoint.write( chunks_.front(), offset_ );
+            if ( bytes_written == 0 ) {
+                return;
+            }
+
+            offset_ += bytes_written;
+            bytes_ -= bytes_written;
+
+            if ( offset_ == chunks_.front().size() ) {
+                chunks_.pop();
+                offset_ = 0;
+            }
+        }
+    }
+
+    bool empty( void ) const { return chunks_.empty(); }
+    size_t bytes( void ) const { return bytes_; }
+};
+
+/* one client connection and its connection to the original destination,
+   advanced a step at a time as the worker's epoll loop reports readiness */
+class Connection
+{
+private:
+    enum class State { Connecting, ServerHandshake, ClientHandshake, Proxying, Closed };
+    State state_;
+
+    SSLContext & server_context_, & client_context_;
+    HTTPBackingStore & backing_store_;
+
+    const Address server_addr_;
+
+    unique_ptr< Endpoint > client_, server_;
+
+    HTTPRequestParser request_parser_ {};
+    HTTPResponseParser response_parser_ {};
+
+    PendingOutput to_client_ {}, to_server_ {};
+
+    /* (as in the blocking proxy) once either side is done, stop reading from both */
+    bool reading( void ) const { return not client_->fd().eof() and not server_->fd().eof(); }
+
+    void read_requests( void );
+    void read_responses( void );
+
+    static TCPSocket release( unique_ptr< Endpoint > & plain )
+    {
+        return move( static_cast<PlainEndpoint &>( *plain ).socket() );
+    }
+
+public:
+    Connection( TCPSocket && client,
+                SSLContext & server_context, SSLContext & client_context,
+                HTTPBackingStore & backing_store,
+                const size_t body_spill_threshold );
+
+    FileDescriptor & client_fd( void ) { return client_->fd(); }
+    FileDescriptor & server_fd( void ) { return server_->fd(); }
+
+    /* make whatever progress is possible after events on fd */
+    void process( const int fd, const uint32_t events );
+
+    /* events to wait for on fd (one of ours) */
+    uint32_t interest( const FileDescriptor & fd ) const;
+
+    void close( void ) { state_ = State::Closed; }
+
+    /* nothing more to do, so the sockets can be closed */
+    bool finished( void ) const;
+};
+
+Connection::Connection( TCPSocket && client,
+                        SSLContext & server_context, SSLContext & client_context,
+                        HTTPBackingStore & backing_store,
+                        const size_t body_spill_threshold )
+    : state_( State::Connecting ),
+      server_context_( server_context ),
+      client_context_( client_context ),
+      backing_store_( backing_store ),
+      server_addr_( client.original_dest() ),
+      client_( new PlainEndpoint( move( client ) ) ),
+      server_( new PlainEndpoint( TCPSocket() ) )
+{
+    client_->fd().set_blocking( false );
+    server_->fd().set_blocking( false );
+
+    static_cast<PlainEndpoint &>( *server_ ).socket().start_connect( server_addr_ );
+
+    response_parser_.spill_bodies_over( body_spill_threshold, "/tmp/mm-webrecord_body" );
+}
+
+void Connection::process( const int fd, const uint32_t events )
+{
+    switch ( state_ ) {
+    case State::Connecting:
+        static_cast<PlainEndpoint &>( *server_ ).socket().check_connect();
+
+        if ( server_addr_.port() != 443 ) { /* normal HTTP */
+            state_ = State::Proxying;
+            return;
+        }
+
+        /* handle TLS */
+        server_.reset( new TLSEndpoint( client_context_.new_secure_socket( release( server_ ) ), CLIENT ) );
+        state_ = State::ServerHandshake;
+        /* fall through */
+
+    case State::ServerHandshake:
+        if ( not server_->handshake() ) {
+            return;
+        }
+
+        client_.reset( new TLSEndpoint( server_context_.new_secure_socket( release( client_ ) ), SERVER ) );
+        state_ = State::ClientHandshake;
+        /* fall through */
+
+    case State::ClientHandshake:
+        if ( client_->handshake() ) {
+            state_ = State::Proxying;
+        }
+        return;
+
+    case State::Proxying:
+        break;
+
+    case State::Closed:
+        return;
+    }
+
+    const bool from_client = ( fd == client_->fd().fd_num() );
+    const Endpoint & endpoint = from_client ? *client_ : *server_;
+
+    if ( reading() and ( ( events & (EPOLLIN | EPOLLHUP | EPOLLERR) )
+                         or ( ( events & EPOLLOUT ) and endpoint.wants_write() ) ) ) {
+        if ( from_client ) {
+            read_requests();
+        } else {
+            read_responses();
+        }
+    }
+
+    /* a read usually leaves something to write to the other side, so try both now */
+    to_server_.write_to( *server_ );
+    to_client_.write_to( *client_ );
+}
+
+void Connection::read_requests( void )
+{
+    const string buffer = client_->read();
+    if ( buffer.empty() and not client_->fd().eof() ) {
+        return;
+    }
+
+    request_parser_.parse( buffer );
+
+    /* completed requests from client are serialized and sent to server */
+    while ( not request_parser_.empty() ) {
+        to_server_.push( request_parser_.front().str() );
+        response_parser_.new_request_arrived( request_parser_.front() );
+        request_parser_.pop();
+    }
+}
+
+void Connection::read_responses( void )
+{
+    string buffer = server_->read();
+    if ( buffer.empty() and not server_->fd().eof() ) {
+        return;
+    }
+
+    response_parser_.parse( buffer );
+
+    /* responses from server are passed through to the client as they arrive */
+    if ( not buffer.empty() ) {
+        to_client_.push( move( buffer ) );
+    }
+
+    /* save completed responses */
+    while ( not response_parser_.empty() ) {
+        backing_store_.save( response_parser_.front(), server_addr_ );
+        response_parser_.pop();
+    }
+}
+
+uint32_t Connection::interest( const FileDescriptor & fd ) const
+{
+    const bool is_client = ( fd.fd_num() == client_->fd().fd_num() );
+    const Endpoint & endpoint = is_client ? *client_ : *server_;
+
+    switch ( state_ ) {
+    case State::Connecting:
+        if ( is_client ) {
+            return 0;
+        }
+        return EPOLLOUT;
+
+    case State::ServerHandshake:
+        if ( is_client ) {
+            return 0;
+        }
+        return endpoint.wants_write() ? EPOLLOUT : EPOLLIN;
+
+    case State::ClientHandshake:
+        if ( not is_client ) {
+            return 0;
+        }
+        return endpoint.wants_write() ? EPOLLOUT : EPOLLIN;
+
+    case State::Proxying:
+        break;
+
+    case State::Closed:
+        return 0;
+    }
+
+    const PendingOutput & output = is_client ? to_client_ : to_server_;
+    const PendingOutput & forwarded = is_client ? to_server_ : to_client_;
+
+    uint32_t events = 0;
+
+    /* backpressure: don't read more than the other side can soak up */
+    if ( reading() and forwarded.bytes() < MAX_PENDING ) {
+        events |= endpoint.wants_write() ? EPOLLOUT : EPOLLIN;
+    }
+
+    if ( not output.empty() ) {
+        events |= EPOLLOUT;
+    }
+
+    return events;
+}
+
+bool Connection::finished( void ) const
+{
+    if ( state_ == State::Closed ) {
+        return true;
+    }
+
+    return state_ == State::Proxying and not reading()
+        and to_client_.empty() and to_server_.empty();
+}
+
+class ProxyWorkerPool::Worker
+{
+private:
+    SSLContext & server_context_, & client_context_;
+    HTTPBackingStore & backing_store_;
+    const size_t body_spill_threshold_;
+
+    Epoller epoller_;
+
+    /* written to by dispatching thread to wake the worker up */
+    pair< UnixDomainSocket, UnixDomainSocket > wakeup_;
+
+    mutex mutex_;
+    queue< TCPSocket > new_clients_; /* protected by mutex_ */
+    atomic< bool > halt_;
+
+    /* each connection, under both its client and server fds */
+    unordered_map< int, shared_ptr< Connection > > connections_;
+
+    thread thread_;
+
+    void loop( void );
+    void add_new_clients( void );
+    void update( const shared_ptr< Connection > & connection );
+
+public:
+    Worker( SSLContext & server_context, SSLContext & client_context,
+            HTTPBackingStore & backing_store,
+            const size_t body_spill_threshold );
+    ~Worker();
+
+    void add_client( TCPSocket && client );
+
+    /* forbid copying */
+    Worker( const Worker & other ) = delete;
+    Worker & operator=( const Worker & other ) = delete;
+};
+
+ProxyWorkerPool::Worker::Worker( SSLContext & server_context, SSLContext & client_context,
+                                 HTTPBackingStore & backing_store,
+                                 const size_t body_spill_threshold )
+    : server_context_( server_context ),
+      client_context_( client_context ),
+      backing_store_( backing_store ),
+      body_spill_threshold_( body_spill_threshold ),
+      epoller_(),
+      wakeup_( UnixDomainSocket::make_pair() ),
+      mutex_(),
+      new_clients_(),
+      halt_( false ),
+      connections_(),
+      thread_( [&] () {
+              try {
+                  loop();
+              } catch ( const exception & e ) {
+                  print_exception( e );
+              }
+          } )
+{}
+
+ProxyWorkerPool::Worker::~Worker()
+{
+    halt_ = true;
+    wakeup_.first.write( "x" );
+    thread_.join();
+}
+
+void ProxyWorkerPool::Worker::add_client( TCPSocket && client )
+{
+    {
+        unique_lock<mutex> ul( mutex_ );
+        new_clients_.push( move( client ) );
+    }
+
+    wakeup_.first.write( "x" );
+}
+
+void ProxyWorkerPool::Worker::add_new_clients( void )
+{
+    queue< TCPSocket > clients;
+
+    {
+        unique_lock<mutex> ul( mutex_ );
+        swap( clients, new_clients_ );
+    }
+
+    while ( not clients.empty() ) {
+        try {
+            auto connection = make_shared<Connection>( move( clients.front() ),
+                                                       server_context_, client_context_,
+                                                       backing_store_, body_spill_threshold_ );
+            connections_[ connection->client_fd().fd_num() ] = connection;
+            connections_[ connection->server_fd().fd_num() ] = connection;
+            update( connection );
+        } catch ( const exception & e ) {
+            print_exception( e );
+        }
+
+        clients.pop();
+    }
+}
+
+void ProxyWorkerPool::Worker::update( const shared_ptr< Connection > & connection )
+{
+    FileDescriptor & client = connection->client_fd();
+    FileDescriptor & server = connection->server_fd();
+
+    if ( connection->finished() ) {
+        /* the last reference goes when the caller is done with it, closing the sockets */
+        epoller_.remove( client );
+        epoller_.remove( server );
+        connections_.erase( client.fd_num() );
+        connections_.erase( server.fd_num() );
+        return;
+    }
+
+    epoller_.set_interest( client, connection->interest( client ) );
+    epoller_.set_interest( server, connection->interest( server ) );
+}
+
+void ProxyWorkerPool::Worker::loop( void )
+{
+    epoller_.set_interest( wakeup_.second, EPOLLIN );
+
+    while ( not halt_ ) {
+        for ( const auto & event : epoller_.wait( -1 ) ) {
+            if ( event.data.fd == wakeup_.second.fd_num() ) {
+                wakeup_.second.read();
+                add_new_clients();
+                continue;
+            }
+
+            const auto it = connections_.find( event.data.fd );
+            if ( it == connections_.end() ) { /* closed earlier in this batch */
+                continue;
+            }
+
+            const shared_ptr< Connection > connection = it->second;
+
+            try {
+                connection->process( event.data.fd, event.events );
+            } catch ( const exception & e ) {
+                print_exception( e );
+                connection->close();
+            }
+
+            update( connection );
+        }
+    }
+}
+
+ProxyWorkerPool::ProxyWorkerPool( const unsigned int num_workers,
+                                  SSLContext & server_context, SSLContext & client_context,
+                                  HTTPBackingStore & backing_store,
+                                  const size_t body_spill_threshold )
+    : workers_(),
+      next_worker_( 0 )
+{
+    if ( num_workers == 0 ) {
+        throw runtime_error( "ProxyWorkerPool: need at least one worker" );
+    }
+
+    for ( unsigned int i = 0; i < num_workers; i++ ) {
+        workers_.emplace_back( new Worker( server_context, client_context,
+                                           backing_store, body_spill_threshold ) );
+    }
+}
+
+ProxyWorkerPool::~ProxyWorkerPool() {}
+
+void ProxyWorkerPool::dispatch( TCPSocket && client )
+{
+    workers_.at( next_worker_ )->add_client( move( client ) );
+    next_worker_ = ( next_worker_ + 1 ) % workers_.size();
+}
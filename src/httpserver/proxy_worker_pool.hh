@@ -0,0 +1,41 @@
+/* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef PROXY_WORKER_POOL_HH
+#define PROXY_WORKER_POOL_HH
+
+#include <vector>
+#include <memory>
+
+#include "socket.hh"
+
+class SSLContext;
+class HTTPBackingStore;
+
+/* event-driven alternative to HTTPProxy's thread per connection:
+   a fixed set of worker threads, each running one epoll loop
+   that ferries (and records) many connections at once */
+class ProxyWorkerPool
+{
+private:
+    class Worker;
+
+    std::vector< std::unique_ptr< Worker > > workers_;
+    unsigned int next_worker_;
+
+public:
+    /* contexts and backing_store are captured and must continue to persist */
+    ProxyWorkerPool( const unsigned int num_workers,
+                     SSLContext & server_context, SSLContext & client_context,
+                     HTTPBackingStore & backing_store,
+                     const size_t body_spill_threshold );
+    ~ProxyWorkerPool();
+
+    /* hand an accepted (DNATed) client connection to one of the workers */
+    void dispatch( TCPSocket && client );
+
+    /* forbid copying */
+    ProxyWorkerPool( const ProxyWorkerPool & other ) = delete;
+    ProxyWorkerPool & operator=( const ProxyWorkerPool & other ) = delete;
+};
+
+#endif /* PROXY_WORKER_POOL_HH */
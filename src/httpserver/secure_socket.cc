@@ -4,33 +4,16 @@
 #include <vector>
 #include <thread>
 #include <mutex>
+#include <unordered_map>
 
 #include "secure_socket.hh"
+#include "certificate_authority.hh"
 #include "certificate.hh"
 #include "exception.hh"
+#include "address.hh"
 
 using namespace std;
 
-/* error category for OpenSSL */
-class ssl_error_category : public error_category
-{
-public:
-    const char * name( void ) const noexcept override { return "SSL"; }
-    string message( const int ssl_error ) const noexcept override
-    {
-        return ERR_error_string( ssl_error, nullptr );
-    }
-};
-
-class ssl_error : public tagged_error
-{
-public:
-    ssl_error( const string & s_attempt,
-               const int error_code = ERR_get_error() )
-        : tagged_error( ssl_error_category(), s_attempt, error_code )
-    {}
-};
-
 class OpenSSL
 {
 private:
@@ -84,10 +67,99 @@ SSL_CTX * initialize_new_context( const SSL_MODE type )
     return ret;
 }
 
+class SSLContext::SessionCache
+{
+private:
+    struct SESSION_deleter { void operator()( SSL_SESSION * x ) const { SSL_SESSION_free( x ); } };
+    typedef std::unique_ptr<SSL_SESSION, SESSION_deleter> SESSION_handle;
+
+    mutex mutex_ {};
+    unordered_map< string, SESSION_handle > sessions_ {};
+
+public:
+    /* takes ownership of session */
+    void store( const string & origin, SSL_SESSION * session )
+    {
+        unique_lock<mutex> ul( mutex_ );
+        sessions_[ origin ] = SESSION_handle( session );
+    }
+
+    /* set up ssl to resume its origin's most recent session, if any */
+    void resume( SSL * ssl, const string & origin )
+    {
+        unique_lock<mutex> ul( mutex_ );
+        const auto it = sessions_.find( origin );
+        if ( it != sessions_.end() ) {
+            SSL_set_session( ssl, it->second.get() );
+        }
+    }
+
+    /* called by OpenSSL when a server hands us a session (or ticket) */
+    static int new_session_callback( SSL * ssl, SSL_SESSION * session )
+    {
+        SessionCache * cache = static_cast<SessionCache *>( SSL_CTX_get_app_data( SSL_get_SSL_CTX( ssl ) ) );
+
+        try {
+            sockaddr_in peer;
+            socklen_t size = sizeof( peer );
+            SystemCall( "getpeername", getpeername( SSL_get_fd( ssl ), reinterpret_cast<sockaddr *>( &peer ), &size ) );
+            cache->store( Address( peer ).str(), session );
+        } catch ( const exception & e ) {
+            print_exception( e );
+            return 0; /* didn't keep a reference */
+        }
+
+        return 1;
+    }
+};
+
+/* present a certificate for the requested server name */
+static int servername_callback( SSL * ssl, int *, void * arg )
+{
+    const char * servername = SSL_get_servername( ssl, TLSEXT_NAMETYPE_host_name );
+    if ( not servername ) { /* keep the default certificate */
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+
+    try {
+        CertificateAuthority & ca = *static_cast<CertificateAuthority *>( arg );
+
+        X509 * const certificate = ca.certificate_for( servername );
+        if ( certificate ) {
+            if ( not SSL_use_certificate( ssl, certificate ) ) {
+                throw ssl_error( "SSL_use_certificate" );
+            }
+
+            if ( not SSL_use_PrivateKey( ssl, ca.leaf_key() ) ) {
+                throw ssl_error( "SSL_use_PrivateKey" );
+            }
+        }
+    } catch ( const exception & e ) { /* carry on with the default certificate */
+        print_exception( e );
+    }
+
+    return SSL_TLSEXT_ERR_OK;
+}
+
 SSLContext::SSLContext( const SSL_MODE type )
-    : ctx_( initialize_new_context( type ) )
+    : ctx_( initialize_new_context( type ) ),
+      session_cache_()
 {
+    if ( type == CLIENT ) {
+        /* keep sessions so later connections to the same server can resume them */
+        session_cache_.reset( new SessionCache );
+        SSL_CTX_set_app_data( ctx_.get(), session_cache_.get() );
+        SSL_CTX_set_session_cache_mode( ctx_.get(), SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE );
+        SSL_CTX_sess_set_new_cb( ctx_.get(), SessionCache::new_session_callback );
+    }
+
     if ( type == SERVER ) {
+        /* let clients resume sessions (by ID or ticket) */
+        static const unsigned char session_id_context[] = "mahimahi";
+        if ( not SSL_CTX_set_session_id_context( ctx_.get(), session_id_context, sizeof( session_id_context ) - 1 ) ) {
+            throw ssl_error( "SSL_CTX_set_session_id_context" );
+        }
+
         if ( not SSL_CTX_use_certificate_ASN1( ctx_.get(), 678, certificate ) ) {
             throw ssl_error( "SSL_CTX_use_certificate_ASN1" );
         }
@@ -119,10 +191,25 @@ SecureSocket::SecureSocket( TCPSocket && sock, SSL * ssl )
     SSL_set_mode( ssl_.get(), SSL_MODE_AUTO_RETRY );
 }
 
+SSLContext::~SSLContext() {}
+
+void SSLContext::mint_certificates_with( CertificateAuthority & ca )
+{
+    assert( not session_cache_ ); /* server contexts only */
+
+    SSL_CTX_set_tlsext_servername_callback( ctx_.get(), servername_callback );
+    SSL_CTX_set_tlsext_servername_arg( ctx_.get(), &ca );
+}
+
 SecureSocket SSLContext::new_secure_socket( TCPSocket && sock )
 {
-    return SecureSocket( move( sock ),
-                         SSL_new( ctx_.get() ) );
+    SecureSocket ret( move( sock ), SSL_new( ctx_.get() ) );
+
+    if ( session_cache_ ) {
+        session_cache_->resume( ret.ssl_.get(), ret.peer_address().str() );
+    }
+
+    return ret;
 }
 
 void SecureSocket::connect( void )
@@ -176,6 +263,94 @@ string SecureSocket::read( void )
     }
 }
 
+bool SecureSocket::retry_later( const int ret, const string & attempt )
+{
+    switch ( SSL_get_error( ssl_.get(), ret ) ) {
+    case SSL_ERROR_WANT_READ:
+        wants_write_ = false;
+        return true;
+    case SSL_ERROR_WANT_WRITE:
+        wants_write_ = true;
+        return true;
+    default:
+        throw ssl_error( attempt );
+    }
+}
+
+bool SecureSocket::connect_nonblocking( void )
+{
+    const auto ret = SSL_connect( ssl_.get() );
+    if ( ret == 1 ) {
+        wants_write_ = false;
+        return true;
+    }
+
+    return not retry_later( ret, "SSL_connect" );
+}
+
+bool SecureSocket::accept_nonblocking( void )
+{
+    const auto ret = SSL_accept( ssl_.get() );
+    if ( ret == 1 ) {
+        wants_write_ = false;
+        return true;
+    }
+
+    return not retry_later( ret, "SSL_accept" );
+}
+
+string SecureSocket::read_nonblocking( const size_t limit )
+{
+    const size_t SSL_max_record_length = 16384;
+    char buffer[ SSL_max_record_length ];
+
+    string ret;
+
+    /* keep reading until OpenSSL has nothing buffered and the socket is dry */
+    while ( ret.size() < limit ) {
+        const int bytes_read = SSL_read( ssl_.get(), buffer,
+                                         min( SSL_max_record_length, limit - ret.size() ) );
+
+        if ( bytes_read > 0 ) {
+            ret.append( buffer, bytes_read );
+            continue;
+        }
+
+        const int error_return = SSL_get_error( ssl_.get(), bytes_read );
+        if ( SSL_ERROR_ZERO_RETURN == error_return ) { /* Clean SSL close */
+            set_eof();
+        } else if ( SSL_ERROR_SYSCALL == error_return and ERR_peek_error() == 0 ) {
+            /* Underlying TCP connection close */
+            set_eof();
+        } else {
+            retry_later( bytes_read, "SSL_read" );
+        }
+        break;
+    }
+
+    register_read();
+    return ret;
+}
+
+size_t SecureSocket::write_nonblocking( const char * data, const size_t length )
+{
+    /* a write that has to be retried may be retried from a different buffer,
+       and may finish having only written part of it */
+    SSL_set_mode( ssl_.get(), SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER );
+
+    const int bytes_written = SSL_write( ssl_.get(), data, length );
+
+    register_write();
+
+    if ( bytes_written > 0 ) {
+        wants_write_ = false;
+        return bytes_written;
+    }
+
+    retry_later( bytes_written, "SSL_write" );
+    return 0;
+}
+
 void SecureSocket::write(const string & message )
 {
     /* SSL_write returns with success if complete contents of message are written */
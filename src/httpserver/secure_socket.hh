@@ -9,26 +9,73 @@
 #include <openssl/err.h>
 
 #include "socket.hh"
+#include "exception.hh"
 
 enum SSL_MODE { CLIENT, SERVER };
 
+/* error category for OpenSSL */
+class ssl_error_category : public std::error_category
+{
+public:
+    const char * name( void ) const noexcept override { return "SSL"; }
+    std::string message( const int ssl_error ) const noexcept override
+    {
+        return ERR_error_string( ssl_error, nullptr );
+    }
+};
+
+class ssl_error : public tagged_error
+{
+public:
+    ssl_error( const std::string & s_attempt,
+               const int error_code = ERR_get_error() )
+        : tagged_error( ssl_error_category(), s_attempt, error_code )
+    {}
+};
+
+class CertificateAuthority;
+
 class SecureSocket : public TCPSocket
 {
     friend class SSLContext;
 
 private:
-    struct SSL_deleter { void operator()( SSL * x ) const { SSL_free( x ); } };
+    struct SSL_deleter {
+        void operator()( SSL * x ) const
+        {
+            /* we never send close_notify, but that shouldn't keep the session from being resumed */
+            SSL_set_shutdown( x, SSL_SENT_SHUTDOWN );
+            SSL_free( x );
+        }
+    };
     typedef std::unique_ptr<SSL, SSL_deleter> SSL_handle;
     SSL_handle ssl_;
 
+    /* in non-blocking operation, whether the last call that could
+       not finish needs the socket to become writable */
+    bool wants_write_ { false };
+
     SecureSocket( TCPSocket && sock, SSL * ssl );
 
+    /* if the SSL call that returned ret just needs to be retried later, note
+       which way and return true; otherwise throw */
+    bool retry_later( const int ret, const std::string & attempt );
+
 public:
     void connect( void );
     void accept( void );
 
     std::string read( void );
     void write( const std::string & message );
+
+    /* non-blocking operation (after set_blocking( false )): each call makes as
+       much progress as it can, and wants_write() says whether to wait for the
+       socket to become writable (instead of readable) before calling again */
+    bool connect_nonblocking( void ); /* true when the handshake is done */
+    bool accept_nonblocking( void );  /* true when the handshake is done */
+    std::string read_nonblocking( const size_t limit ); /* "" if nothing yet (check eof()) */
+    size_t write_nonblocking( const char * data, const size_t length ); /* bytes taken */
+    bool wants_write( void ) const { return wants_write_; }
 };
 
 class SSLContext
@@ -38,10 +85,25 @@ private:
     typedef std::unique_ptr<SSL_CTX, CTX_deleter> CTX_handle;
     CTX_handle ctx_;
 
+    /* (client contexts) sessions to resume, by server address */
+    class SessionCache;
+    std::unique_ptr<SessionCache> session_cache_;
+
 public:
     SSLContext( const SSL_MODE type );
+    ~SSLContext();
 
+    /* for a client context, sock must already be connected */
     SecureSocket new_secure_socket( TCPSocket && sock );
+
+    /* (server contexts) present a certificate for the server name the
+       client asks for, minted by ca (which is captured and must continue
+       to persist), instead of the compiled-in certificate */
+    void mint_certificates_with( CertificateAuthority & ca );
+
+    /* forbid copying */
+    SSLContext( const SSLContext & other ) = delete;
+    SSLContext & operator=( const SSLContext & other ) = delete;
 };
 
 #endif
@@ -22,6 +22,14 @@ public:
 
     virtual unsigned int size_bytes( void ) const = 0;
     virtual unsigned int size_packets( void ) const = 0;
+
+    /* packets (and bytes) dropped so far */
+    virtual unsigned int dropped_packets( void ) const { return 0; }
+    virtual unsigned int dropped_bytes( void ) const { return 0; }
+
+    /* packets (and bytes) marked Congestion Experienced so far */
+    virtual unsigned int marked_packets( void ) const { return 0; }
+    virtual unsigned int marked_bytes( void ) const { return 0; }
 };
 
 #endif /* ABSTRACT_PACKET_QUEUE */ 
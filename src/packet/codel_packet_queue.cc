@@ -65,14 +65,23 @@ QueuedPacket CODELPacketQueue::dequeue( void )
   dodequeue_result r = std::move( dodequeue ( now ) );
   uint32_t delta;
     
+  //As in Linux's codel_dequeue, each decision is about the packet now at
+  //the head (r.p): with ECN, an ECN-capable one is marked and sent;
+  //otherwise it is dropped and the next one takes its place.
   if ( dropping_ ) {
     if ( !r.ok_to_drop ) {
       dropping_ = false;
     }
 
     while ( now >= drop_next_ && dropping_ ) {
-      dodequeue_result r = std::move( dodequeue ( now ) );
       count_++;
+      if ( ecn_ && mark( r.p ) ) {
+	drop_next_ = control_law(drop_next_, count_);
+	break;
+      }
+
+      drop( r.p );
+      r = dodequeue ( now );
       if ( ! r.ok_to_drop ) {
 	dropping_ = false;
       } else {
@@ -81,7 +90,10 @@ QueuedPacket CODELPacketQueue::dequeue( void )
     }
   }
   else if ( r.ok_to_drop ) {
-    dodequeue_result r = std::move( dodequeue ( now ) );
+    if ( !( ecn_ && mark( r.p ) ) ) {
+      drop( r.p );
+      r = dodequeue ( now );
+    }
     dropping_ = true;
     delta = count_ - lastcount_;
     count_ = ( ( delta > 1 ) && ( now - drop_next_ < 16 * interval_ ))? 
@@ -99,6 +111,8 @@ void CODELPacketQueue::enqueue( QueuedPacket && p )
   if ( good_with( size_bytes() + p.contents.size(),
 		  size_packets() + 1 ) ) {
     accept( std::move( p ) );
+  } else {
+    drop( p );
   }
   assert( good() );
 }
@@ -1,32 +1,53 @@
 /* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
 
 #include <iostream>
+#include <algorithm>
 
 #include "dropping_packet_queue.hh"
 #include "exception.hh"
 #include "ezio.hh"
+#include "ecn.hh"
 
 using namespace std;
 
 DroppingPacketQueue::DroppingPacketQueue( const string & args )
-    : packet_limit_( get_arg( args, "packets" ) ),
-      byte_limit_( get_arg( args, "bytes" ) )
+    : internal_queue_( initial_slots( args ) ),
+      packet_limit_( get_arg( args, "packets" ) ),
+      byte_limit_( get_arg( args, "bytes" ) ),
+      ecn_( get_arg( args, "ecn" ) )
 {
     if ( packet_limit_ == 0 and byte_limit_ == 0 ) {
         throw runtime_error( "Dropping queue must have a byte or packet limit." );
     }
 }
 
-QueuedPacket DroppingPacketQueue::dequeue( void )
+size_t DroppingPacketQueue::initial_slots( const string & args )
 {
-    assert( not internal_queue_.empty() );
+    const size_t MAX_INITIAL_SLOTS = 1 << 16; /* (more are added if needed) */
+    const size_t PACKET_SIZE = 1504; /* default max TUN payload size */
+
+    const unsigned int packet_limit = get_arg( args, "packets" );
+    const unsigned int byte_limit = get_arg( args, "bytes" );
+
+    const size_t slots = packet_limit ? packet_limit : byte_limit / PACKET_SIZE;
 
-    QueuedPacket ret = std::move( internal_queue_.front() );
-    internal_queue_.pop();
+    return min( slots + 1, MAX_INITIAL_SLOTS );
+}
+
+QueuedPacket DroppingPacketQueue::take( void )
+{
+    QueuedPacket ret = internal_queue_.pop();
 
     queue_size_in_bytes_ -= ret.contents.size();
     queue_size_in_packets_--;
 
+    return ret;
+}
+
+QueuedPacket DroppingPacketQueue::dequeue( void )
+{
+    QueuedPacket ret = take();
+
     assert( good() );
 
     return ret;
@@ -60,14 +81,12 @@ bool DroppingPacketQueue::good( void ) const
 
 unsigned int DroppingPacketQueue::size_bytes( void ) const
 {
-    assert( queue_size_in_bytes_ >= 0 );
-    return unsigned( queue_size_in_bytes_ );
+    return queue_size_in_bytes_;
 }
 
 unsigned int DroppingPacketQueue::size_packets( void ) const
 {
-    assert( queue_size_in_packets_ >= 0 );
-    return unsigned( queue_size_in_packets_ );
+    return queue_size_in_packets_;
 }
 
 /* put a packet on the back of the queue */
@@ -75,7 +94,24 @@ void DroppingPacketQueue::accept( QueuedPacket && p )
 {
     queue_size_in_bytes_ += p.contents.size();
     queue_size_in_packets_++;
-    internal_queue_.emplace( std::move( p ) );
+    internal_queue_.push( std::move( p ) );
+}
+
+void DroppingPacketQueue::drop( const QueuedPacket & p )
+{
+    dropped_packets_++;
+    dropped_bytes_ += p.contents.size();
+}
+
+bool DroppingPacketQueue::mark( QueuedPacket & p )
+{
+    if ( not mark_congestion_experienced( p.contents ) ) {
+        return false;
+    }
+
+    marked_packets_++;
+    marked_bytes_ += p.contents.size();
+    return true;
 }
 
 string DroppingPacketQueue::to_string( void ) const
@@ -94,6 +130,10 @@ string DroppingPacketQueue::to_string( void ) const
         ret += string( "packets=" ) + ::to_string( packet_limit_ );
     }
 
+    if ( ecn_ ) {
+        ret += ", ecn";
+    }
+
     ret += "]";
 
     return ret;
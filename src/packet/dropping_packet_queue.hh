@@ -3,18 +3,26 @@
 #ifndef DROPPING_PACKET_QUEUE_HH
 #define DROPPING_PACKET_QUEUE_HH
 
-#include <queue>
 #include <cassert>
 
 #include "abstract_packet_queue.hh"
+#include "packet_ring.hh"
 #include "exception.hh"
 
 class DroppingPacketQueue : public AbstractPacketQueue
 {
 private:
-    int queue_size_in_bytes_ = 0, queue_size_in_packets_ = 0;
+    /* (of different widths, so the compiler can't fuse their updates into
+       one wide load, which would stall on the narrow stores before it) */
+    uint64_t queue_size_in_bytes_ = 0;
+    unsigned int queue_size_in_packets_ = 0;
+    unsigned int dropped_packets_ = 0, dropped_bytes_ = 0;
+    unsigned int marked_packets_ = 0, marked_bytes_ = 0;
 
-    std::queue<QueuedPacket> internal_queue_ {};
+    PacketRing internal_queue_;
+
+    /* enough slots for the limits (and a packet over, for drophead) */
+    static size_t initial_slots( const std::string & args );
 
     virtual const std::string & type( void ) const = 0;
 
@@ -22,9 +30,21 @@ protected:
     const unsigned int packet_limit_;
     const unsigned int byte_limit_;
 
+    /* mark instead of dropping where the packet allows ("ecn=1") */
+    const bool ecn_;
+
     /* put a packet on the back of the queue */
     void accept( QueuedPacket && p );
 
+    /* take the packet from the front of the queue (to send or drop) */
+    QueuedPacket take( void );
+
+    /* count a packet as dropped */
+    void drop( const QueuedPacket & p );
+
+    /* set CE on an ECN-capable packet (false if it isn't one) */
+    bool mark( QueuedPacket & p );
+
     /* are the limits currently met? */
     bool good( void ) const;
     bool good_with( const unsigned int size_in_bytes,
@@ -45,6 +65,12 @@ public:
 
     unsigned int size_bytes( void ) const override;
     unsigned int size_packets( void ) const override;
+
+    unsigned int dropped_packets( void ) const override { return dropped_packets_; }
+    unsigned int dropped_bytes( void ) const override { return dropped_bytes_; }
+
+    unsigned int marked_packets( void ) const override { return marked_packets_; }
+    unsigned int marked_bytes( void ) const override { return marked_bytes_; }
 };
 
 #endif /* DROPPING_PACKET_QUEUE_HH */ 
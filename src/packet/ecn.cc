@@ -0,0 +1,89 @@
+/* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <cstdint>
+#include <linux/if_ether.h>
+
+#include "ecn.hh"
+
+using namespace std;
+
+namespace {
+    const size_t PI_LENGTH = 4; /* the TUN device's struct tun_pi */
+    const size_t IPV4_HEADER_LENGTH = 20, IPV6_HEADER_LENGTH = 40;
+    const size_t IPV4_CHECKSUM_OFFSET = 10;
+
+    const unsigned int ECN_MASK = 0x3, NOT_ECT = 0x0, CE = 0x3;
+
+    uint16_t get_word( const string & packet, const size_t offset )
+    {
+        return ( uint8_t( packet[ offset ] ) << 8 ) | uint8_t( packet[ offset + 1 ] );
+    }
+
+    void put_word( string & packet, const size_t offset, const uint16_t word )
+    {
+        packet[ offset ] = char( word >> 8 );
+        packet[ offset + 1 ] = char( word & 0xff );
+    }
+
+    /* the ECN field is two bits of the IP header's second byte: the low
+       ones in IPv4 (after the DSCP), the third and fourth lowest in IPv6
+       (where the traffic class straddles the first two bytes) */
+    bool find_ecn_field( const string & packet, unsigned int & shift, bool & ipv4 )
+    {
+        if ( packet.size() < PI_LENGTH + 1 ) {
+            return false;
+        }
+
+        const uint16_t protocol = get_word( packet, 2 );
+        const unsigned int version = uint8_t( packet[ PI_LENGTH ] ) >> 4;
+
+        if ( protocol == ETH_P_IP and version == 4
+             and packet.size() >= PI_LENGTH + IPV4_HEADER_LENGTH ) {
+            shift = 0;
+            ipv4 = true;
+            return true;
+        } else if ( protocol == ETH_P_IPV6 and version == 6
+                    and packet.size() >= PI_LENGTH + IPV6_HEADER_LENGTH ) {
+            shift = 4;
+            ipv4 = false;
+            return true;
+        }
+
+        return false;
+    }
+}
+
+bool mark_congestion_experienced( string & packet )
+{
+    unsigned int shift;
+    bool ipv4;
+
+    if ( not find_ecn_field( packet, shift, ipv4 ) ) {
+        return false;
+    }
+
+    const uint16_t old_word = get_word( packet, PI_LENGTH );
+    const unsigned int ecn = ( old_word >> shift ) & ECN_MASK;
+
+    if ( ecn == NOT_ECT ) {
+        return false;
+    } else if ( ecn == CE ) {
+        return true;
+    }
+
+    const uint16_t new_word = old_word | ( CE << shift );
+    put_word( packet, PI_LENGTH, new_word );
+
+    if ( ipv4 ) {
+        /* HC' = ~(~HC + ~m + m') (RFC 1624) */
+        const size_t checksum_offset = PI_LENGTH + IPV4_CHECKSUM_OFFSET;
+        uint32_t sum = uint16_t( ~get_word( packet, checksum_offset ) );
+        sum += uint16_t( ~old_word );
+        sum += new_word;
+        sum = ( sum & 0xffff ) + ( sum >> 16 );
+        sum = ( sum & 0xffff ) + ( sum >> 16 );
+        put_word( packet, checksum_offset, ~sum );
+    }
+
+    return true;
+}
@@ -0,0 +1,16 @@
+/* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef ECN_HH
+#define ECN_HH
+
+#include <string>
+
+/* Explicit Congestion Notification (RFC 3168) on packets as read from a
+   TUN device: a packet-information header (flags and EtherType) and then
+   an IPv4 or IPv6 header */
+
+/* set CE on an ECN-capable (ECT or CE) packet, updating the IPv4 header
+   checksum in place, and return true; leave others alone and return false */
+bool mark_congestion_experienced( std::string & packet );
+
+#endif /* ECN_HH */
@@ -0,0 +1,38 @@
+/* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include "l4s_packet_queue.hh"
+#include "timestamp.hh"
+
+using namespace std;
+
+L4SPacketQueue::L4SPacketQueue( const string & args )
+    : DroppingPacketQueue( args ),
+      threshold_( get_arg( args, "threshold" ) )
+{
+    if ( threshold_ == 0 ) {
+        throw runtime_error( "L4S queue must have a threshold argument." );
+    }
+}
+
+void L4SPacketQueue::enqueue( QueuedPacket && p )
+{
+    if ( good_with( size_bytes() + p.contents.size(),
+                    size_packets() + 1 ) ) {
+        accept( std::move( p ) );
+    } else {
+        drop( p );
+    }
+
+    assert( good() );
+}
+
+QueuedPacket L4SPacketQueue::dequeue( void )
+{
+    QueuedPacket ret = DroppingPacketQueue::dequeue();
+
+    if ( timestamp() - ret.arrival_time >= threshold_ ) {
+        mark( ret );
+    }
+
+    return ret;
+}
@@ -0,0 +1,31 @@
+/* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef L4S_PACKET_QUEUE_HH
+#define L4S_PACKET_QUEUE_HH
+
+#include "dropping_packet_queue.hh"
+
+/* Shallow-threshold marking for scalable congestion controls (DCTCP,
+   TCP Prague), as in the L4S queue of the DualQ Coupled AQM (RFC 9332):
+   an ECN-capable packet that has waited at least the threshold (in ms)
+   is marked as it leaves. Nothing is dropped unless the queue is full. */
+class L4SPacketQueue : public DroppingPacketQueue
+{
+private:
+    uint32_t threshold_;
+
+    virtual const std::string & type( void ) const override
+    {
+        static const std::string type_ { "l4s" };
+        return type_;
+    }
+
+public:
+    L4SPacketQueue( const std::string & args );
+
+    void enqueue( QueuedPacket && p ) override;
+
+    QueuedPacket dequeue( void ) override;
+};
+
+#endif /* L4S_PACKET_QUEUE_HH */
@@ -0,0 +1,67 @@
+/* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef PACKET_RING_HH
+#define PACKET_RING_HH
+
+#include <vector>
+#include <cassert>
+
+#include "queued_packet.hh"
+
+/* A FIFO of packets in a ring of slots allocated up front. Packets are
+   moved in and out of the slots, so their contents are never copied and,
+   as long as the ring has room, nothing is allocated. A full ring doubles
+   in size. */
+class PacketRing
+{
+private:
+    std::vector<QueuedPacket> slots_;
+    size_t head_ = 0, size_ = 0;
+
+    void grow( void )
+    {
+        std::vector<QueuedPacket> bigger( 2 * slots_.size(), QueuedPacket( "", 0 ) );
+        for ( size_t i = 0; i < size_; i++ ) {
+            bigger[ i ] = std::move( slots_[ ( head_ + i ) % slots_.size() ] );
+        }
+        slots_.swap( bigger );
+        head_ = 0;
+    }
+
+public:
+    explicit PacketRing( const size_t capacity )
+        : slots_( capacity ? capacity : 1, QueuedPacket( "", 0 ) )
+    {}
+
+    void push( QueuedPacket && p )
+    {
+        if ( size_ == slots_.size() ) {
+            grow();
+        }
+
+        size_t tail = head_ + size_;
+        if ( tail >= slots_.size() ) {
+            tail -= slots_.size();
+        }
+
+        slots_[ tail ] = std::move( p );
+        size_++;
+    }
+
+    QueuedPacket pop( void )
+    {
+        assert( size_ > 0 );
+
+        QueuedPacket ret = std::move( slots_[ head_ ] );
+        if ( ++head_ == slots_.size() ) {
+            head_ = 0;
+        }
+        size_--;
+
+        return ret;
+    }
+
+    bool empty( void ) const { return size_ == 0; }
+};
+
+#endif /* PACKET_RING_HH */
@@ -4,10 +4,11 @@
 #include <chrono>
 
 #include <sys/socket.h>
-#include <net/route.h>
 
 #include "packetshell.hh"
 #include "netdevice.hh"
+#include "netlink.hh"
+#include "system_runner.hh"
 #include "nat.hh"
 #include "util.hh"
 #include "interfaces.hh"
@@ -16,6 +17,7 @@
 #include "timestamp.hh"
 #include "exception.hh"
 #include "bindworkaround.hh"
+#include "random.hh"
 #include "config.h"
 
 using namespace std;
@@ -23,12 +25,14 @@ using namespace PollerShortNames;
 
 template <class FerryQueueType>
 PacketShell<FerryQueueType>::PacketShell( const std::string & device_prefix, char ** const user_environment, const bool passthrough_until_signal )
-    : user_environment_( user_environment ),
+    : setup_phase_( "addresses" ),
+      user_environment_( user_environment ),
       egress_ingress( two_unassigned_addresses( get_mahimahi_base() ) ),
-      nameserver_( first_nameserver() ),
-      egress_tun_( device_prefix + "-" + to_string( getpid() ) , egress_addr(), ingress_addr() ),
-      dns_outside_( egress_addr(), nameserver_, nameserver_ ),
-      nat_rule_( ingress_addr() ),
+      nameserver_( setup_phase_.next( "nameserver", first_nameserver() ) ),
+      egress_tun_( setup_phase_.next( "egress TUN device", device_prefix + "-" + to_string( getpid() ) ),
+                   egress_addr(), ingress_addr() ),
+      dns_outside_( setup_phase_.next( "DNS proxy", egress_addr() ), nameserver_, nameserver_ ),
+      nat_rule_( setup_phase_.next( "NAT", ingress_addr() ) ),
       passthrough_until_signal_( passthrough_until_signal ),
       pipe_( UnixDomainSocket::make_pair() ),
       event_loop_()
@@ -38,6 +42,8 @@ PacketShell<FerryQueueType>::PacketShell( const std::string & device_prefix, cha
         throw runtime_error( "PacketShell: environment was not cleared" );
     }
 
+    setup_phase_.finish();
+
     /* initialize base timestamp value before any forking */
     initial_timestamp();
 }
@@ -61,43 +67,29 @@ void PacketShell<FerryQueueType>::start_uplink( const string & shell_prefix,
     */
 
     /* Fork */
+    SetupTrace::Phase fork_phase( "container" );
     event_loop_.add_special_child_process( 77, "packetshell", [&]() {
-            TunDevice ingress_tun( "ingress", ingress_addr(), egress_addr() );
-
-            /* bring up localhost */
-            interface_ioctl( SIOCSIFFLAGS, "lo",
-                             [] ( ifreq &ifr ) { ifr.ifr_flags = IFF_UP; } );
+            SetupTrace::forked( "container" );
+            Random::forked( "uplink" );
+            SetupTrace::Phase phase( "ingress TUN device" );
 
-            /* create default route */
-            rtentry route;
-            zero( route );
-
-            route.rt_gateway = egress_addr().to_sockaddr();
-            route.rt_dst = route.rt_genmask = Address().to_sockaddr();
-            route.rt_flags = RTF_UP | RTF_GATEWAY;
+            TunDevice ingress_tun( "ingress", ingress_addr(), egress_addr() );
 
-            SystemCall( "ioctl SIOCADDRT", ioctl( UDPSocket().fd_num(), SIOCADDRT, &route ) );
+            /* bring up localhost and create default route */
+            phase.next( "routes" );
+            RTNetlink rtnetlink;
+            rtnetlink.set_link_up( "lo" );
+            rtnetlink.add_default_route( egress_addr() );
+            rtnetlink.commit();
 
             Ferry inner_ferry { passthrough_until_signal_ };
 
-            /* dnsmasq doesn't distinguish between UDP and TCP forwarding nameservers,
-               so use a DNSProxy that listens on the same UDP and TCP port */
-
-            UDPSocket dns_udp_listener;
-            dns_udp_listener.bind( ingress_addr() );
-
-            TCPSocket dns_tcp_listener;
-            dns_tcp_listener.bind( dns_udp_listener.local_address() );
-
-            DNSProxy dns_inside_ { move( dns_udp_listener ), move( dns_tcp_listener ),
-                    dns_outside_.udp_listener().local_address(),
-                    dns_outside_.tcp_listener().local_address() };
-
-            dns_inside_.register_handlers( inner_ferry );
-
-            /* run dnsmasq as local caching nameserver */
-            inner_ferry.add_child_process( start_dnsmasq( {
-                        "-S", dns_inside_.udp_listener().local_address().str( "#" ) } ) );
+            /* run a local caching nameserver, forwarding to the DNS proxy outside */
+            phase.next( "DNS server" );
+            DNSServer dns_server;
+            dns_server.forward_to( dns_outside_.udp_listener().local_address(),
+                                   dns_outside_.tcp_listener().local_address() );
+            dns_server.register_handlers( inner_ferry );
 
             /* Fork again after dropping root privileges */
             drop_privileges();
@@ -110,6 +102,12 @@ void PacketShell<FerryQueueType>::start_uplink( const string & shell_prefix,
                                           egress_addr().ip().c_str(),
                                           false /* don't override */ ) );
 
+            /* shells nested in this one trace their setup as an inner layer,
+               and draw random numbers from the same seed */
+            SetupTrace::export_layer();
+            Random::export_seed();
+
+            phase.next( "command" );
             inner_ferry.add_child_process( join( command ), [&]() {
                     /* tweak bash prompt */
                     prepend_shell_prefix( shell_prefix );
@@ -120,7 +118,12 @@ void PacketShell<FerryQueueType>::start_uplink( const string & shell_prefix,
             /* allow downlink to write directly to inner namespace's TUN device */
             pipe_.first.send_fd( ingress_tun );
 
+            phase.next( "uplink queue" );
             FerryQueueType uplink_queue { ferry_maker() };
+
+            phase.finish();
+            SetupTrace::flush();
+
             return inner_ferry.loop( uplink_queue, ingress_tun, egress_tun_ );
         }, true );  /* new network namespace */
 }
@@ -142,19 +145,28 @@ void PacketShell<FerryQueueType>::start_downlink( Targs&&... Fargs )
     */
 
     event_loop_.add_special_child_process( 77, "downlink", [&] () {
+            SetupTrace::forked( "downlink" );
+            Random::forked( "downlink" );
+
             drop_privileges();
 
             /* restore environment */
             environ = user_environment_;
 
             /* downlink packets go to inner namespace's TUN device */
+            SetupTrace::Phase phase( "wait for container" );
             FileDescriptor ingress_tun = pipe_.second.recv_fd();
 
             Ferry outer_ferry { passthrough_until_signal_ };
 
             dns_outside_.register_handlers( outer_ferry );
 
+            phase.next( "downlink queue" );
             FerryQueueType downlink_queue { ferry_maker() };
+
+            phase.finish();
+            SetupTrace::flush();
+
             return outer_ferry.loop( downlink_queue, egress_tun_, ingress_tun );
         } );
 }
@@ -162,6 +174,8 @@ void PacketShell<FerryQueueType>::start_downlink( Targs&&... Fargs )
 template <class FerryQueueType>
 int PacketShell<FerryQueueType>::wait_for_exit( void )
 {
+    SetupTrace::flush();
+
     return event_loop_.loop();
 }
 
@@ -12,11 +12,13 @@
 #include "dns_proxy.hh"
 #include "event_loop.hh"
 #include "socketpair.hh"
+#include "setup_trace.hh"
 
 template <class FerryQueueType>
 class PacketShell
 {
 private:
+    SetupTrace::Phase setup_phase_;
     char ** const user_environment_;
     std::pair<Address, Address> egress_ingress;
     Address nameserver_;
@@ -3,6 +3,7 @@
 
 #include "pie_packet_queue.hh"
 #include "timestamp.hh"
+#include "random.hh"
 
 using namespace std;
 
@@ -24,7 +25,7 @@ PIEPacketQueue::PIEPacketQueue( const string & args )
     dq_tstamp_ ( 0 ),
     avg_dq_rate_ ( 0 ),
     uniform_generator_ ( 0.0, 1.0 ),
-    prng_( random_device()() ),
+    prng_( Random::stream( "pie" ) ),
     last_update_( timestamp() )
 {
   if ( qdelay_ref_ == 0 || max_burst_ == 0 ) {
@@ -39,6 +40,7 @@ void PIEPacketQueue::enqueue( QueuedPacket && p )
   if ( ! good_with( size_bytes() + p.contents.size(),
 		    size_packets() + 1 ) ) {
     // Internal queue is full. Packet has to be dropped.
+    drop( p );
     return;
   } 
 
@@ -48,6 +50,14 @@ void PIEPacketQueue::enqueue( QueuedPacket && p )
     //All other packets are dropped
     accept( std::move( p ) );
   }
+  else if ( ecn_ && drop_prob_ <= MAX_ECN_MARK_PROB && mark( p ) ) {
+    //With ECN, an ECN-capable packet is marked and enqueued instead,
+    //unless the drop probability is high enough to call for drops (RFC 8033)
+    accept( std::move( p ) );
+  }
+  else {
+    drop( p );
+  }
 
   assert( good() );
 }
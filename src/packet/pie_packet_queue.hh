@@ -6,6 +6,7 @@
 #include <random>
 #include <thread>
 #include "dropping_packet_queue.hh"
+#include "xoshiro.hh"
 
 /*    
    Proportional Integral controller Enhanced (PIE)
@@ -21,6 +22,9 @@ private:
     //It maybe better to get this in a more reliable way in the future.
     const static unsigned int PACKET_SIZE = 1504; /* default max TUN payload size */
 
+    //Above this drop probability, even ECN-capable packets are dropped.
+    constexpr static double MAX_ECN_MARK_PROB = 0.1;
+
     //Configurable parameters
     uint32_t qdelay_ref_, max_burst_;
 
@@ -36,7 +40,7 @@ private:
 
     //Implementation specific
     std::uniform_real_distribution<double> uniform_generator_;
-    std::default_random_engine prng_;
+    Xoshiro256 prng_;
     uint64_t last_update_;
     
 
@@ -0,0 +1,209 @@
+/* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/* feed random chunked bodies, split at random places, to ChunkedBodyParser
+   and to the buffer-rebuilding parser it replaced, and check that they agree */
+
+#include <iostream>
+#include <random>
+#include <cassert>
+#include <cstdlib>
+
+#include "chunked_parser.hh"
+#include "exception.hh"
+#include "ezio.hh"
+
+using namespace std;
+
+/* the previous parser, kept as a reference */
+class ReferenceChunkedParser
+{
+private:
+    string parser_buffer_ {};
+    uint32_t current_chunk_size_ { 0 };
+    string::size_type acked_so_far_ { 0 };
+    string::size_type parsed_so_far_ { 0 };
+    enum { CHUNK_HDR, CHUNK, TRAILER } state_ { CHUNK_HDR };
+    const bool trailers_enabled_;
+
+    uint32_t get_chunk_size( const string & chunk_hdr ) const
+    {
+        auto pos = chunk_hdr.find( ";" );
+        if ( pos == string::npos ) {
+            pos = chunk_hdr.find( "\r\n" );
+        }
+
+        auto hex_string = chunk_hdr.substr( 0, pos );
+        auto space_loc = hex_string.find( " " );
+        if ( space_loc != string::npos ) hex_string.erase( space_loc, hex_string.length() - space_loc );
+        return myatoi( hex_string, 16 );
+    }
+
+    string::size_type compute_ack_size( const string & needle, const string::size_type input_size )
+    {
+        auto loc = parser_buffer_.find( needle );
+        if ( loc != string::npos ) {
+            parsed_so_far_ += loc + needle.length();
+            return parsed_so_far_ - acked_so_far_;
+        } else {
+            acked_so_far_ += input_size;
+            return loc;
+        }
+    }
+
+public:
+    ReferenceChunkedParser( const bool trailers_enabled ) : trailers_enabled_( trailers_enabled ) {}
+
+    string::size_type read( const string & input_buffer )
+    {
+        parser_buffer_ += input_buffer;
+
+        while ( not parser_buffer_.empty() ) {
+            switch ( state_ ) {
+            case CHUNK_HDR: {
+                auto it = parser_buffer_.find( "\r\n" );
+                if ( it == string::npos ) {
+                    acked_so_far_ += input_buffer.length();
+                    return string::npos;
+                }
+                current_chunk_size_ = get_chunk_size( parser_buffer_.substr( 0, it + 2 ) );
+                state_ = ( current_chunk_size_ == 0 ) ? TRAILER : CHUNK;
+                parsed_so_far_ += it + 2;
+                parser_buffer_ = parser_buffer_.substr( it + 2 );
+                break;
+            }
+            case CHUNK:
+                if ( parser_buffer_.length() < current_chunk_size_ + 2 ) {
+                    acked_so_far_ += input_buffer.length();
+                    return string::npos;
+                }
+                state_ = CHUNK_HDR;
+                parsed_so_far_ += current_chunk_size_ + 2;
+                parser_buffer_ = parser_buffer_.substr( current_chunk_size_ + 2 );
+                break;
+            case TRAILER:
+                return compute_ack_size( trailers_enabled_ ? "\r\n\r\n" : "\r\n", input_buffer.length() );
+            }
+        }
+
+        acked_so_far_ += input_buffer.length();
+        return string::npos;
+    }
+};
+
+static string random_chunked_body( mt19937 & prng, const bool with_trailers )
+{
+    string ret;
+
+    const unsigned int chunk_count = uniform_int_distribution<unsigned int>( 0, 20 )( prng );
+    for ( unsigned int i = 0; i < chunk_count; i++ ) {
+        /* mostly small chunks, sometimes a big one */
+        const size_t size = ( prng() % 8 ) ? 1 + prng() % 64 : 1 + prng() % 200000;
+
+        char hex[ 32 ];
+        snprintf( hex, sizeof( hex ), ( prng() % 2 ) ? "%zx" : "%zX", size );
+        ret.append( hex );
+
+        switch ( prng() % 4 ) {
+        case 0: ret.append( ";name=value" ); break;
+        case 1: ret.append( " ;ext" ); break;
+        default: break;
+        }
+
+        ret.append( "\r\n" );
+        ret.append( size, char( 'a' + prng() % 26 ) );
+        ret.append( "\r\n" );
+    }
+
+    ret.append( "0\r\n" );
+
+    if ( with_trailers ) {
+        const unsigned int trailer_count = uniform_int_distribution<unsigned int>( 1, 3 )( prng );
+        for ( unsigned int i = 0; i < trailer_count; i++ ) {
+            ret.append( "X-Trailer-" + to_string( i ) + ": " + to_string( prng() ) + "\r\n" );
+        }
+    }
+
+    ret.append( "\r\n" );
+
+    return ret;
+}
+
+static void fuzz_one( mt19937 & prng )
+{
+    /* the reference parser only handles trailers when told to expect them */
+    const bool with_trailers = prng() % 2;
+
+    const string body = random_chunked_body( prng, with_trailers );
+    const string input = body + "HTTP/1.1 200 OK\r\n"; /* start of the next message */
+
+    ChunkedBodyParser parser;
+    ReferenceChunkedParser reference( with_trailers );
+
+    size_t offset = 0;
+    while ( true ) {
+        if ( offset >= input.size() ) {
+            throw runtime_error( "body never completed" );
+        }
+
+        const size_t piece_size = ( prng() % 4 ) ? 1 + prng() % 16 : 1 + prng() % 100000;
+        const string piece = input.substr( offset, piece_size );
+
+        const auto expected = reference.read( piece );
+        const auto actual = parser.read( piece );
+
+        if ( actual != expected ) {
+            throw runtime_error( "parsers disagree at offset " + to_string( offset ) );
+        }
+
+        if ( actual != string::npos ) {
+            if ( offset + actual != body.size() ) {
+                throw runtime_error( "body ended at the wrong place" );
+            }
+            return;
+        }
+
+        offset += piece.size();
+    }
+}
+
+/* malformed input must be rejected with an exception (not a crash) */
+static void fuzz_garbage( mt19937 & prng )
+{
+    string input = random_chunked_body( prng, prng() % 2 );
+    for ( unsigned int i = 0; i < 3; i++ ) {
+        input.at( prng() % input.size() ) = char( prng() );
+    }
+
+    ChunkedBodyParser parser;
+    try {
+        for ( size_t offset = 0; offset < input.size(); offset += 7 ) {
+            if ( parser.read( input.substr( offset, 7 ) ) != string::npos ) {
+                return;
+            }
+        }
+    } catch ( const runtime_error & ) {}
+}
+
+int main( int argc, char *argv[] )
+{
+    try {
+        if ( argc > 3 ) {
+            throw runtime_error( "Usage: " + string( argv[ 0 ] ) + " [iterations] [seed]" );
+        }
+
+        const unsigned int iterations = argc > 1 ? myatoi( argv[ 1 ] ) : 2000;
+        const unsigned int seed = argc > 2 ? myatoi( argv[ 2 ] ) : 1;
+
+        mt19937 prng( seed );
+
+        for ( unsigned int i = 0; i < iterations; i++ ) {
+            fuzz_one( prng );
+            fuzz_garbage( prng );
+        }
+    } catch ( const exception & e ) {
+        print_exception( e );
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
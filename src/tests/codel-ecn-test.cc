@@ -0,0 +1,111 @@
+/* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/* drain a standing backlog of alternating ECN-capable and not-ECN-capable
+   packets through CoDel with ecn=1 (in virtual time), and check that it
+   drops only the packets it can't mark and marks only the ones it can */
+
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+
+#include "codel_packet_queue.hh"
+#include "timestamp.hh"
+#include "exception.hh"
+
+using namespace std;
+
+namespace {
+    const size_t PI_LENGTH = 4, PACKET_LENGTH = 1000;
+    const unsigned int ECT_0 = 0x2, CE = 0x3;
+
+    /* a TUN packet: the packet-information header, then an IPv4 header
+       with the given ECN field, then the packet's number */
+    string make_packet( const unsigned int number, const unsigned int ecn )
+    {
+        string ret( PACKET_LENGTH, 0 );
+        ret[ 2 ] = 0x08; /* ETH_P_IP */
+        ret[ PI_LENGTH ] = 0x45;
+        ret[ PI_LENGTH + 1 ] = char( ecn );
+        ret.replace( PI_LENGTH + 20, 10, to_string( number ) );
+        return ret;
+    }
+
+    unsigned int number_of( const string & packet )
+    {
+        return stoul( packet.substr( PI_LENGTH + 20, 10 ) );
+    }
+
+    unsigned int ecn_of( const string & packet )
+    {
+        return packet[ PI_LENGTH + 1 ] & 0x3;
+    }
+}
+
+int main()
+{
+    try {
+        /* (before anything takes a timestamp) */
+        VirtualClock clock( 1000000 );
+        set_clock( &clock );
+
+        CODELPacketQueue queue( "packets=10000, target=5, interval=100, ecn=1" );
+
+        const unsigned int PACKETS = 4000;
+        vector<bool> departed( PACKETS, false );
+
+        /* even-numbered packets are ECT(0), odd ones not ECN-capable */
+        for ( unsigned int i = 0; i < PACKETS; i++ ) {
+            queue.enqueue( QueuedPacket( make_packet( i, i % 2 ? 0 : ECT_0 ), timestamp() ) );
+        }
+
+        /* one packet out each ms */
+        unsigned int marked = 0;
+        while ( not queue.empty() ) {
+            clock.advance( 1 );
+
+            const QueuedPacket packet = queue.dequeue();
+            const unsigned int number = number_of( packet.contents );
+            const unsigned int ecn = ecn_of( packet.contents );
+            departed.at( number ) = true;
+
+            if ( number % 2 == 0 ) {
+                if ( ecn == CE ) {
+                    marked++;
+                } else if ( ecn != ECT_0 ) {
+                    throw runtime_error( "ECN-capable packet " + to_string( number ) + " was mangled" );
+                }
+            } else if ( ecn != 0 ) {
+                throw runtime_error( "packet " + to_string( number ) + " was marked but isn't ECN-capable" );
+            }
+        }
+
+        unsigned int dropped = 0;
+        for ( unsigned int i = 0; i < PACKETS; i++ ) {
+            if ( not departed.at( i ) ) {
+                if ( i % 2 == 0 ) {
+                    throw runtime_error( "ECN-capable packet " + to_string( i ) + " was dropped" );
+                }
+                dropped++;
+            }
+        }
+
+        if ( dropped == 0 or marked == 0 ) {
+            throw runtime_error( "CoDel never dropped or never marked (" + to_string( dropped )
+                                 + " dropped, " + to_string( marked ) + " marked)" );
+        }
+
+        if ( queue.dropped_packets() != dropped or queue.marked_packets() != marked ) {
+            throw runtime_error( "queue counted " + to_string( queue.dropped_packets() ) + " dropped and "
+                                 + to_string( queue.marked_packets() ) + " marked, not "
+                                 + to_string( dropped ) + " and " + to_string( marked ) );
+        }
+
+        cout << "codel-ecn-test: " << dropped << " not-ECN-capable packets dropped, "
+             << marked << " ECN-capable packets marked" << endl;
+    } catch ( const exception & e ) {
+        print_exception( e );
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,96 @@
+/* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/* time HTTPResponseParser on a stream of responses with multi-megabyte
+   bodies, fed to it in pieces the size of typical socket reads */
+
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+
+#include "http_request_parser.hh"
+#include "http_response_parser.hh"
+#include "exception.hh"
+#include "ezio.hh"
+
+using namespace std;
+
+static HTTPRequest make_request( void )
+{
+    HTTPRequestParser parser;
+    parser.parse( "GET / HTTP/1.1\r\nHost: example.com\r\n\r\n" );
+    return parser.front();
+}
+
+static string make_responses( const unsigned int count, const size_t body_size )
+{
+    string ret;
+
+    for ( unsigned int i = 0; i < count; i++ ) {
+        ret.append( "HTTP/1.1 200 OK\r\n" );
+        for ( unsigned int j = 0; j < 20; j++ ) {
+            ret.append( "X-Header-" + to_string( j ) + ": some value for this header\r\n" );
+        }
+        ret.append( "Content-Length: " + to_string( body_size ) + "\r\n\r\n" );
+        ret.append( body_size, 'x' );
+    }
+
+    return ret;
+}
+
+static double parse_in_pieces( const string & stream, const unsigned int count,
+                               const size_t body_size, const size_t piece_size )
+{
+    const HTTPRequest request = make_request();
+
+    const auto start = chrono::steady_clock::now();
+
+    HTTPResponseParser parser;
+    for ( unsigned int i = 0; i < count; i++ ) {
+        parser.new_request_arrived( request );
+    }
+
+    unsigned int parsed = 0;
+    for ( size_t offset = 0; offset < stream.size(); offset += piece_size ) {
+        parser.parse( stream.substr( offset, piece_size ) );
+
+        while ( not parser.empty() ) {
+            if ( parser.front().body_size() != body_size ) {
+                throw runtime_error( "body size mismatch" );
+            }
+            parser.pop();
+            parsed++;
+        }
+    }
+
+    if ( parsed != count ) {
+        throw runtime_error( "parsed " + to_string( parsed ) + " of " + to_string( count ) + " responses" );
+    }
+
+    return chrono::duration<double>( chrono::steady_clock::now() - start ).count();
+}
+
+int main( int argc, char *argv[] )
+{
+    try {
+        if ( argc > 3 ) {
+            throw runtime_error( "Usage: " + string( argv[ 0 ] ) + " [body megabytes] [responses]" );
+        }
+
+        const size_t body_size = ( argc > 1 ? myatoi( argv[ 1 ] ) : 8 ) * 1024 * 1024;
+        const unsigned int count = argc > 2 ? myatoi( argv[ 2 ] ) : 8;
+
+        const string stream = make_responses( count, body_size );
+
+        /* the last case hands over the whole stream at once, as when the parser falls behind */
+        for ( const size_t piece_size : { size_t( 1460 ), size_t( 16384 ), size_t( 1048576 ), stream.size() } ) {
+            const double seconds = parse_in_pieces( stream, count, body_size, piece_size );
+            cout << "pieces of " << piece_size << " bytes: "
+                 << stream.size() / seconds / 1e6 << " MB/s" << endl;
+        }
+    } catch ( const exception & e ) {
+        print_exception( e );
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
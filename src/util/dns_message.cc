@@ -0,0 +1,222 @@
+/* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <stdexcept>
+#include <cctype>
+
+#include <arpa/inet.h>
+
+#include "dns_message.hh"
+
+using namespace std;
+
+static const size_t HEADER_SIZE = 12;
+
+/* offsets in the header */
+static const size_t QDCOUNT = 4, ANCOUNT = 6, NSCOUNT = 8, ARCOUNT = 10;
+
+static void need( const string & data, const size_t offset, const size_t count )
+{
+    if ( offset + count > data.size() ) {
+        throw runtime_error( "DNS message truncated" );
+    }
+}
+
+uint16_t DNSMessage::get16( const size_t offset ) const
+{
+    need( data_, offset, 2 );
+    return ( uint8_t( data_[ offset ] ) << 8 ) | uint8_t( data_[ offset + 1 ] );
+}
+
+static void set16( string & str, const size_t offset, const uint16_t value )
+{
+    str.at( offset ) = value >> 8;
+    str.at( offset + 1 ) = value & 0xff;
+}
+
+void DNSMessage::put16( const size_t offset, const uint16_t value )
+{
+    set16( data_, offset, value );
+}
+
+size_t DNSMessage::read_name( size_t offset, string & name ) const
+{
+    name.clear();
+
+    size_t end = 0; /* where the name ends, once a pointer has been followed */
+    unsigned int pointers_followed = 0;
+
+    while ( true ) {
+        need( data_, offset, 1 );
+        const uint8_t length = data_[ offset ];
+
+        if ( ( length & 0xc0 ) == 0xc0 ) {
+            need( data_, offset, 2 );
+            if ( ++pointers_followed > 64 ) {
+                throw runtime_error( "DNS message has a compression loop" );
+            }
+            if ( end == 0 ) {
+                end = offset + 2;
+            }
+            offset = ( ( length & 0x3f ) << 8 ) | uint8_t( data_[ offset + 1 ] );
+            continue;
+        }
+
+        if ( length & 0xc0 ) {
+            throw runtime_error( "DNS message has an unknown label type" );
+        }
+
+        if ( length == 0 ) {
+            return end ? end : offset + 1;
+        }
+
+        need( data_, offset + 1, length );
+        if ( not name.empty() ) {
+            name.push_back( '.' );
+        }
+        name.append( data_, offset + 1, length );
+        offset += 1 + length;
+
+        if ( name.size() > 255 ) {
+            throw runtime_error( "DNS message has an overlong name" );
+        }
+    }
+}
+
+DNSMessage::DNSMessage( const string & data )
+    : data_( data )
+{
+    need( data_, 0, HEADER_SIZE );
+
+    /* the question(s) */
+    const uint16_t question_count = get16( QDCOUNT );
+    size_t offset = HEADER_SIZE;
+
+    for ( unsigned int i = 0; i < question_count; i++ ) {
+        string name;
+        offset = read_name( offset, name );
+
+        if ( question_count == 1 ) {
+            name_ = canonical_name( name );
+            type_ = get16( offset );
+            class_ = get16( offset + 2 );
+            has_question_ = true;
+        }
+
+        need( data_, offset, 4 );
+        offset += 4;
+    }
+
+    question_end_ = offset;
+
+    /* the answer, authority and additional records */
+    const unsigned int record_count = get16( ANCOUNT ) + get16( NSCOUNT ) + get16( ARCOUNT );
+
+    for ( unsigned int i = 0; i < record_count; i++ ) {
+        string name;
+        offset = read_name( offset, name );
+
+        /* type, class, TTL, data length */
+        need( data_, offset, 10 );
+        const uint16_t type = get16( offset );
+        const uint16_t data_length = get16( offset + 8 );
+
+        /* (an OPT record's "TTL" holds EDNS flags instead) */
+        if ( type != OPT ) {
+            ttl_offsets_.push_back( offset + 4 );
+        }
+
+        offset += 10;
+        need( data_, offset, data_length );
+        offset += data_length;
+    }
+}
+
+string DNSMessage::cache_key( void ) const
+{
+    return name_ + "/" + to_string( type_ ) + "/" + to_string( class_ );
+}
+
+bool DNSMessage::minimum_ttl( uint32_t & ttl ) const
+{
+    if ( ttl_offsets_.empty() ) {
+        return false;
+    }
+
+    ttl = UINT32_MAX;
+    for ( const auto offset : ttl_offsets_ ) {
+        ttl = min( ttl, ( uint32_t( get16( offset ) ) << 16 ) | get16( offset + 2 ) );
+    }
+
+    return true;
+}
+
+void DNSMessage::age( const uint32_t seconds )
+{
+    for ( const auto offset : ttl_offsets_ ) {
+        const uint32_t ttl = ( uint32_t( get16( offset ) ) << 16 ) | get16( offset + 2 );
+        const uint32_t aged = ttl > seconds ? ttl - seconds : 0;
+        put16( offset, aged >> 16 );
+        put16( offset + 2, aged & 0xffff );
+    }
+}
+
+static void append16( string & str, const uint16_t value )
+{
+    str.push_back( value >> 8 );
+    str.push_back( value & 0xff );
+}
+
+string DNSMessage::reply( const DNSMessage & query, const ResponseCode code,
+                          const vector< Address > & addresses )
+{
+    /* the query's header and question */
+    string ret = query.data_.substr( 0, query.question_end_ );
+
+    /* QR and AA set, opcode and RD copied; RA set */
+    ret[ 2 ] = 0x80 | ( query.data_[ 2 ] & 0x79 ) | 0x04;
+    ret[ 3 ] = 0x80 | code;
+
+    set16( ret, ANCOUNT, addresses.size() );
+    set16( ret, NSCOUNT, 0 );
+    set16( ret, ARCOUNT, 0 );
+
+    for ( const auto & address : addresses ) {
+        const sockaddr & addr = address.to_sockaddr();
+        string rdata;
+        uint16_t type;
+
+        if ( addr.sa_family == AF_INET ) {
+            const in_addr & ip = reinterpret_cast<const sockaddr_in &>( addr ).sin_addr;
+            rdata.assign( reinterpret_cast<const char *>( &ip ), sizeof( ip ) );
+            type = A;
+        } else {
+            const in6_addr & ip = reinterpret_cast<const sockaddr_in6 &>( addr ).sin6_addr;
+            rdata.assign( reinterpret_cast<const char *>( &ip ), sizeof( ip ) );
+            type = AAAA;
+        }
+
+        append16( ret, 0xc000 | HEADER_SIZE ); /* the name in the question */
+        append16( ret, type );
+        append16( ret, CLASS_IN );
+        append16( ret, 0 ); /* TTL of zero, so nothing holds on to the answer */
+        append16( ret, 0 );
+        append16( ret, rdata.size() );
+        ret.append( rdata );
+    }
+
+    return ret;
+}
+
+string DNSMessage::canonical_name( const string & name )
+{
+    string ret;
+    for ( const char c : name ) {
+        ret.push_back( tolower( static_cast<unsigned char>( c ) ) );
+    }
+
+    if ( not ret.empty() and ret.back() == '.' ) {
+        ret.pop_back();
+    }
+
+    return ret;
+}
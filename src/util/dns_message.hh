@@ -0,0 +1,75 @@
+/* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef DNS_MESSAGE_HH
+#define DNS_MESSAGE_HH
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "address.hh"
+
+/* a DNS query or reply (RFC 1035), parsed just enough to answer,
+   forward and cache it */
+class DNSMessage
+{
+public:
+    enum RecordType : uint16_t { A = 1, AAAA = 28, OPT = 41, ANY = 255 };
+    static const uint16_t CLASS_IN = 1;
+    enum ResponseCode : uint8_t { NOERROR = 0, FORMERR = 1, SERVFAIL = 2, NXDOMAIN = 3, REFUSED = 5 };
+
+private:
+    std::string data_;
+
+    bool has_question_ {};
+    std::string name_ {};          /* lowercase, without the trailing dot */
+    uint16_t type_ {}, class_ {};
+    size_t question_end_ {};
+
+    std::vector< size_t > ttl_offsets_ {}; /* of every record but OPT */
+
+    uint16_t get16( const size_t offset ) const;
+    void put16( const size_t offset, const uint16_t value );
+
+    /* read the (possibly compressed) name at offset, and return where it ends */
+    size_t read_name( const size_t offset, std::string & name ) const;
+
+public:
+    /* throws runtime_error if data isn't a well-formed DNS message */
+    DNSMessage( const std::string & data );
+
+    uint16_t id( void ) const { return get16( 0 ); }
+    void set_id( const uint16_t id ) { put16( 0, id ); }
+
+    bool is_response( void ) const { return data_.at( 2 ) & 0x80; }
+    bool truncated( void ) const { return data_.at( 2 ) & 0x02; }
+    uint8_t response_code( void ) const { return data_.at( 3 ) & 0x0f; }
+
+    /* the one question of a usual query (has_question() is false if
+       there are none, or several) */
+    bool has_question( void ) const { return has_question_; }
+    const std::string & name( void ) const { return name_; }
+    uint16_t type( void ) const { return type_; }
+    uint16_t question_class( void ) const { return class_; }
+
+    /* identifies the question for caching */
+    std::string cache_key( void ) const;
+
+    /* the smallest TTL of the records (false if there are none) */
+    bool minimum_ttl( uint32_t & ttl ) const;
+
+    /* count down every TTL by seconds, as a cache does */
+    void age( const uint32_t seconds );
+
+    const std::string & str( void ) const { return data_; }
+
+    /* reply to a query with the given code and addresses (of the type asked
+       for) as answers */
+    static std::string reply( const DNSMessage & query, const ResponseCode code,
+                              const std::vector< Address > & addresses = {} );
+
+    /* lowercase, without a trailing dot */
+    static std::string canonical_name( const std::string & name );
+};
+
+#endif /* DNS_MESSAGE_HH */
@@ -2,51 +2,307 @@
 
 #include <random>
 #include <thread>
-#include <chrono>
 #include <string>
 
-#include "child_process.hh"
-#include "system_runner.hh"
+#include "dns_server.hh"
+#include "event_loop.hh"
+#include "timestamp.hh"
 #include "exception.hh"
-#include "socket.hh"
-
-#include "config.h"
 
 using namespace std;
+using namespace PollerShortNames;
+
+/* give up on a forwarded query after this long */
+static const uint64_t FORWARD_TIMEOUT_MS = 10000;
+
+/* sweep the tables when they get this big */
+static const size_t FORWARDED_SWEEP_SIZE = 256;
+static const size_t CACHE_SWEEP_SIZE = 4096;
+
+DNSServer::DNSServer( const Address & listen_address )
+    : udp_listener_(),
+      tcp_listener_(),
+      next_id_( random_device()() )
+{
+    udp_listener_.bind( listen_address );
+
+    /* same port for TCP, even if the UDP one was chosen by the kernel */
+    tcp_listener_.bind( udp_listener_.local_address() );
+    tcp_listener_.listen();
+}
 
-ChildProcess start_dnsmasq( const vector< string > & extra_arguments )
+void DNSServer::add_host( const string & name, const Address & address )
 {
-    vector< string > args = { DNSMASQ, "--keep-in-foreground", "--no-resolv",
-                              "--no-hosts",
-                              "-C", "/dev/null" };
+    auto & addresses = hosts_[ DNSMessage::canonical_name( name ) ];
 
-    args.insert( args.end(), extra_arguments.begin(), extra_arguments.end() );
+    for ( const auto & x : addresses ) {
+        if ( x.ip() == address.ip() ) {
+            return;
+        }
+    }
 
-    ChildProcess dnsmasq( "dnsmasq", [&] () { return ezexec( args ); }, false, SIGTERM );
+    addresses.emplace_back( address.ip(), 0 );
+}
 
-    /* busy-wait for dnsmasq to start answering DNS queries */
-    UDPSocket server;
-    server.connect( Address( "0", "domain" ) );
+void DNSServer::forward_to( const Address & udp_target, const Address & tcp_target )
+{
+    forwarding_ = true;
+    udp_target_ = udp_target;
+    tcp_target_ = tcp_target;
+}
 
-    unsigned int attempts = 0;
-    while ( true ) {
-        if ( ++attempts >= 20 ) {
-            throw runtime_error( "dnsmasq: did not start after " + to_string( attempts ) + " attempts" );
+string DNSServer::answer_from_hosts( const DNSMessage & query ) const
+{
+    if ( not query.has_question() or query.question_class() != DNSMessage::CLASS_IN ) {
+        return string();
+    }
+
+    const auto host = hosts_.find( query.name() );
+    if ( host == hosts_.end() ) {
+        return string();
+    }
+
+    /* a known name has just the addresses it has
+       (so asking for another type gets no answers) */
+    vector< Address > answers;
+    for ( const auto & address : host->second ) {
+        const bool ipv4 = address.to_sockaddr().sa_family == AF_INET;
+        if ( query.type() == DNSMessage::ANY
+             or query.type() == ( ipv4 ? DNSMessage::A : DNSMessage::AAAA ) ) {
+            answers.push_back( address );
         }
+    }
 
-        try {
-            /* write will throw an exception if the prior UDP datagram got a bad ICMP reply */
-            server.write( "x" );
-            this_thread::sleep_for( chrono::milliseconds( 10 ) );
-            server.write( "x" );
-            break;
-        } catch ( const exception & e ) {
-            if ( string( e.what() ).substr( 0, 6 ) != "write:" ) {
-                throw;
-            }
-            this_thread::sleep_for( chrono::milliseconds( 10 ) );
+    return DNSMessage::reply( query, DNSMessage::NOERROR, answers );
+}
+
+string DNSServer::answer_from_cache( const DNSMessage & query )
+{
+    if ( not query.has_question() ) {
+        return string();
+    }
+
+    const auto cached = cache_.find( query.cache_key() );
+    if ( cached == cache_.end() ) {
+        return string();
+    }
+
+    const uint64_t now = timestamp();
+    if ( now >= cached->second.expires ) {
+        cache_.erase( cached );
+        return string();
+    }
+
+    DNSMessage reply( cached->second.reply );
+    reply.set_id( query.id() );
+    reply.age( ( now - cached->second.stored ) / 1000 );
+    return reply.str();
+}
+
+void DNSServer::cache( const string & key, const DNSMessage & reply )
+{
+    uint32_t ttl;
+    if ( reply.truncated()
+         or ( reply.response_code() != DNSMessage::NOERROR and reply.response_code() != DNSMessage::NXDOMAIN )
+         or not reply.minimum_ttl( ttl )
+         or ttl == 0 ) {
+        return;
+    }
+
+    const uint64_t now = timestamp();
+
+    if ( cache_.size() >= CACHE_SWEEP_SIZE ) {
+        for ( auto it = cache_.begin(); it != cache_.end(); ) {
+            it = ( now >= it->second.expires ) ? cache_.erase( it ) : next( it );
+        }
+
+        if ( cache_.size() >= CACHE_SWEEP_SIZE ) {
+            cache_.clear();
+        }
+    }
+
+    const CachedReply entry { reply.str(), now, now + uint64_t( ttl ) * 1000 };
+    const auto inserted = cache_.emplace( key, entry );
+    if ( not inserted.second ) {
+        inserted.first->second = entry;
+    }
+}
+
+void DNSServer::forward( const Address & client, DNSMessage & query )
+{
+    const uint64_t now = timestamp();
+
+    /* forget queries that were never answered */
+    if ( forwarded_.size() >= FORWARDED_SWEEP_SIZE ) {
+        for ( auto it = forwarded_.begin(); it != forwarded_.end(); ) {
+            it = ( now - it->second.sent >= FORWARD_TIMEOUT_MS ) ? forwarded_.erase( it ) : next( it );
         }
     }
 
-    return dnsmasq;
+    if ( forwarded_.size() > UINT16_MAX ) {
+        throw runtime_error( "DNSServer: too many queries awaiting replies" );
+    }
+
+    /* give the query an ID of our own, as clients' IDs may collide */
+    while ( forwarded_.count( next_id_ ) ) {
+        next_id_++;
+    }
+
+    const string cache_key = query.has_question() ? query.cache_key() : string();
+    forwarded_.emplace( next_id_, ForwardedQuery { client, query.id(), cache_key, now } );
+
+    query.set_id( next_id_++ );
+    upstream_.sendto( udp_target_, query.str() );
+}
+
+void DNSServer::handle_udp( void )
+{
+    const auto request = udp_listener_.recvfrom();
+
+    string reply;
+
+    try {
+        DNSMessage query( request.second );
+        if ( query.is_response() ) {
+            return;
+        }
+
+        reply = answer_from_hosts( query );
+
+        if ( reply.empty() ) {
+            reply = answer_from_cache( query );
+        }
+
+        if ( reply.empty() and forwarding_ ) {
+            forward( request.first, query );
+            return;
+        }
+
+        if ( reply.empty() ) {
+            reply = DNSMessage::reply( query, DNSMessage::REFUSED );
+        }
+    } catch ( const exception & e ) {
+        print_exception( e );
+        return;
+    }
+
+    udp_listener_.sendto( request.first, reply );
+}
+
+void DNSServer::handle_upstream_reply( void )
+{
+    const auto datagram = upstream_.recvfrom();
+    if ( not ( datagram.first == udp_target_ ) ) {
+        return;
+    }
+
+    try {
+        DNSMessage reply( datagram.second );
+
+        const auto forwarded = forwarded_.find( reply.id() );
+        if ( forwarded == forwarded_.end() ) {
+            return; /* answered already, or given up on */
+        }
+
+        const ForwardedQuery query = forwarded->second;
+        forwarded_.erase( forwarded );
+
+        reply.set_id( query.client_id );
+        udp_listener_.sendto( query.client, reply.str() );
+
+        if ( not query.cache_key.empty() ) {
+            cache( query.cache_key, reply );
+        }
+    } catch ( const exception & e ) {
+        print_exception( e );
+    }
+}
+
+/* size of the length-prefixed message at the start of buffer, prefix included */
+static size_t framed_size( const string & buffer )
+{
+    return 2 + ( ( uint8_t( buffer[ 0 ] ) << 8 ) | uint8_t( buffer[ 1 ] ) );
+}
+
+/* next length-prefixed message on a TCP connection ("" at EOF) */
+static string read_message( TCPSocket & socket, string & buffer )
+{
+    while ( buffer.size() < 2 or buffer.size() < framed_size( buffer ) ) {
+        const string data = socket.read();
+        if ( socket.eof() ) {
+            return string();
+        }
+        buffer.append( data );
+    }
+
+    const size_t size = framed_size( buffer );
+    const string ret = buffer.substr( 2, size - 2 );
+    buffer.erase( 0, size );
+    return ret;
+}
+
+static void write_message( TCPSocket & socket, const string & message )
+{
+    socket.write( string( 1, message.size() >> 8 ) + char( message.size() & 0xff ) + message );
+}
+
+void DNSServer::handle_tcp( void )
+{
+    /* start a new thread to handle the connection
+       (which only reads the table, so needs no locking) */
+    thread newthread( [&] ( TCPSocket client ) {
+            try {
+                string buffer;
+
+                while ( true ) {
+                    const string message = read_message( client, buffer );
+                    if ( message.empty() ) {
+                        return;
+                    }
+
+                    DNSMessage query( message );
+                    string reply = answer_from_hosts( query );
+
+                    if ( reply.empty() and forwarding_ ) {
+                        TCPSocket upstream;
+                        upstream.connect( tcp_target_ );
+                        write_message( upstream, query.str() );
+
+                        string upstream_buffer;
+                        reply = read_message( upstream, upstream_buffer );
+                        if ( reply.empty() ) {
+                            throw runtime_error( "DNSServer: upstream server closed connection" );
+                        }
+                    }
+
+                    if ( reply.empty() ) {
+                        reply = DNSMessage::reply( query, DNSMessage::REFUSED );
+                    }
+
+                    write_message( client, reply );
+                }
+            } catch ( const exception & e ) {
+                print_exception( e );
+                return;
+            }
+        }, tcp_listener_.accept() );
+
+    /* don't wait around for the reply */
+    newthread.detach();
+}
+
+void DNSServer::forget( void )
+{
+    cache_.clear();
+    forwarded_.clear();
+}
+
+void DNSServer::register_handlers( EventLoop & event_loop )
+{
+    event_loop.add_simple_input_handler( udp_listener_,
+                                         [&] () { handle_udp(); return ResultType::Continue; } );
+    event_loop.add_simple_input_handler( upstream_,
+                                         [&] () { handle_upstream_reply(); return ResultType::Continue; } );
+    event_loop.add_simple_input_handler( tcp_listener_,
+                                         [&] () { handle_tcp(); return ResultType::Continue; } );
 }
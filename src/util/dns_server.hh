@@ -5,9 +5,83 @@
 
 #include <vector>
 #include <string>
+#include <unordered_map>
 
-#include "child_process.hh"
+#include "socket.hh"
+#include "dns_message.hh"
 
-ChildProcess start_dnsmasq( const std::vector< std::string > & extra_arguments );
+class EventLoop;
+
+/* a DNS server (in place of dnsmasq) that answers queries for the names
+   in a table, and forwards the rest to an upstream server, if it has
+   one, caching the replies for as long as their TTL allows. It answers
+   over UDP from the event loop, and over TCP from a thread per connection.
+
+   It's listening once constructed (queries wait in the socket until
+   the event loop runs). */
+class DNSServer
+{
+private:
+    UDPSocket udp_listener_;
+    TCPSocket tcp_listener_;
+
+    /* by DNSMessage::canonical_name */
+    std::unordered_map< std::string, std::vector< Address > > hosts_ {};
+
+    bool forwarding_ {};
+    Address udp_target_ {}, tcp_target_ {};
+    UDPSocket upstream_ {}; /* (unconnected, so unanswered queries don't make it fail) */
+
+    /* queries forwarded over UDP and not yet answered, by the ID we gave them */
+    struct ForwardedQuery
+    {
+        Address client;
+        uint16_t client_id;
+        std::string cache_key;
+        uint64_t sent;
+    };
+    std::unordered_map< uint16_t, ForwardedQuery > forwarded_ {};
+    uint16_t next_id_;
+
+    struct CachedReply
+    {
+        std::string reply;
+        uint64_t stored, expires;
+    };
+    std::unordered_map< std::string, CachedReply > cache_ {};
+    void cache( const std::string & key, const DNSMessage & reply );
+
+    /* reply from the table ("" if the name isn't there) */
+    std::string answer_from_hosts( const DNSMessage & query ) const;
+
+    /* reply from the cache ("" if there's none) */
+    std::string answer_from_cache( const DNSMessage & query );
+
+    void forward( const Address & client, DNSMessage & query );
+
+    void handle_udp( void );
+    void handle_upstream_reply( void );
+    void handle_tcp( void );
+
+public:
+    /* by default, on port 53 of every interface */
+    DNSServer( const Address & listen_address = Address( "0", "domain" ) );
+
+    /* answer queries for name with address (the table should be filled
+       in before register_handlers) */
+    void add_host( const std::string & name, const Address & address );
+
+    /* forward other queries to an upstream server */
+    void forward_to( const Address & udp_target, const Address & tcp_target );
+
+    /* drop the cached replies (and the queries still waiting for one),
+       so what's looked up next goes upstream as if for the first time */
+    void forget( void );
+
+    UDPSocket & udp_listener( void ) { return udp_listener_; }
+    TCPSocket & tcp_listener( void ) { return tcp_listener_; }
+
+    void register_handlers( EventLoop & event_loop );
+};
 
 #endif /* DNS_SERVER_HH */
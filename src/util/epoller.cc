@@ -0,0 +1,50 @@
+/* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include "epoller.hh"
+#include "exception.hh"
+
+using namespace std;
+
+Epoller::Epoller()
+    : epoll_fd_( SystemCall( "epoll_create1", epoll_create1( EPOLL_CLOEXEC ) ) ),
+      interest_(),
+      ready_( 64 )
+{}
+
+void Epoller::set_interest( const FileDescriptor & fd, const uint32_t events )
+{
+    const auto it = interest_.find( fd.fd_num() );
+    const uint32_t current = ( it == interest_.end() ) ? 0 : it->second;
+
+    if ( events == current ) {
+        return;
+    }
+
+    epoll_event ev;
+    ev.events = events;
+    ev.data.fd = fd.fd_num();
+
+    if ( events == 0 ) {
+        SystemCall( "epoll_ctl DEL", epoll_ctl( epoll_fd_.fd_num(), EPOLL_CTL_DEL, fd.fd_num(), &ev ) );
+        interest_.erase( it );
+    } else if ( current == 0 ) {
+        SystemCall( "epoll_ctl ADD", epoll_ctl( epoll_fd_.fd_num(), EPOLL_CTL_ADD, fd.fd_num(), &ev ) );
+        interest_[ fd.fd_num() ] = events;
+    } else {
+        SystemCall( "epoll_ctl MOD", epoll_ctl( epoll_fd_.fd_num(), EPOLL_CTL_MOD, fd.fd_num(), &ev ) );
+        it->second = events;
+    }
+}
+
+const vector< epoll_event > & Epoller::wait( const int timeout_ms )
+{
+    ready_.resize( max( size_t( 64 ), interest_.size() ) );
+
+    int count;
+    do {
+        count = epoll_wait( epoll_fd_.fd_num(), &ready_[ 0 ], ready_.size(), timeout_ms );
+    } while ( count < 0 and errno == EINTR );
+
+    ready_.resize( SystemCall( "epoll_wait", count ) );
+    return ready_;
+}
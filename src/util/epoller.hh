@@ -0,0 +1,40 @@
+/* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef EPOLLER_HH
+#define EPOLLER_HH
+
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+#include <sys/epoll.h>
+
+#include "file_descriptor.hh"
+
+/* level-triggered epoll over a changing set of file descriptors
+   (unlike Poller, whose actions are fixed once added) */
+class Epoller
+{
+private:
+    FileDescriptor epoll_fd_;
+
+    /* events currently registered for each fd */
+    std::unordered_map< int, uint32_t > interest_;
+
+    std::vector< epoll_event > ready_;
+
+public:
+    Epoller();
+
+    /* set the events of interest for fd; an fd with no events of
+       interest is removed from the set, so hangups on it aren't reported */
+    void set_interest( const FileDescriptor & fd, const uint32_t events );
+
+    /* forget fd (must be called before it is closed) */
+    void remove( const FileDescriptor & fd ) { set_interest( fd, 0 ); }
+
+    /* wait for events; returns the ready fds and their events */
+    const std::vector< epoll_event > & wait( const int timeout_ms );
+};
+
+#endif /* EPOLLER_HH */
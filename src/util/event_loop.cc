@@ -4,6 +4,7 @@
 
 #include "event_loop.hh"
 #include "exception.hh"
+#include "timestamp.hh"
 
 using namespace std;
 using namespace PollerShortNames;
@@ -101,7 +102,13 @@ int EventLoop::internal_loop( const std::function<int(void)> & wait_time )
     add_simple_input_handler( signal_fd.fd(),
                               [&] () { return handle_signal( signal_fd.read_signal() ); } );
 
+    /* the stages of the loop read the time as of the latest sample */
+    LoopClock clock;
+
     while ( true ) {
+        /* (the timeout runs from now, however long the last wakeup's work took) */
+        LoopClock::tick();
+
         const auto poll_result = poller_.poll( wait_time() );
         if ( poll_result.result == Poller::Result::Type::Exit ) {
             return poll_result.exit_status;
@@ -49,6 +49,18 @@ FileDescriptor::~FileDescriptor()
     }
 }
 
+void FileDescriptor::set_blocking( const bool blocking )
+{
+    int flags = SystemCall( "fcntl F_GETFL", fcntl( fd_, F_GETFL ) );
+    if ( blocking ) {
+        flags &= ~O_NONBLOCK;
+    } else {
+        flags |= O_NONBLOCK;
+    }
+
+    SystemCall( "fcntl F_SETFL", fcntl( fd_, F_SETFL, flags ) );
+}
+
 /* attempt to write a portion of a string */
 string::const_iterator FileDescriptor::write( const string::const_iterator & begin,
                                               const string::const_iterator & end )
@@ -57,7 +69,14 @@ string::const_iterator FileDescriptor::write( const string::const_iterator & beg
         throw runtime_error( "nothing to write" );
     }
 
-    ssize_t bytes_written = SystemCall( "write", ::write( fd_, &*begin, end - begin ) );
+    const ssize_t result = ::write( fd_, &*begin, end - begin );
+    if ( result < 0 and ( errno == EAGAIN or errno == EWOULDBLOCK ) ) {
+        /* non-blocking fd that can't take any more right now */
+        register_write();
+        return begin;
+    }
+
+    ssize_t bytes_written = SystemCall( "write", result );
     if ( bytes_written == 0 ) {
         throw runtime_error( "write returned 0" );
     }
@@ -72,7 +91,14 @@ string FileDescriptor::read( const size_t limit )
 {
     char buffer[ BUFFER_SIZE ];
 
-    ssize_t bytes_read = SystemCall( "read", ::read( fd_, buffer, min( BUFFER_SIZE, limit ) ) );
+    const ssize_t result = ::read( fd_, buffer, min( BUFFER_SIZE, limit ) );
+    if ( result < 0 and ( errno == EAGAIN or errno == EWOULDBLOCK ) ) {
+        /* non-blocking fd with nothing to read yet (not EOF) */
+        register_read();
+        return string();
+    }
+
+    ssize_t bytes_read = SystemCall( "read", result );
     if ( bytes_read == 0 ) {
         set_eof();
     }
@@ -38,7 +38,12 @@ public:
     unsigned int read_count( void ) const { return read_count_; }
     unsigned int write_count( void ) const { return write_count_; }
 
+    /* put the fd in blocking (the default) or non-blocking mode */
+    void set_blocking( const bool blocking );
+
     /* read and write methods */
+    /* (on a non-blocking fd, read returns "" without EOF, and write
+       returns begin, if the fd isn't ready) */
     std::string read( const size_t limit = BUFFER_SIZE );
     std::string::const_iterator write( const std::string & buffer, const bool write_all = true );
     std::string::const_iterator write( const std::string::const_iterator & begin,
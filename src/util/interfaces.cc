@@ -11,6 +11,8 @@
 #include <sys/types.h>
 #include <ifaddrs.h>
 #include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
 
 #include "interfaces.hh"
 #include "exception.hh"
@@ -126,14 +128,54 @@ pair< Address, uint16_t > Interfaces::first_unassigned_address( uint16_t last_oc
     throw runtime_error( "Interfaces: could not find free interface address" );
 }
 
+/* claim an address for as long as this process (or a child) lives, so
+   shells starting at the same time don't both choose it before either
+   has configured it. The claim is a lock on a file named for the address,
+   which goes away with the process even if it crashes. */
+static bool reserve( const Address & address )
+{
+    static vector< FileDescriptor > reservations;
+
+    struct stat lock_directory;
+    const string directory = ( stat( "/run/lock", &lock_directory ) == 0 ) ? "/run/lock/" : "/tmp/";
+    const string filename = directory + "mahimahi-" + address.ip() + ".lock";
+
+    const int fd = open( filename.c_str(), O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 00600 );
+    if ( fd < 0 ) {
+        /* can't coordinate, so go without */
+        return true;
+    }
+
+    FileDescriptor lock( fd );
+    if ( flock( lock.fd_num(), LOCK_EX | LOCK_NB ) < 0 ) {
+        if ( errno == EWOULDBLOCK ) {
+            return false; /* another shell has it */
+        }
+        throw unix_error( "flock " + filename );
+    }
+
+    reservations.push_back( move( lock ) );
+    return true;
+}
+
 std::pair< Address, Address > two_unassigned_addresses( const Address & avoid )
 {
     Interfaces interfaces;
 
     interfaces.add_address( avoid );
 
-    auto one = interfaces.first_unassigned_address( 1 );
-    auto two = interfaces.first_unassigned_address( one.second + 1 );
+    auto first_reserved_address = [&] ( uint16_t last_octet ) {
+        while ( true ) {
+            const auto candidate = interfaces.first_unassigned_address( last_octet );
+            if ( reserve( candidate.first ) ) {
+                return candidate;
+            }
+            last_octet = candidate.second + 1;
+        }
+    };
+
+    auto one = first_reserved_address( 1 );
+    auto two = first_reserved_address( one.second + 1 );
 
     return make_pair( one.first, two.first );
 }
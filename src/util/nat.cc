@@ -8,71 +8,251 @@
 
 #include <unistd.h>
 #include <sys/types.h>
+#include <arpa/inet.h>
+#include <netinet/ip.h>
+#include <net/if.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nf_tables.h>
 #include <iostream>
+#include <atomic>
+#include <cstddef>
 
 #include "nat.hh"
+#include "netlink.hh"
 #include "exception.hh"
-#include "config.h"
 
 using namespace std;
 
-/**
- * iptables commit ef7781e (July 2021) prevents running when setuid root, so
- * temporarily assume ruid 0 to run iptables
- */
-class TempRUIDRoot
+/* nftables requests, which the kernel applies all-or-nothing */
+class NFTablesTransaction : public NetlinkSocket
 {
-    uid_t orig_ruid_;
+private:
+    void batch_marker( const uint16_t type )
+    {
+        NetlinkMessage marker( type, 0 );
+        marker.add_header( nfgenmsg { AF_UNSPEC, NFNETLINK_V0, htons( NFNL_SUBSYS_NFTABLES ) } );
+        queue( marker, "", false );
+    }
 
 public:
-    TempRUIDRoot()
-        : orig_ruid_( getuid() )
+    NFTablesTransaction()
+        : NetlinkSocket( NETLINK_NETFILTER )
+    {
+        batch_marker( NFNL_MSG_BATCH_BEGIN );
+    }
+
+    static NetlinkMessage message( const uint16_t type, const uint16_t flags )
+    {
+        NetlinkMessage ret( ( NFNL_SUBSYS_NFTABLES << 8 ) | type, flags );
+        ret.add_header( nfgenmsg { NFPROTO_IPV4, NFNETLINK_V0, 0 } );
+        return ret;
+    }
+
+    void add( NetlinkMessage & message, const string & description )
     {
-        SystemCall( "setreuid", setreuid( 0, -1 ) );
+        queue( message, description );
     }
 
-    ~TempRUIDRoot()
+    void commit( void )
     {
-        /* don't throw from destructor */
-        try {
-            SystemCall( "setreuid", setreuid( orig_ruid_, -1 ) );
-        } catch ( const exception & e ) {
-            print_exception( e );
-            cerr << "Unable to drop ruid root, aborting.\n";
-            abort();
-        }
+        batch_marker( NFNL_MSG_BATCH_END );
+        NetlinkSocket::commit();
     }
 };
 
-NATRule::NATRule( const vector< string > & s_args )
-    : arguments( s_args )
+/* expressions making up rules */
+
+static void begin_expression( NetlinkMessage & rule, const string & name )
+{
+    rule.begin_nested( NFTA_LIST_ELEM );
+    rule.add_string( NFTA_EXPR_NAME, name );
+    rule.begin_nested( NFTA_EXPR_DATA );
+}
+
+static void end_expression( NetlinkMessage & rule )
+{
+    rule.end_nested();
+    rule.end_nested();
+}
+
+static void add_data( NetlinkMessage & rule, const uint16_t type, const string & value )
+{
+    rule.begin_nested( type );
+    rule.add_attribute( NFTA_DATA_VALUE, value );
+    rule.end_nested();
+}
+
+template <class T>
+static string bytes( const T & value )
+{
+    return string( reinterpret_cast<const char *>( &value ), sizeof( value ) );
+}
+
+/* register = bytes of the IPv4 header */
+static void load_ip_header( NetlinkMessage & rule, const uint32_t offset, const uint32_t length )
+{
+    begin_expression( rule, "payload" );
+    rule.add_be32( NFTA_PAYLOAD_DREG, NFT_REG_1 );
+    rule.add_be32( NFTA_PAYLOAD_BASE, NFT_PAYLOAD_NETWORK_HEADER );
+    rule.add_be32( NFTA_PAYLOAD_OFFSET, offset );
+    rule.add_be32( NFTA_PAYLOAD_LEN, length );
+    end_expression( rule );
+}
+
+static void load_meta( NetlinkMessage & rule, const uint32_t key )
+{
+    begin_expression( rule, "meta" );
+    rule.add_be32( NFTA_META_KEY, key );
+    rule.add_be32( NFTA_META_DREG, NFT_REG_1 );
+    end_expression( rule );
+}
+
+/* continue with the rule only if register 1 holds value */
+static void require_equal( NetlinkMessage & rule, const string & value )
+{
+    begin_expression( rule, "cmp" );
+    rule.add_be32( NFTA_CMP_SREG, NFT_REG_1 );
+    rule.add_be32( NFTA_CMP_OP, NFT_CMP_EQ );
+    add_data( rule, NFTA_CMP_DATA, value );
+    end_expression( rule );
+}
+
+static void load_immediate( NetlinkMessage & rule, const uint32_t reg, const string & value )
+{
+    begin_expression( rule, "immediate" );
+    rule.add_be32( NFTA_IMMEDIATE_DREG, reg );
+    add_data( rule, NFTA_IMMEDIATE_DATA, value );
+    end_expression( rule );
+}
+
+static void load_connection_mark( NetlinkMessage & rule )
+{
+    begin_expression( rule, "ct" );
+    rule.add_be32( NFTA_CT_KEY, NFT_CT_MARK );
+    rule.add_be32( NFTA_CT_DREG, NFT_REG_1 );
+    end_expression( rule );
+}
+
+static void store_connection_mark( NetlinkMessage & rule )
+{
+    begin_expression( rule, "ct" );
+    rule.add_be32( NFTA_CT_KEY, NFT_CT_MARK );
+    rule.add_be32( NFTA_CT_SREG, NFT_REG_1 );
+    end_expression( rule );
+}
+
+static string ipv4_bytes( const Address & address )
 {
-    TempRUIDRoot temp_root;
-    vector< string > command = { IPTABLES, "-w", "-t", "nat", "-A" };
-    command.insert( command.end(), arguments.begin(), arguments.end() );
-    run( command );
+    const sockaddr & addr = address.to_sockaddr();
+    if ( addr.sa_family != AF_INET ) {
+        throw runtime_error( "NAT: " + address.ip() + " is not an IPv4 address" );
+    }
+
+    return bytes( reinterpret_cast<const sockaddr_in &>( addr ).sin_addr );
+}
+
+/* tables are named for the process, and numbered within it */
+static string next_table_name( void )
+{
+    static atomic<unsigned int> counter( 0 );
+    return "mahimahi-" + to_string( getpid() ) + "-" + to_string( counter++ );
 }
 
-NATRule::~NATRule()
+static void add_chain( NFTablesTransaction & transaction, const string & table,
+                       const string & chain, const uint32_t hook, const int32_t priority,
+                       const vector< NATRule > & rules )
+{
+    if ( rules.empty() ) {
+        return;
+    }
+
+    NetlinkMessage new_chain = NFTablesTransaction::message( NFT_MSG_NEWCHAIN, NLM_F_CREATE | NLM_F_EXCL );
+    new_chain.add_string( NFTA_CHAIN_TABLE, table );
+    new_chain.add_string( NFTA_CHAIN_NAME, chain );
+    new_chain.add_string( NFTA_CHAIN_TYPE, "nat" );
+    new_chain.begin_nested( NFTA_CHAIN_HOOK );
+    new_chain.add_be32( NFTA_HOOK_HOOKNUM, hook );
+    new_chain.add_be32( NFTA_HOOK_PRIORITY, priority );
+    new_chain.end_nested();
+    transaction.add( new_chain, "create chain " + table + " " + chain );
+
+    for ( const auto & rule : rules ) {
+        NetlinkMessage new_rule = NFTablesTransaction::message( NFT_MSG_NEWRULE, NLM_F_CREATE | NLM_F_APPEND );
+        new_rule.add_string( NFTA_RULE_TABLE, table );
+        new_rule.add_string( NFTA_RULE_CHAIN, chain );
+        new_rule.begin_nested( NFTA_RULE_EXPRESSIONS );
+        rule( new_rule );
+        new_rule.end_nested();
+        transaction.add( new_rule, "add rule to " + table + " " + chain );
+    }
+}
+
+NATTable::NATTable( const vector< NATRule > & prerouting, const vector< NATRule > & postrouting )
+    : name_( next_table_name() )
+{
+    NFTablesTransaction transaction;
+
+    NetlinkMessage new_table = NFTablesTransaction::message( NFT_MSG_NEWTABLE, NLM_F_CREATE | NLM_F_EXCL );
+    new_table.add_string( NFTA_TABLE_NAME, name_ );
+    transaction.add( new_table, "create table " + name_ );
+
+    /* at the usual priorities of destination and source NAT */
+    add_chain( transaction, name_, "prerouting", NF_INET_PRE_ROUTING, -100, prerouting );
+    add_chain( transaction, name_, "postrouting", NF_INET_POST_ROUTING, 100, postrouting );
+
+    transaction.commit();
+}
+
+NATTable::~NATTable()
 {
     try {
-        TempRUIDRoot temp_root;
-        vector< string > command = { IPTABLES, "-w", "-t", "nat", "-D" };
-        command.insert( command.end(), arguments.begin(), arguments.end() );
-        run( command );
+        NFTablesTransaction transaction;
+
+        NetlinkMessage delete_table = NFTablesTransaction::message( NFT_MSG_DELTABLE, 0 );
+        delete_table.add_string( NFTA_TABLE_NAME, name_ );
+        transaction.add( delete_table, "delete table " + name_ );
+
+        transaction.commit();
     } catch ( const exception & e ) { /* don't throw from destructor */
         print_exception( e );
     }
 }
 
 NAT::NAT( const Address & ingress_addr )
-: pre_( { "PREROUTING", "-s", ingress_addr.ip(), "-j", "CONNMARK",
-            "--set-mark", to_string( getpid() ) } ),
-  post_( { "POSTROUTING", "-j", "MASQUERADE", "-m", "connmark",
-              "--mark", to_string( getpid() ) } )
+    : table_( { [&] ( NetlinkMessage & rule ) { /* ip saddr ingress ct mark set pid */
+                    load_ip_header( rule, offsetof( iphdr, saddr ), 4 );
+                    require_equal( rule, ipv4_bytes( ingress_addr ) );
+                    load_immediate( rule, NFT_REG_1, bytes( uint32_t( getpid() ) ) );
+                    store_connection_mark( rule );
+                } },
+              { [] ( NetlinkMessage & rule ) { /* ct mark pid masquerade */
+                      load_connection_mark( rule );
+                      require_equal( rule, bytes( uint32_t( getpid() ) ) );
+                      begin_expression( rule, "masq" );
+                      end_expression( rule );
+                  } } )
 {}
 
 DNAT::DNAT( const Address & listener, const string & interface )
-    : rule_( { "PREROUTING", "-p", "TCP", "-i", interface, "-j", "DNAT",
-                "--to-destination", listener.str() } )
+    : table_( { [&] ( NetlinkMessage & rule ) { /* meta l4proto tcp iifname interface dnat listener */
+                    load_meta( rule, NFT_META_L4PROTO );
+                    require_equal( rule, bytes( uint8_t( IPPROTO_TCP ) ) );
+
+                    char name[ IFNAMSIZ ] = {};
+                    interface.copy( name, IFNAMSIZ - 1 );
+                    load_meta( rule, NFT_META_IIFNAME );
+                    require_equal( rule, bytes( name ) );
+
+                    load_immediate( rule, NFT_REG_1, ipv4_bytes( listener ) );
+                    load_immediate( rule, NFT_REG_2, bytes( htons( listener.port() ) ) );
+
+                    begin_expression( rule, "nat" );
+                    rule.add_be32( NFTA_NAT_TYPE, NFT_NAT_DNAT );
+                    rule.add_be32( NFTA_NAT_FAMILY, NFPROTO_IPV4 );
+                    rule.add_be32( NFTA_NAT_REG_ADDR_MIN, NFT_REG_1 );
+                    rule.add_be32( NFTA_NAT_REG_PROTO_MIN, NFT_REG_2 );
+                    end_expression( rule );
+                } },
+              {} )
 {}
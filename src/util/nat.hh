@@ -6,41 +6,53 @@
 /* Network Address Translator */
 
 #include <string>
+#include <vector>
+#include <functional>
 
-#include "system_runner.hh"
 #include "address.hh"
 
-/* RAII class to make connections coming from the ingress address
-   look like they're coming from the output device's address.
+class NetlinkMessage;
 
-   We mark the connections on entry from the ingress address (with our PID),
-   and then look for the mark on output. */
+/* an nftables rule, as a function that adds its expressions to a rule message */
+typedef std::function<void( NetlinkMessage & )> NATRule;
+
+/* RAII class for an nftables table of our own (in the ip family), with
+   NAT chains at prerouting and postrouting holding the given rules.
+   Deleting the table deletes its rules, whatever else is in nftables. */
 
-class NATRule {
+class NATTable {
 private:
-    std::vector< std::string > arguments;
+    std::string name_;
 
 public:
-    NATRule( const std::vector< std::string > & s_args );
-    ~NATRule();
+    NATTable( const std::vector< NATRule > & prerouting, const std::vector< NATRule > & postrouting );
+    ~NATTable();
 
-    NATRule( const NATRule & other ) = delete;
-    const NATRule & operator=( const NATRule & other ) = delete;
+    NATTable( const NATTable & other ) = delete;
+    const NATTable & operator=( const NATTable & other ) = delete;
 };
 
+/* RAII class to make connections coming from the ingress address
+   look like they're coming from the output device's address.
+
+   We mark the connections on entry from the ingress address (with our PID),
+   and then look for the mark on output. */
+
 class NAT
 {
 private:
-    NATRule pre_, post_;
+    NATTable table_;
 
 public:
     NAT( const Address & ingress_addr );
 };
 
+/* RAII class to redirect TCP connections arriving on an interface to a listener */
+
 class DNAT
 {
 private:
-    NATRule rule_;
+    NATTable table_;
 
 public:
     DNAT( const Address & listener, const std::string & interface );
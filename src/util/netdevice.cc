@@ -13,8 +13,7 @@
 #include "ezio.hh"
 #include "socket.hh"
 #include "util.hh"
-#include "system_runner.hh"
-#include "config.h"
+#include "netlink.hh"
 
 using namespace std;
 
@@ -53,24 +52,13 @@ void interface_ioctl( const unsigned long request,
 
 void assign_address( const string & device_name, const Address & addr, const Address & peer )
 {
-    /* assign address */
-    interface_ioctl( SIOCSIFADDR, device_name,
-                     [&] ( ifreq &ifr )
-                     { ifr.ifr_addr = addr.to_sockaddr(); } );
-
-    /* destination */
-    interface_ioctl( SIOCSIFDSTADDR, device_name,
-                     [&] ( ifreq &ifr )
-                     { ifr.ifr_addr = peer.to_sockaddr(); } );
-
-    /* netmask */
-    interface_ioctl( SIOCSIFNETMASK, device_name,
-                     [&] ( ifreq &ifr )
-                     { ifr.ifr_netmask = Address( "255.255.255.255", 0 ).to_sockaddr(); } );
-
-    /* bring interface up */
-    interface_ioctl( SIOCSIFFLAGS, device_name,
-                     [] ( ifreq &ifr ) { ifr.ifr_flags = IFF_UP; } );
+    RTNetlink rtnetlink;
+
+    /* assign address and destination, and bring interface up */
+    rtnetlink.add_address( device_name, addr, peer );
+    rtnetlink.set_link_up( device_name );
+
+    rtnetlink.commit();
 }
 
 void name_check( const string & str )
@@ -88,7 +76,9 @@ VirtualEthernetPair::VirtualEthernetPair( const string & outside_name, const str
     name_check( outside_name );
     name_check( inside_name );
 
-    run( { IP, "link", "add", outside_name, "type", "veth", "peer", "name", inside_name } );
+    RTNetlink rtnetlink;
+    rtnetlink.add_veth_pair( outside_name, inside_name );
+    rtnetlink.commit();
 }
 
 VirtualEthernetPair::~VirtualEthernetPair()
@@ -98,7 +88,9 @@ VirtualEthernetPair::~VirtualEthernetPair()
     }
 
     try {
-        run( { IP, "link", "del", name_ } );
+        RTNetlink rtnetlink;
+        rtnetlink.delete_link( name_ );
+        rtnetlink.commit();
     } catch ( const std::exception & e ) {
         print_exception( e );
     }
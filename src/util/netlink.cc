@@ -0,0 +1,406 @@
+/* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
+#include <linux/veth.h>
+#include <net/if.h>
+
+#include "netlink.hh"
+#include "exception.hh"
+#include "util.hh"
+
+using namespace std;
+
+NetlinkMessage::NetlinkMessage( const uint16_t type, const uint16_t flags )
+    : data_( NLMSG_HDRLEN, 0 )
+{
+    header().nlmsg_len = data_.size();
+    header().nlmsg_type = type;
+    header().nlmsg_flags = flags;
+}
+
+void NetlinkMessage::add_bytes( const string & bytes )
+{
+    data_.append( bytes );
+    data_.resize( NLMSG_ALIGN( data_.size() ), 0 );
+    header().nlmsg_len = data_.size();
+}
+
+void NetlinkMessage::add_attribute( const uint16_t type, const string & payload )
+{
+    nlattr attribute;
+    attribute.nla_len = NLA_HDRLEN + payload.size();
+    attribute.nla_type = type;
+
+    add_bytes( string( reinterpret_cast<const char *>( &attribute ), sizeof( attribute ) ) + payload );
+}
+
+void NetlinkMessage::add_string( const uint16_t type, const string & str )
+{
+    add_attribute( type, string( str.c_str(), str.size() + 1 ) );
+}
+
+void NetlinkMessage::add_u32( const uint16_t type, const uint32_t value )
+{
+    add_attribute( type, string( reinterpret_cast<const char *>( &value ), sizeof( value ) ) );
+}
+
+void NetlinkMessage::add_be32( const uint16_t type, const uint32_t value )
+{
+    add_u32( type, htonl( value ) );
+}
+
+void NetlinkMessage::begin_nested( const uint16_t type )
+{
+    nests_.push_back( data_.size() );
+    add_attribute( type, string() );
+}
+
+void NetlinkMessage::end_nested( void )
+{
+    if ( nests_.empty() ) {
+        throw runtime_error( "NetlinkMessage: end_nested without begin_nested" );
+    }
+
+    nlattr & attribute = *reinterpret_cast<nlattr *>( &data_[ nests_.back() ] );
+    attribute.nla_len = data_.size() - nests_.back();
+    nests_.pop_back();
+}
+
+NetlinkSocket::NetlinkSocket( const int protocol )
+    : FileDescriptor( SystemCall( "socket", socket( AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, protocol ) ) )
+{
+    /* ask for acknowledgments without a copy of the request, and with
+       the kernel's explanation of any error (older kernels do without) */
+    const int on = 1;
+    setsockopt( fd_num(), SOL_NETLINK, NETLINK_CAP_ACK, &on, sizeof( on ) );
+    setsockopt( fd_num(), SOL_NETLINK, NETLINK_EXT_ACK, &on, sizeof( on ) );
+
+    sockaddr_nl kernel;
+    zero( kernel );
+    kernel.nl_family = AF_NETLINK;
+
+    SystemCall( "connect", connect( fd_num(), reinterpret_cast<const sockaddr *>( &kernel ), sizeof( kernel ) ) );
+}
+
+void NetlinkSocket::queue( NetlinkMessage & message, const string & description, const bool acknowledge )
+{
+    nlmsghdr & header = message.header();
+    header.nlmsg_flags |= NLM_F_REQUEST | ( acknowledge ? NLM_F_ACK : 0 );
+    header.nlmsg_seq = next_sequence_number_++;
+
+    if ( acknowledge ) {
+        unacknowledged_.emplace( header.nlmsg_seq, description );
+    }
+
+    batch_.append( message.str() );
+}
+
+void NetlinkSocket::commit( void )
+{
+    if ( batch_.empty() ) {
+        return;
+    }
+
+    write( batch_ );
+    batch_.clear();
+
+    read_responses( [] ( const nlmsghdr & ) {} );
+}
+
+void NetlinkSocket::dump( NetlinkMessage & request, const string & description,
+                          const function<void( const nlmsghdr & )> & handle_message )
+{
+    commit();
+
+    request.header().nlmsg_flags |= NLM_F_DUMP;
+    queue( request, description, false );
+    unacknowledged_.emplace( request.header().nlmsg_seq, description ); /* until NLMSG_DONE */
+
+    write( batch_ );
+    batch_.clear();
+
+    read_responses( handle_message );
+}
+
+/* the kernel's explanation of an error, if it gave one */
+static string extended_ack_message( const nlmsghdr & header, const nlmsgerr & error )
+{
+    if ( not ( header.nlmsg_flags & NLM_F_ACK_TLVS ) ) {
+        return string();
+    }
+
+    /* the TLVs follow the request (or just its header, if capped) */
+    const size_t offset = NLMSG_HDRLEN + sizeof( nlmsgerr )
+        + ( ( header.nlmsg_flags & NLM_F_CAPPED ) ? 0 : error.msg.nlmsg_len - NLMSG_HDRLEN );
+
+    const char * const base = reinterpret_cast<const char *>( &header );
+
+    size_t pos = NLMSG_ALIGN( offset );
+    while ( pos + NLA_HDRLEN <= header.nlmsg_len ) {
+        const nlattr & attribute = *reinterpret_cast<const nlattr *>( base + pos );
+        if ( attribute.nla_len < NLA_HDRLEN or pos + attribute.nla_len > header.nlmsg_len ) {
+            break;
+        }
+
+        if ( attribute.nla_type == NLMSGERR_ATTR_MSG ) {
+            const string message( base + pos + NLA_HDRLEN, attribute.nla_len - NLA_HDRLEN );
+            return message.substr( 0, message.find( '\0' ) );
+        }
+
+        pos += NLA_ALIGN( attribute.nla_len );
+    }
+
+    return string();
+}
+
+void NetlinkSocket::read_responses( const function<void( const nlmsghdr & )> & handle_message )
+{
+    while ( not unacknowledged_.empty() ) {
+        const string datagram = read();
+        if ( eof() ) {
+            throw runtime_error( "netlink: socket closed" );
+        }
+
+        int length = datagram.size();
+        for ( const nlmsghdr * header = reinterpret_cast<const nlmsghdr *>( datagram.data() );
+              NLMSG_OK( header, length );
+              header = NLMSG_NEXT( header, length ) ) {
+            const auto request = unacknowledged_.find( header->nlmsg_seq );
+            if ( request == unacknowledged_.end() ) {
+                continue; /* left over from a batch that failed */
+            }
+
+            if ( header->nlmsg_type == NLMSG_DONE ) {
+                /* (which may carry an error that cut the dump short) */
+                const int * const error = reinterpret_cast<const int *>( NLMSG_DATA( header ) );
+                if ( header->nlmsg_len >= NLMSG_LENGTH( sizeof( int ) ) and *error < 0 ) {
+                    const string description = request->second;
+                    unacknowledged_.clear();
+                    throw unix_error( "netlink " + description, -*error );
+                }
+
+                unacknowledged_.erase( request );
+            } else if ( header->nlmsg_type == NLMSG_ERROR ) {
+                const nlmsgerr & error = *reinterpret_cast<const nlmsgerr *>( NLMSG_DATA( header ) );
+                if ( error.error == 0 ) {
+                    unacknowledged_.erase( request );
+                    continue;
+                }
+
+                /* give up on the rest of the batch */
+                const string description = request->second;
+                unacknowledged_.clear();
+
+                const string explanation = extended_ack_message( *header, error );
+                throw unix_error( "netlink " + description
+                                  + ( explanation.empty() ? "" : " (" + explanation + ")" ),
+                                  -error.error );
+            } else {
+                handle_message( *header );
+            }
+        }
+    }
+}
+
+unordered_map< uint16_t, string > NetlinkSocket::attributes( const nlmsghdr & message,
+                                                             const size_t header_size )
+{
+    unordered_map< uint16_t, string > ret;
+
+    const char * const base = reinterpret_cast<const char *>( &message );
+    size_t pos = NLMSG_HDRLEN + NLMSG_ALIGN( header_size );
+
+    while ( pos + NLA_HDRLEN <= message.nlmsg_len ) {
+        const nlattr & attribute = *reinterpret_cast<const nlattr *>( base + pos );
+        if ( attribute.nla_len < NLA_HDRLEN or pos + attribute.nla_len > message.nlmsg_len ) {
+            break;
+        }
+
+        ret[ attribute.nla_type & NLA_TYPE_MASK ] = string( base + pos + NLA_HDRLEN,
+                                                            attribute.nla_len - NLA_HDRLEN );
+        pos += NLA_ALIGN( attribute.nla_len );
+    }
+
+    return ret;
+}
+
+/* an address's bytes, in network order, and its family */
+static string address_bytes( const Address & address, uint8_t & family )
+{
+    const sockaddr & addr = address.to_sockaddr();
+    family = addr.sa_family;
+
+    switch ( family ) {
+    case AF_INET: {
+        const in_addr & ip = reinterpret_cast<const sockaddr_in &>( addr ).sin_addr;
+        return string( reinterpret_cast<const char *>( &ip ), sizeof( ip ) );
+    }
+    case AF_INET6: {
+        const in6_addr & ip = reinterpret_cast<const sockaddr_in6 &>( addr ).sin6_addr;
+        return string( reinterpret_cast<const char *>( &ip ), sizeof( ip ) );
+    }
+    default:
+        throw runtime_error( "netlink: unsupported address family" );
+    }
+}
+
+static ifinfomsg link_header( const unsigned int flags = 0 )
+{
+    ifinfomsg ret;
+    zero( ret );
+    ret.ifi_family = AF_UNSPEC;
+    ret.ifi_flags = ret.ifi_change = flags;
+    return ret;
+}
+
+RTNetlink::RTNetlink()
+    : NetlinkSocket( NETLINK_ROUTE )
+{}
+
+void RTNetlink::new_link( const string & name, const string & kind, const string & peer_name )
+{
+    NetlinkMessage message( RTM_NEWLINK, NLM_F_CREATE | NLM_F_EXCL );
+    message.add_header( link_header( IFF_UP ) );
+    message.add_string( IFLA_IFNAME, name );
+
+    message.begin_nested( IFLA_LINKINFO );
+    message.add_string( IFLA_INFO_KIND, kind );
+
+    if ( not peer_name.empty() ) {
+        message.begin_nested( IFLA_INFO_DATA );
+        message.begin_nested( VETH_INFO_PEER );
+        message.add_header( link_header() );
+        message.add_string( IFLA_IFNAME, peer_name );
+        message.end_nested();
+        message.end_nested();
+    }
+
+    message.end_nested();
+
+    queue( message, "create " + kind + " " + name );
+}
+
+void RTNetlink::add_dummy_link( const string & name )
+{
+    new_link( name, "dummy", "" );
+}
+
+void RTNetlink::add_veth_pair( const string & name, const string & peer_name )
+{
+    new_link( name, "veth", peer_name );
+}
+
+void RTNetlink::delete_link( const string & name )
+{
+    NetlinkMessage message( RTM_DELLINK, 0 );
+    message.add_header( link_header() );
+    message.add_string( IFLA_IFNAME, name );
+
+    queue( message, "delete " + name );
+    link_indices_.erase( name );
+}
+
+void RTNetlink::set_link_up( const string & name )
+{
+    NetlinkMessage message( RTM_NEWLINK, 0 );
+    message.add_header( link_header( IFF_UP ) );
+    message.add_string( IFLA_IFNAME, name );
+
+    queue( message, "bring up " + name );
+}
+
+void RTNetlink::move_link_to_namespace( const string & name, const pid_t pid )
+{
+    NetlinkMessage message( RTM_NEWLINK, 0 );
+    message.add_header( link_header() );
+    message.add_string( IFLA_IFNAME, name );
+    message.add_u32( IFLA_NET_NS_PID, pid );
+
+    queue( message, "move " + name + " to network namespace of " + to_string( pid ) );
+    link_indices_.erase( name );
+}
+
+void RTNetlink::add_address( const string & name, const Address & local, const Address & peer )
+{
+    uint8_t family, peer_family;
+    const string local_bytes = address_bytes( local, family );
+    const string peer_bytes = address_bytes( peer, peer_family );
+
+    if ( family != peer_family ) {
+        throw runtime_error( "netlink: " + local.ip() + " and " + peer.ip() + " are of different families" );
+    }
+
+    ifaddrmsg header;
+    zero( header );
+    header.ifa_family = family;
+    header.ifa_prefixlen = local_bytes.size() * 8;
+    header.ifa_scope = RT_SCOPE_UNIVERSE;
+    header.ifa_index = link_index( name );
+
+    NetlinkMessage message( RTM_NEWADDR, NLM_F_CREATE | NLM_F_EXCL );
+    message.add_header( header );
+    message.add_attribute( IFA_LOCAL, local_bytes );
+    message.add_attribute( IFA_ADDRESS, peer_bytes );
+
+    queue( message, "add address " + local.ip() + " to " + name );
+}
+
+void RTNetlink::add_default_route( const Address & gateway )
+{
+    uint8_t family;
+    const string gateway_bytes = address_bytes( gateway, family );
+
+    rtmsg header;
+    zero( header );
+    header.rtm_family = family;
+    header.rtm_table = RT_TABLE_MAIN;
+    header.rtm_protocol = RTPROT_BOOT;
+    header.rtm_scope = RT_SCOPE_UNIVERSE;
+    header.rtm_type = RTN_UNICAST;
+
+    NetlinkMessage message( RTM_NEWROUTE, NLM_F_CREATE | NLM_F_EXCL );
+    message.add_header( header );
+    message.add_attribute( RTA_GATEWAY, gateway_bytes );
+
+    queue( message, "add default route via " + gateway.ip() );
+}
+
+int RTNetlink::link_index( const string & name )
+{
+    commit();
+
+    auto it = link_indices_.find( name );
+    if ( it != link_indices_.end() ) {
+        return it->second;
+    }
+
+    /* learn every link's index at once, since a caller
+       that wants one usually wants several */
+    link_indices_.clear();
+
+    NetlinkMessage request( RTM_GETLINK, 0 );
+    request.add_header( link_header() );
+
+    dump( request, "list links", [&] ( const nlmsghdr & message ) {
+            if ( message.nlmsg_type != RTM_NEWLINK ) {
+                return;
+            }
+
+            const ifinfomsg & link = *reinterpret_cast<const ifinfomsg *>( NLMSG_DATA( &message ) );
+            const auto link_attributes = attributes( message, sizeof( ifinfomsg ) );
+            const auto ifname = link_attributes.find( IFLA_IFNAME );
+            if ( ifname != link_attributes.end() ) {
+                link_indices_[ ifname->second.c_str() ] = link.ifi_index;
+            }
+        } );
+
+    it = link_indices_.find( name );
+    if ( it == link_indices_.end() ) {
+        throw runtime_error( "netlink: no network interface named " + name );
+    }
+
+    return it->second;
+}
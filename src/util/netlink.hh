@@ -0,0 +1,116 @@
+/* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef NETLINK_HH
+#define NETLINK_HH
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <cstdint>
+
+#include <sys/types.h>
+#include <linux/netlink.h>
+
+#include "file_descriptor.hh"
+#include "address.hh"
+
+/* a netlink message under construction: a header, a fixed-size family
+   header, and (possibly nested) attributes */
+class NetlinkMessage
+{
+private:
+    std::string data_;
+    std::vector< size_t > nests_ {}; /* offsets of the open nested attributes */
+
+public:
+    NetlinkMessage( const uint16_t type, const uint16_t flags );
+
+    /* the family header (ifinfomsg, ifaddrmsg, ...) that follows the nlmsghdr */
+    template <class T>
+    void add_header( const T & header )
+    {
+        add_bytes( std::string( reinterpret_cast<const char *>( &header ), sizeof( header ) ) );
+    }
+
+    void add_attribute( const uint16_t type, const std::string & payload );
+    void add_string( const uint16_t type, const std::string & str ); /* null-terminated */
+    void add_u32( const uint16_t type, const uint32_t value ); /* host order */
+    void add_be32( const uint16_t type, const uint32_t value ); /* network order */
+
+    /* attributes added between these go inside a nested attribute */
+    void begin_nested( const uint16_t type );
+    void end_nested( void );
+
+    void add_bytes( const std::string & bytes ); /* padded to alignment */
+
+    nlmsghdr & header( void ) { return *reinterpret_cast<nlmsghdr *>( &data_[ 0 ] ); }
+    const std::string & str( void ) const { return data_; }
+};
+
+/* a netlink socket to the kernel that sends requests in batches, one
+   send per batch, and checks the acknowledgment of each request */
+class NetlinkSocket : public FileDescriptor
+{
+private:
+    std::string batch_ {};
+    uint32_t next_sequence_number_ { 1 };
+    std::unordered_map< uint32_t, std::string > unacknowledged_ {}; /* by sequence number */
+
+    /* act on each response to our requests; throws on an error */
+    void read_responses( const std::function<void( const nlmsghdr & )> & handle_message );
+
+protected:
+    /* add a message to the batch, with NLM_F_REQUEST (and NLM_F_ACK if
+       acknowledge is set); description names it in any error */
+    void queue( NetlinkMessage & message, const std::string & description, const bool acknowledge = true );
+
+    /* commit, then send a dump request and pass each message of the reply to handle_message */
+    void dump( NetlinkMessage & request, const std::string & description,
+               const std::function<void( const nlmsghdr & )> & handle_message );
+
+    /* attributes of a message, after its family header */
+    static std::unordered_map< uint16_t, std::string > attributes( const nlmsghdr & message,
+                                                                   const size_t header_size );
+
+public:
+    NetlinkSocket( const int protocol );
+
+    /* send the batch and wait for every request in it to be acknowledged
+       (throws if any failed) */
+    void commit( void );
+};
+
+/* rtnetlink: network links, addresses and routes */
+class RTNetlink : public NetlinkSocket
+{
+private:
+    std::unordered_map< std::string, int > link_indices_ {};
+
+    void new_link( const std::string & name, const std::string & kind, const std::string & peer_name );
+
+public:
+    RTNetlink();
+
+    /* create links, already up (in a batch, like the rest) */
+    void add_dummy_link( const std::string & name );
+    void add_veth_pair( const std::string & name, const std::string & peer_name );
+
+    /* deleting one of a veth pair deletes both */
+    void delete_link( const std::string & name );
+
+    void set_link_up( const std::string & name );
+    void move_link_to_namespace( const std::string & name, const pid_t pid );
+
+    /* a /32 (or /128) address, and the peer at the other end of a
+       point-to-point link if peer differs from local */
+    void add_address( const std::string & name, const Address & local, const Address & peer );
+
+    void add_default_route( const Address & gateway );
+
+    /* interface index of a link (commits the batch first, in case
+       it creates the link) */
+    int link_index( const std::string & name );
+};
+
+#endif /* NETLINK_HH */
@@ -4,6 +4,7 @@
 #include <numeric>
 #include "poller.hh"
 #include "exception.hh"
+#include "timestamp.hh"
 
 using namespace std;
 using namespace PollerShortNames;
@@ -42,7 +43,12 @@ Poller::Result Poller::poll( const int & timeout_ms )
         return Result::Type::Exit;
     }
 
-    if ( 0 == SystemCall( "poll", ::poll( &pollfds_[ 0 ], pollfds_.size(), timeout_ms ) ) ) {
+    const int ready = SystemCall( "poll", ::poll( &pollfds_[ 0 ], pollfds_.size(), timeout_ms ) );
+
+    /* the time this wakeup's callbacks see */
+    LoopClock::tick();
+
+    if ( ready == 0 ) {
         return Result::Type::Timeout;
     }
 
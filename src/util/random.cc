@@ -0,0 +1,124 @@
+/* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <map>
+#include <random>
+#include <cstdlib>
+#include <stdexcept>
+
+#include "random.hh"
+#include "exception.hh"
+
+using namespace std;
+
+namespace {
+    struct State
+    {
+        bool initialized = false;
+        bool passed_on = false; /* (only by shells that read MAHIMAHI_SEED) */
+        uint64_t seed = 0;
+        unsigned int layer = 1;
+        string role {};
+        map<string, unsigned int> streams {};
+    };
+
+    State & state( void )
+    {
+        static State the_state;
+        if ( not the_state.initialized ) {
+            the_state.initialized = true;
+            random_device device;
+            the_state.seed = ( uint64_t( device() ) << 32 ) | device();
+        }
+        return the_state;
+    }
+
+    /* (the finalizer of splitmix64) */
+    uint64_t mix( uint64_t x )
+    {
+        x += 0x9e3779b97f4a7c15;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+        return x ^ (x >> 31);
+    }
+
+    /* (FNV-1a) */
+    uint64_t fnv_hash( const string & str )
+    {
+        uint64_t ret = 0xcbf29ce484222325;
+        for ( const unsigned char c : str ) {
+            ret = (ret ^ c) * 0x100000001b3;
+        }
+        return ret;
+    }
+
+    uint64_t parse_seed( const string & str )
+    {
+        size_t end = 0;
+        uint64_t ret = 0;
+        try {
+            ret = stoull( str, &end );
+        } catch ( const exception & ) {
+            end = 0;
+        }
+        if ( str.empty() or end != str.size() or str.front() == '-' ) {
+            throw runtime_error( "invalid seed: " + str + " (need a number from 0 to 2^64 - 1)" );
+        }
+        return ret;
+    }
+}
+
+void Random::initialize( void )
+{
+    State & s = state();
+    s.passed_on = true;
+
+    const char * const seed = getenv( "MAHIMAHI_SEED" );
+    if ( seed and *seed ) {
+        s.seed = parse_seed( seed );
+    }
+
+    const char * const layer = getenv( "MAHIMAHI_SEED_LAYER" );
+    if ( layer ) {
+        s.layer = max( 1, atoi( layer ) + 1 );
+    }
+}
+
+void Random::set_seed( const string & seed )
+{
+    State & s = state();
+    s.seed = parse_seed( seed );
+    s.passed_on = true;
+}
+
+uint64_t Random::seed( void )
+{
+    return state().seed;
+}
+
+void Random::forked( const string & role )
+{
+    state().role = role;
+}
+
+Xoshiro256 Random::stream( const string & name )
+{
+    State & s = state();
+
+    uint64_t key = mix( s.seed );
+    key = mix( key ^ s.layer );
+    key = mix( key ^ fnv_hash( s.role + "/" + name ) );
+    key = mix( key ^ s.streams[ name ]++ );
+
+    return Xoshiro256( key );
+}
+
+void Random::export_seed( void )
+{
+    const State & s = state();
+    if ( not s.passed_on ) {
+        return;
+    }
+
+    SystemCall( "setenv", setenv( "MAHIMAHI_SEED", to_string( s.seed ).c_str(), true ) );
+    SystemCall( "setenv", setenv( "MAHIMAHI_SEED_LAYER", to_string( s.layer ).c_str(), true ) );
+}
@@ -0,0 +1,40 @@
+/* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef RANDOM_HH
+#define RANDOM_HH
+
+#include <string>
+#include <cstdint>
+
+#include "xoshiro.hh"
+
+/* Every random choice the emulators make (losses, jitter, on/off times,
+   AQM drops...) follows from one seed, so a run can be repeated exactly.
+
+   A shell takes the seed from its --seed option or from MAHIMAHI_SEED,
+   or else makes one up; either way it passes the seed on (in
+   MAHIMAHI_SEED) to the command it runs, and so to shells nested in it.
+   Each random component draws from a stream of its own, derived from the
+   seed, the shell's layer of nesting, the direction, the component's name
+   and how many streams of that name came before it. */
+
+namespace Random {
+    /* read MAHIMAHI_SEED (so call before clearing the environment) */
+    void initialize( void );
+
+    /* a seed given on the command line (a number from 0 to 2^64 - 1) */
+    void set_seed( const std::string & seed );
+
+    uint64_t seed( void );
+
+    /* name the direction a forked process emulates ("uplink", "downlink") */
+    void forked( const std::string & role );
+
+    /* a generator for one component ("loss", "jitter", "pie"...) */
+    Xoshiro256 stream( const std::string & name );
+
+    /* tell shells started hereafter the seed, and that they are nested in this one */
+    void export_seed( void );
+}
+
+#endif /* RANDOM_HH */
@@ -0,0 +1,261 @@
+/* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <vector>
+#include <sstream>
+#include <iomanip>
+#include <cstdlib>
+#include <ctime>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "setup_trace.hh"
+#include "file_descriptor.hh"
+#include "exception.hh"
+#include "util.hh"
+
+using namespace std;
+
+namespace {
+    struct TimedPhase
+    {
+        string name;
+        pid_t pid;
+        uint64_t begin_ns, end_ns;
+        bool written;
+    };
+
+    struct Trace
+    {
+        bool enabled = false;
+        string destination {};
+        string process_name {};
+        unsigned int layer = 1;
+        vector<TimedPhase> phases {};
+    };
+
+    Trace & trace( void )
+    {
+        static Trace the_trace;
+        return the_trace;
+    }
+
+    uint64_t monotonic_ns( void )
+    {
+        timespec ts;
+        SystemCall( "clock_gettime", clock_gettime( CLOCK_MONOTONIC, &ts ) );
+        return uint64_t( ts.tv_sec ) * 1000000000 + ts.tv_nsec;
+    }
+
+    bool ends_with( const string & str, const string & suffix )
+    {
+        return str.size() >= suffix.size()
+            and str.compare( str.size() - suffix.size(), suffix.size(), suffix ) == 0;
+    }
+
+    string json_string( const string & str )
+    {
+        string ret = "\"";
+        for ( const char c : str ) {
+            if ( c == '"' or c == '\\' ) {
+                ret.push_back( '\\' );
+            }
+            ret.push_back( ( c >= 0 and c < ' ' ) ? ' ' : c );
+        }
+        return ret + "\"";
+    }
+
+    string chrome_trace_events( const vector<TimedPhase> & phases )
+    {
+        const Trace & t = trace();
+        const string pid = to_string( getpid() );
+
+        ostringstream out;
+        out << fixed << setprecision( 3 );
+
+        out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << pid
+            << ",\"args\":{\"name\":" << json_string( t.process_name + " (layer " + to_string( t.layer ) + ")" ) << "}},\n";
+        out << "{\"name\":\"process_sort_index\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << pid
+            << ",\"args\":{\"sort_index\":" << t.layer << "}},\n";
+
+        for ( const auto & phase : phases ) {
+            out << "{\"name\":" << json_string( phase.name ) << ",\"cat\":\"setup\",\"ph\":\"X\""
+                << ",\"ts\":" << phase.begin_ns / 1000.0
+                << ",\"dur\":" << ( phase.end_ns - phase.begin_ns ) / 1000.0
+                << ",\"pid\":" << pid << ",\"tid\":" << pid
+                << ",\"args\":{\"layer\":" << t.layer << "}},\n";
+        }
+
+        return out.str();
+    }
+
+    string summary_table( const vector<TimedPhase> & phases )
+    {
+        const Trace & t = trace();
+
+        ostringstream out;
+        out << fixed << setprecision( 3 );
+        out << "setup of " << t.process_name << " (layer " << t.layer << ", pid " << getpid() << "):\n";
+        out << setw( 12 ) << "total ms" << setw( 12 ) << "self ms" << "  phase\n";
+
+        for ( const auto & phase : phases ) {
+            /* nested in the phases that contain it; its self time excludes
+               the time of the phases directly nested in it */
+            auto contains = [] ( const TimedPhase & outer, const TimedPhase & inner ) {
+                return &outer != &inner
+                    and outer.begin_ns <= inner.begin_ns and inner.end_ns <= outer.end_ns;
+            };
+
+            unsigned int depth = 0;
+            uint64_t nested_ns = 0;
+            for ( const auto & other : phases ) {
+                if ( contains( other, phase ) ) {
+                    depth++;
+                } else if ( contains( phase, other ) ) {
+                    bool direct = true;
+                    for ( const auto & between : phases ) {
+                        if ( contains( phase, between ) and contains( between, other ) ) {
+                            direct = false;
+                            break;
+                        }
+                    }
+                    if ( direct ) {
+                        nested_ns += other.end_ns - other.begin_ns;
+                    }
+                }
+            }
+
+            const uint64_t total_ns = phase.end_ns - phase.begin_ns;
+            out << setw( 12 ) << total_ns / 1000000.0
+                << setw( 12 ) << ( total_ns - min( nested_ns, total_ns ) ) / 1000000.0
+                << "  " << string( 2 * depth, ' ' ) << phase.name << "\n";
+        }
+
+        return out.str();
+    }
+
+    void flush_at_exit( void )
+    {
+        try {
+            SetupTrace::flush();
+        } catch ( const exception & e ) {
+            print_exception( e );
+        }
+    }
+}
+
+SetupTrace::Phase::Phase( const string & name )
+    : index_( -1 )
+{
+    next( name );
+}
+
+void SetupTrace::Phase::finish( void )
+{
+    if ( index_ < 0 ) {
+        return;
+    }
+
+    TimedPhase & phase = trace().phases.at( index_ );
+    index_ = -1;
+
+    /* (a phase begun before a fork belongs to the parent) */
+    if ( phase.pid == getpid() ) {
+        phase.end_ns = monotonic_ns();
+    }
+}
+
+void SetupTrace::Phase::next( const string & name )
+{
+    finish();
+
+    Trace & t = trace();
+    if ( t.enabled ) {
+        index_ = t.phases.size();
+        t.phases.push_back( TimedPhase { name, getpid(), monotonic_ns(), 0, false } );
+    }
+}
+
+void SetupTrace::enable( const string & program_name )
+{
+    const char * const destination = getenv( "MAHIMAHI_SETUP_TRACE" );
+    if ( not destination or not *destination ) {
+        return;
+    }
+
+    Trace & t = trace();
+    t.enabled = true;
+    t.destination = destination;
+    t.process_name = program_name;
+
+    const char * const layer = getenv( "MAHIMAHI_SETUP_TRACE_LAYER" );
+    if ( layer ) {
+        t.layer = max( 1, atoi( layer ) + 1 );
+    }
+
+    atexit( flush_at_exit );
+}
+
+bool SetupTrace::enabled( void )
+{
+    return trace().enabled;
+}
+
+void SetupTrace::forked( const string & role )
+{
+    Trace & t = trace();
+    if ( t.enabled ) {
+        t.process_name += " " + role;
+    }
+}
+
+void SetupTrace::export_layer( void )
+{
+    const Trace & t = trace();
+    if ( t.enabled ) {
+        SystemCall( "setenv", setenv( "MAHIMAHI_SETUP_TRACE", t.destination.c_str(), true ) );
+        SystemCall( "setenv", setenv( "MAHIMAHI_SETUP_TRACE_LAYER", to_string( t.layer ).c_str(), true ) );
+    }
+}
+
+void SetupTrace::flush( void )
+{
+    Trace & t = trace();
+    if ( not t.enabled ) {
+        return;
+    }
+
+    vector<TimedPhase> finished;
+    for ( auto & phase : t.phases ) {
+        if ( phase.pid == getpid() and phase.end_ns and not phase.written ) {
+            finished.push_back( phase );
+            phase.written = true;
+        }
+    }
+
+    if ( finished.empty() ) {
+        return;
+    }
+
+    const bool json = ends_with( t.destination, ".json" );
+    const string output = json ? chrome_trace_events( finished ) : summary_table( finished );
+
+    /* (the file is the user's) */
+    TemporarilyUnprivileged tu;
+
+    FileDescriptor fd( t.destination == "-"
+                       ? SystemCall( "dup", dup( STDERR_FILENO ) )
+                       : SystemCall( "open " + t.destination,
+                                     open( t.destination.c_str(),
+                                           O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0666 ) ) );
+
+    /* nested shells append to the same file, one process at a time */
+    SystemCall( "flock", flock( fd.fd_num(), LOCK_EX ) );
+
+    /* a trace is a JSON array; its closing bracket may be left off */
+    struct stat st;
+    SystemCall( "fstat", fstat( fd.fd_num(), &st ) );
+    fd.write( ( json and st.st_size == 0 ) ? "[\n" + output : output );
+}
@@ -0,0 +1,63 @@
+/* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef SETUP_TRACE_HH
+#define SETUP_TRACE_HH
+
+#include <string>
+#include <utility>
+
+/* Opt-in timing of the phases of a shell's setup (namespaces, devices,
+   NAT, servers, traces...), to find where startup time goes.
+
+   Setting MAHIMAHI_SETUP_TRACE=FILE enables it, in the shell and in any
+   shells nested inside it. Each process appends the phases it has timed
+   to FILE when it has finished setting up: as Chrome trace events (for
+   chrome://tracing or Perfetto) if FILE ends in ".json", and otherwise as
+   a table of total and self times ("-" for stderr). A phase timed while
+   another is in progress in the same process is nested within it, and
+   each process is labeled with its layer of nesting (1 is outermost). */
+
+namespace SetupTrace {
+    /* times a phase of setup, until finished or destroyed */
+    class Phase
+    {
+    private:
+        int index_;
+
+    public:
+        Phase( const std::string & name );
+        ~Phase() { finish(); }
+
+        void finish( void );
+
+        /* finish, and time the next phase */
+        void next( const std::string & name );
+
+        /* (passes value through, for use in member initializers) */
+        template <typename T>
+        T && next( const std::string & name, T && value )
+        {
+            next( name );
+            return std::forward<T>( value );
+        }
+
+        Phase( const Phase & other ) = delete;
+        Phase & operator=( const Phase & other ) = delete;
+    };
+
+    /* read MAHIMAHI_SETUP_TRACE (so call before clearing the environment) */
+    void enable( const std::string & program_name );
+
+    bool enabled( void );
+
+    /* name a forked process after its role ("container", "downlink"...) */
+    void forked( const std::string & role );
+
+    /* tell shells started hereafter that they are nested in this one */
+    void export_layer( void );
+
+    /* write out the phases this process has finished timing */
+    void flush( void );
+}
+
+#endif /* SETUP_TRACE_HH */
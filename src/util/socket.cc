@@ -75,6 +75,25 @@ void Socket::connect( const Address & address )
                                       address.size() ) );
 }
 
+/* begin connecting a non-blocking socket */
+void Socket::start_connect( const Address & address )
+{
+    if ( ::connect( fd_num(), &address.to_sockaddr(), address.size() ) < 0
+         and errno != EINPROGRESS ) {
+        throw unix_error( "connect" );
+    }
+}
+
+/* throw if a finished non-blocking connect failed */
+void Socket::check_connect( void ) const
+{
+    int error;
+    getsockopt( SOL_SOCKET, SO_ERROR, error );
+    if ( error ) {
+        throw unix_error( "connect", error );
+    }
+}
+
 /* send datagram to specified address */
 void UDPSocket::sendto( const Address & destination, const string & payload )
 {
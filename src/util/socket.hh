@@ -37,6 +37,13 @@ public:
     /* connect socket to a specified peer address */
     void connect( const Address & address );
 
+    /* begin connecting a non-blocking socket; the socket
+       becomes writable when the attempt has finished */
+    void start_connect( const Address & address );
+
+    /* throw if a finished non-blocking connect failed */
+    void check_connect( void ) const;
+
     /* accessors */
     Address local_address( void ) const;
     Address peer_address( void ) const;
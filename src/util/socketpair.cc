@@ -10,13 +10,66 @@
 
 using namespace std;
 
-pair<UnixDomainSocket, UnixDomainSocket> UnixDomainSocket::make_pair( void )
+pair<UnixDomainSocket, UnixDomainSocket> UnixDomainSocket::make_pair( const int type )
 {
     int pipe[ 2 ];
-    SystemCall( "socketpair", socketpair( AF_UNIX, SOCK_DGRAM, 0, pipe ) );
+    SystemCall( "socketpair", socketpair( AF_UNIX, type, 0, pipe ) );
     return ::make_pair( UnixDomainSocket( pipe[ 0 ] ), UnixDomainSocket( pipe[ 1 ] ) );
 }
 
+static sockaddr_un unix_address( const string & path )
+{
+    sockaddr_un address;
+    zero( address );
+    address.sun_family = AF_UNIX;
+
+    if ( path.empty() or path.size() >= sizeof( address.sun_path ) ) {
+        throw runtime_error( "invalid socket path: " + path );
+    }
+    path.copy( address.sun_path, path.size() );
+
+    return address;
+}
+
+UnixDomainSocket UnixDomainSocket::listen_at( const string & path )
+{
+    const sockaddr_un address = unix_address( path );
+    UnixDomainSocket ret( SystemCall( "socket", socket( AF_UNIX, SOCK_SEQPACKET, 0 ) ) );
+
+    SystemCall( "bind " + path, ::bind( ret.fd_num(),
+                                        reinterpret_cast<const sockaddr *>( &address ),
+                                        sizeof( address ) ) );
+    SystemCall( "listen", ::listen( ret.fd_num(), 16 ) );
+
+    return ret;
+}
+
+UnixDomainSocket UnixDomainSocket::connect_to( const string & path )
+{
+    const sockaddr_un address = unix_address( path );
+    UnixDomainSocket ret( SystemCall( "socket", socket( AF_UNIX, SOCK_SEQPACKET, 0 ) ) );
+
+    SystemCall( "connect " + path, ::connect( ret.fd_num(),
+                                              reinterpret_cast<const sockaddr *>( &address ),
+                                              sizeof( address ) ) );
+
+    return ret;
+}
+
+UnixDomainSocket UnixDomainSocket::accept( void )
+{
+    register_read();
+    return UnixDomainSocket( SystemCall( "accept", ::accept( fd_num(), nullptr, nullptr ) ) );
+}
+
+uid_t UnixDomainSocket::peer_uid( void ) const
+{
+    ucred credentials;
+    socklen_t size = sizeof( credentials );
+    SystemCall( "getsockopt SO_PEERCRED", getsockopt( fd_num(), SOL_SOCKET, SO_PEERCRED, &credentials, &size ) );
+    return credentials.uid;
+}
+
 void UnixDomainSocket::send_fd( FileDescriptor & fd )
 {
     msghdr message_header;
@@ -4,6 +4,10 @@
 #define SOCKETPAIR_HH
 
 #include <utility>
+#include <string>
+
+#include <sys/types.h>
+#include <sys/socket.h>
 
 #include "file_descriptor.hh"
 
@@ -13,10 +17,22 @@ private:
     UnixDomainSocket( const int s_fd ) : FileDescriptor( s_fd ) {}
 
 public:
+    /* take over a socket (e.g. one received with recv_fd) */
+    UnixDomainSocket( FileDescriptor && fd ) : FileDescriptor( std::move( fd ) ) {}
+
     void send_fd( FileDescriptor & fd );
     FileDescriptor recv_fd( void );
 
-    static std::pair<UnixDomainSocket, UnixDomainSocket> make_pair( void );
+    static std::pair<UnixDomainSocket, UnixDomainSocket> make_pair( const int type = SOCK_DGRAM );
+
+    /* connection-oriented sockets named by a path (SOCK_SEQPACKET,
+       so each write arrives as one read, as with the pairs) */
+    static UnixDomainSocket listen_at( const std::string & path );
+    static UnixDomainSocket connect_to( const std::string & path );
+    UnixDomainSocket accept( void );
+
+    /* user ID of the process at the other end */
+    uid_t peer_uid( void ) const;
 };
 
 #endif /* SOCKETPAIR_HH */
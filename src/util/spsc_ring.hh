@@ -0,0 +1,65 @@
+/* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef SPSC_RING_HH
+#define SPSC_RING_HH
+
+#include <vector>
+#include <atomic>
+#include <cassert>
+
+/* a fixed-size queue between one producer thread and one consumer thread,
+   which never blocks or allocates: the slots are constructed up front, and
+   each side fills or reads a slot in place before handing it over */
+template <class T>
+class SPSCRing
+{
+private:
+    std::vector<T> slots_;
+
+    /* counts of slots pushed and popped so far (each written by one side) */
+    std::atomic<size_t> pushed_ { 0 }, popped_ { 0 };
+
+public:
+    SPSCRing( const size_t size, const T & initial_value = T() )
+        : slots_( size, initial_value )
+    {
+        assert( size > 0 );
+    }
+
+    /* producer: the slot to fill next, or nullptr if the ring is full */
+    T * next_to_push( void )
+    {
+        const size_t pushed = pushed_.load( std::memory_order_relaxed );
+        if ( pushed - popped_.load( std::memory_order_acquire ) == slots_.size() ) {
+            return nullptr;
+        }
+        return &slots_[ pushed % slots_.size() ];
+    }
+
+    /* producer: hand the filled slot to the consumer */
+    void push( void )
+    {
+        pushed_.store( pushed_.load( std::memory_order_relaxed ) + 1, std::memory_order_release );
+    }
+
+    /* consumer: the oldest slot handed over, or nullptr if there is none */
+    const T * front( void ) const
+    {
+        const size_t popped = popped_.load( std::memory_order_relaxed );
+        if ( pushed_.load( std::memory_order_acquire ) == popped ) {
+            return nullptr;
+        }
+        return &slots_[ popped % slots_.size() ];
+    }
+
+    /* consumer: give the oldest slot back to the producer */
+    void pop( void )
+    {
+        popped_.store( popped_.load( std::memory_order_relaxed ) + 1, std::memory_order_release );
+    }
+
+    SPSCRing( const SPSCRing & other ) = delete;
+    SPSCRing & operator=( const SPSCRing & other ) = delete;
+};
+
+#endif /* SPSC_RING_HH */
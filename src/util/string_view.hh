@@ -0,0 +1,92 @@
+/* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef STRING_VIEW_HH
+#define STRING_VIEW_HH
+
+#include <string>
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+
+/* non-owning view of a run of characters (a stand-in for C++17's
+   std::string_view); it must not outlive the string it points into */
+class StringView
+{
+private:
+    const char * data_;
+    size_t size_;
+
+public:
+    static const size_t npos = std::string::npos;
+
+    StringView() : data_( nullptr ), size_( 0 ) {}
+    StringView( const char * data, const size_t size ) : data_( data ), size_( size ) {}
+    StringView( const std::string & str ) : data_( str.data() ), size_( str.size() ) {}
+    StringView( const char * str ) : data_( str ), size_( strlen( str ) ) {}
+
+    const char * data( void ) const { return data_; }
+    size_t size( void ) const { return size_; }
+    bool empty( void ) const { return size_ == 0; }
+
+    char operator[]( const size_t pos ) const { return data_[ pos ]; }
+
+    std::string str( void ) const { return std::string( data_, size_ ); }
+
+    StringView substr( const size_t pos, const size_t count = npos ) const
+    {
+        assert( pos <= size_ );
+        return StringView( data_ + pos, std::min( count, size_ - pos ) );
+    }
+
+    size_t find( const char c, const size_t pos = 0 ) const
+    {
+        if ( pos >= size_ ) {
+            return npos;
+        }
+
+        const void * found = memchr( data_ + pos, c, size_ - pos );
+        return found ? static_cast<const char *>( found ) - data_ : npos;
+    }
+
+    /* memchr (vectorized in libc) for the needle's first character, then compare the rest */
+    size_t find( const StringView & needle, size_t pos = 0 ) const
+    {
+        if ( needle.empty() ) {
+            return pos <= size_ ? pos : npos;
+        }
+
+        while ( ( pos = find( needle[ 0 ], pos ) ) != npos ) {
+            if ( size_ - pos < needle.size() ) {
+                return npos;
+            }
+
+            if ( memcmp( data_ + pos, needle.data(), needle.size() ) == 0 ) {
+                return pos;
+            }
+
+            pos++;
+        }
+
+        return npos;
+    }
+
+    size_t find_first_not_of( const char c, const size_t pos = 0 ) const
+    {
+        for ( size_t i = pos; i < size_; i++ ) {
+            if ( data_[ i ] != c ) {
+                return i;
+            }
+        }
+
+        return npos;
+    }
+
+    bool operator==( const StringView & other ) const
+    {
+        return size_ == other.size_ and memcmp( data_, other.data_, size_ ) == 0;
+    }
+
+    bool operator!=( const StringView & other ) const { return not operator==( other ); }
+};
+
+#endif /* STRING_VIEW_HH */
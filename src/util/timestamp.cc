@@ -5,15 +5,34 @@
 #include "timestamp.hh"
 #include "exception.hh"
 
-uint64_t raw_timestamp( void )
-{
-    timespec ts;
-    SystemCall( "clock_gettime", clock_gettime( CLOCK_REALTIME, &ts ) );
+namespace {
+    class SystemClock : public Clock
+    {
+    public:
+        uint64_t read( void ) override
+        {
+            timespec ts;
+            SystemCall( "clock_gettime", clock_gettime( CLOCK_REALTIME, &ts ) );
+
+            uint64_t millis = ts.tv_nsec / 1000000;
+            millis += uint64_t( ts.tv_sec ) * 1000;
 
-    uint64_t millis = ts.tv_nsec / 1000000;
-    millis += uint64_t( ts.tv_sec ) * 1000;
+            return millis;
+        }
+    };
 
-    return millis;
+    SystemClock system_clock;
+    Clock * current_clock = &system_clock;
+}
+
+void set_clock( Clock * const clock )
+{
+    current_clock = clock ? clock : &system_clock;
+}
+
+uint64_t raw_timestamp( void )
+{
+    return current_clock->read();
 }
 
 uint64_t initial_timestamp( void )
@@ -22,7 +41,22 @@ uint64_t initial_timestamp( void )
     return initial_value;
 }
 
-uint64_t timestamp( void )
+uint64_t fresh_timestamp( void )
 {
     return raw_timestamp() - initial_timestamp();
 }
+
+thread_local bool LoopClock::running_ = false;
+thread_local uint64_t LoopClock::now_ = 0;
+
+LoopClock::LoopClock()
+    : was_running_( running_ )
+{
+    running_ = true;
+    tick();
+}
+
+LoopClock::~LoopClock()
+{
+    running_ = was_running_;
+}
@@ -5,7 +5,73 @@
 
 #include <cstdint>
 
-uint64_t timestamp( void );
+/* where the time comes from: the system's real-time clock, unless it is
+   replaced (by a VirtualClock, say, to run in simulated time) */
+class Clock
+{
+public:
+    /* ms since some fixed point */
+    virtual uint64_t read( void ) = 0;
+
+    virtual ~Clock() {}
+};
+
+/* a clock that moves only when told to */
+class VirtualClock : public Clock
+{
+private:
+    uint64_t now_;
+
+public:
+    VirtualClock( const uint64_t start_ms = 0 ) : now_( start_ms ) {}
+
+    uint64_t read( void ) override { return now_; }
+
+    void advance( const uint64_t ms ) { now_ += ms; }
+};
+
+/* replace the clock (which the caller keeps alive) or, with nullptr, go
+   back to the system's; the first timestamp fixes the start, so swap
+   clocks before taking any */
+void set_clock( Clock * const clock );
+
+/* ms since the first timestamp, read from the clock now */
+uint64_t fresh_timestamp( void );
+
 uint64_t initial_timestamp( void );
 
+/* While a LoopClock exists, the thread's event loop samples the clock
+   once each time it wakes up (and before it works out how long to
+   sleep), and timestamp() returns that sample, so every stage that runs
+   on a wakeup sees the same time without reading the clock again. */
+class LoopClock
+{
+private:
+    static thread_local bool running_;
+    static thread_local uint64_t now_;
+
+    bool was_running_;
+
+public:
+    LoopClock();
+    ~LoopClock();
+
+    /* take a new sample (if a LoopClock is running) */
+    static void tick( void ) { if ( running_ ) { now_ = fresh_timestamp(); } }
+
+    static bool running( void ) { return running_; }
+    static uint64_t now( void ) { return now_; }
+
+    /* forbid copying */
+    LoopClock( const LoopClock & other ) = delete;
+    LoopClock & operator=( const LoopClock & other ) = delete;
+};
+
+/* ms since the first timestamp: as of the event loop's last sample, or
+   read from the clock outside an event loop (and in other threads) */
+inline uint64_t timestamp( void )
+{
+    return LoopClock::running() ? LoopClock::now() : fresh_timestamp();
+}
+
 #endif /* TIMESTAMP_HH */
@@ -0,0 +1,72 @@
+/* -*-mode:c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef XOSHIRO_HH
+#define XOSHIRO_HH
+
+#include <cstdint>
+#include <limits>
+
+/* xoshiro256** (Blackman and Vigna, 2018): a small, fast generator of
+   64-bit random numbers, reproducible from a 64-bit seed (expanded into
+   its state with splitmix64). Usable with the <random> distributions. */
+class Xoshiro256
+{
+private:
+    uint64_t s_[ 4 ];
+
+    static uint64_t rotl( const uint64_t x, const int k ) { return (x << k) | (x >> (64 - k)); }
+
+public:
+    typedef uint64_t result_type;
+
+    explicit Xoshiro256( uint64_t seed )
+        : s_()
+    {
+        for ( auto & word : s_ ) {
+            seed += 0x9e3779b97f4a7c15;
+            uint64_t z = seed;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+            word = z ^ (z >> 31);
+        }
+    }
+
+    static constexpr result_type min( void ) { return 0; }
+    static constexpr result_type max( void ) { return std::numeric_limits<result_type>::max(); }
+
+    result_type operator()( void )
+    {
+        const uint64_t result = rotl( s_[ 1 ] * 5, 7 ) * 9;
+        const uint64_t t = s_[ 1 ] << 17;
+
+        s_[ 2 ] ^= s_[ 0 ];
+        s_[ 3 ] ^= s_[ 1 ];
+        s_[ 1 ] ^= s_[ 2 ];
+        s_[ 0 ] ^= s_[ 3 ];
+        s_[ 2 ] ^= t;
+        s_[ 3 ] = rotl( s_[ 3 ], 45 );
+
+        return result;
+    }
+
+    /* an event of a given probability compares a draw of 53 bits with
+       this threshold, which is cheaper than drawing a double */
+    static uint64_t threshold( const double probability )
+    {
+        const uint64_t one = uint64_t( 1 ) << 53;
+
+        if ( probability <= 0 ) {
+            return 0;
+        } else if ( probability >= 1 ) {
+            return one;
+        }
+
+        return probability * one;
+    }
+
+    uint64_t draw53( void ) { return (*this)() >> 11; }
+
+    bool chance( const uint64_t threshold ) { return draw53() < threshold; }
+};
+
+#endif /* XOSHIRO_HH */